@@ -24,6 +24,7 @@
 #include "openslide-private.h"
 
 #include <glib.h>
+#include <string.h>
 
 #if defined(HAVE_UINTPTR_T) || defined(uintptr_t)
 #define ptr_int uintptr_t
@@ -33,6 +34,20 @@
 #define ptr_int uint64_t
 #endif
 
+// The cache is split into shards, each with its own lock, LRU lists, and
+// slice of the capacity.  Keys are distributed across shards by hash, so
+// concurrent readers only contend when they touch the same shard.
+#define CACHE_SHARDS 16  // power of two
+
+// Replacement is segmented LRU rather than pure LRU, so that a single
+// sequential sweep through a slide cannot evict the entire working set.
+// New entries start in a probationary segment and are only promoted to
+// the protected segment when they are hit again; eviction always prefers
+// the probationary tail.  The protected segment is bounded to this many
+// eighths of the shard capacity; beyond that, its tail is demoted back
+// to probation.
+#define CACHE_PROTECTED_EIGHTHS 6
+
 // hash table key
 struct _openslide_cache_key {
   void *plane;  // cookie for coordinate plane (level, grid, etc.)
@@ -43,8 +58,10 @@ struct _openslide_cache_key {
 // hash table value
 struct _openslide_cache_value {
   GList *link;            // direct pointer to the node in the list
+  GQueue *queue;          // which segment the link is on
   struct _openslide_cache_key *key; // for removing keys when aged out
-  struct _openslide_cache *cache; // sadly, for total_bytes and the list
+  struct cache_shard *shard; // sadly, for total_bytes and the lists
+  void *owner;            // inserting slide, for purging at close
 
   struct _openslide_cache_entry *entry;  // may outlive the value
 };
@@ -53,42 +70,92 @@ struct _openslide_cache_value {
 struct _openslide_cache_entry {
   gint refcount;  // atomic ops only
   void *data;
+  cairo_surface_t *surface;  // lazily created; atomic ops only
   int size;
 };
 
-struct _openslide_cache {
+struct cache_shard {
   GMutex *mutex;
-  GQueue *list;
+  GQueue *probation;
+  GQueue *protected;
   GHashTable *hashtable;
 
-  int capacity;
-  int total_size;
+  int64_t capacity;
+  int64_t total_size;
+  int64_t protected_size;
+
+  // counters, updated under the shard mutex
+  int64_t hits;
+  int64_t misses;
+  int64_t evictions;
+  int64_t puts;
+};
+
+struct _openslide_cache {
+  gint refcount;  // atomic ops only
+
+  struct cache_shard shards[CACHE_SHARDS];
+
+  // protects capacity; the per-shard slices are updated under the
+  // shard mutexes
+  GMutex *capacity_mutex;
+  int64_t capacity;
 
   gint warned_overlarge_entry;
 };
 
+// process-wide shared cache, created on demand when a capacity has been
+// configured with openslide_set_cache_size()
+static GStaticMutex shared_lock = G_STATIC_MUTEX_INIT;
+static struct _openslide_cache *shared_cache;
+static int64_t shared_capacity;
+
+// demotion
+// shard mutex must be held
+static void possibly_demote(struct cache_shard *shard) {
+  int64_t target = shard->capacity * CACHE_PROTECTED_EIGHTHS / 8;
+
+  while (shard->protected_size > target) {
+    // move the protected tail back to the head of probation; eviction
+    // takes the probation tail, so it gets another full pass through
+    // probation to earn a hit before it can be evicted
+    struct _openslide_cache_value *value = g_queue_peek_tail(shard->protected);
+    if (value == NULL) {
+      return;
+    }
+    g_queue_unlink(shard->protected, value->link);
+    g_queue_push_head_link(shard->probation, value->link);
+    value->queue = shard->probation;
+    shard->protected_size -= value->entry->size;
+  }
+}
+
 // eviction
-// mutex must be held
-static void possibly_evict(struct _openslide_cache *cache, int incoming_size) {
+// shard mutex must be held
+static void possibly_evict(struct cache_shard *shard, int incoming_size) {
   g_assert(incoming_size >= 0);
 
-  int size = cache->total_size + incoming_size;
-  int target = cache->capacity;
+  int64_t size = shard->total_size + incoming_size;
+  int64_t target = shard->capacity;
 
   while(size > target) {
-    // get key of last element
-    struct _openslide_cache_value *value = g_queue_peek_tail(cache->list);
+    // get key of last element, preferring the probationary segment
+    struct _openslide_cache_value *value = g_queue_peek_tail(shard->probation);
     if (value == NULL) {
-      return; // cache is empty
+      value = g_queue_peek_tail(shard->protected);
+    }
+    if (value == NULL) {
+      return; // shard is empty
     }
     struct _openslide_cache_key *key = value->key;
 
     //g_debug("EVICT: size: %d", value->entry->size);
 
     size -= value->entry->size;
+    shard->evictions++;
 
     // remove from hashtable, this will trigger removal from everything
-    bool result = g_hash_table_remove(cache->hashtable, key);
+    bool result = g_hash_table_remove(shard->hashtable, key);
     g_assert(result);
   }
 }
@@ -111,6 +178,14 @@ static gboolean key_equal_func(gconstpointer a,
   return (c_a->plane == c_b->plane) && (c_a->x == c_b->x) && (c_a->y == c_b->y);
 }
 
+// shard selection; mix the hash so the table and the shard index don't
+// use the same bits
+static struct cache_shard *get_shard(struct _openslide_cache *cache,
+                                     const struct _openslide_cache_key *key) {
+  guint hash = hash_func(key);
+  return &cache->shards[(hash ^ (hash >> 16)) % CACHE_SHARDS];
+}
+
 static void hash_destroy_key(gpointer data) {
   g_slice_free(struct _openslide_cache_key, data);
 }
@@ -118,12 +193,16 @@ static void hash_destroy_key(gpointer data) {
 static void hash_destroy_value(gpointer data) {
   struct _openslide_cache_value *value = data;
 
-  // remove the item from the list
-  g_queue_delete_link(value->cache->list, value->link);
+  // remove the item from its segment
+  g_queue_delete_link(value->queue, value->link);
 
-  // decrement the total size
-  value->cache->total_size -= value->entry->size;
-  g_assert(value->cache->total_size >= 0);
+  // decrement the sizes
+  value->shard->total_size -= value->entry->size;
+  g_assert(value->shard->total_size >= 0);
+  if (value->queue == value->shard->protected) {
+    value->shard->protected_size -= value->entry->size;
+    g_assert(value->shard->protected_size >= 0);
+  }
 
   // unref the entry
   _openslide_cache_entry_unref(value->entry);
@@ -132,59 +211,163 @@ static void hash_destroy_value(gpointer data) {
   g_slice_free(struct _openslide_cache_value, value);
 }
 
-struct _openslide_cache *_openslide_cache_create(int capacity_in_bytes) {
+struct _openslide_cache *_openslide_cache_create(int64_t capacity_in_bytes) {
   struct _openslide_cache *cache = g_slice_new0(struct _openslide_cache);
 
-  // init mutex
-  cache->mutex = g_mutex_new();
-
-  // init queue
-  cache->list = g_queue_new();
-
-  // init hashtable
-  cache->hashtable = g_hash_table_new_full(hash_func,
-					   key_equal_func,
-					   hash_destroy_key,
-					   hash_destroy_value);
+  // one ref for the caller
+  g_atomic_int_set(&cache->refcount, 1);
+
+  // init shards
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    shard->mutex = g_mutex_new();
+    shard->probation = g_queue_new();
+    shard->protected = g_queue_new();
+    shard->hashtable = g_hash_table_new_full(hash_func,
+					     key_equal_func,
+					     hash_destroy_key,
+					     hash_destroy_value);
+    shard->capacity = capacity_in_bytes / CACHE_SHARDS;
+  }
 
   // init byte_capacity
+  cache->capacity_mutex = g_mutex_new();
   cache->capacity = capacity_in_bytes;
 
   return cache;
 }
 
+struct _openslide_cache *_openslide_cache_ref(struct _openslide_cache *cache) {
+  g_atomic_int_inc(&cache->refcount);
+  return cache;
+}
+
 void _openslide_cache_destroy(struct _openslide_cache *cache) {
-  // clear hashtable (auto-deletes all data)
-  g_mutex_lock(cache->mutex);
-  g_hash_table_unref(cache->hashtable);
-  g_mutex_unlock(cache->mutex);
+  if (!g_atomic_int_dec_and_test(&cache->refcount)) {
+    // shared with other slides
+    return;
+  }
+
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    struct cache_shard *shard = &cache->shards[i];
 
-  // clear list
-  g_queue_free(cache->list);
+    // clear hashtable (auto-deletes all data)
+    g_mutex_lock(shard->mutex);
+    g_hash_table_unref(shard->hashtable);
+    g_mutex_unlock(shard->mutex);
 
-  // free mutex
-  g_mutex_free(cache->mutex);
+    // clear lists
+    g_queue_free(shard->probation);
+    g_queue_free(shard->protected);
+
+    // free mutex
+    g_mutex_free(shard->mutex);
+  }
+
+  g_mutex_free(cache->capacity_mutex);
 
   // destroy struct
   g_slice_free(struct _openslide_cache, cache);
 }
 
 
-int _openslide_cache_get_capacity(struct _openslide_cache *cache) {
-  g_mutex_lock(cache->mutex);
-  int capacity = cache->capacity;
-  g_mutex_unlock(cache->mutex);
+int64_t _openslide_cache_get_capacity(struct _openslide_cache *cache) {
+  g_mutex_lock(cache->capacity_mutex);
+  int64_t capacity = cache->capacity;
+  g_mutex_unlock(cache->capacity_mutex);
   return capacity;
 }
 
 void _openslide_cache_set_capacity(struct _openslide_cache *cache,
-				   int capacity_in_bytes) {
+				   int64_t capacity_in_bytes) {
   g_assert(capacity_in_bytes >= 0);
 
-  g_mutex_lock(cache->mutex);
+  g_mutex_lock(cache->capacity_mutex);
   cache->capacity = capacity_in_bytes;
-  possibly_evict(cache, 0);
-  g_mutex_unlock(cache->mutex);
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    g_mutex_lock(shard->mutex);
+    shard->capacity = capacity_in_bytes / CACHE_SHARDS;
+    possibly_demote(shard);
+    possibly_evict(shard, 0);
+    g_mutex_unlock(shard->mutex);
+  }
+  g_mutex_unlock(cache->capacity_mutex);
+}
+
+// returns a reference to the shared cache, or NULL if no capacity has
+// been configured and slides should use private caches
+struct _openslide_cache *_openslide_cache_shared_ref(void) {
+  struct _openslide_cache *cache = NULL;
+
+  g_static_mutex_lock(&shared_lock);
+  if (shared_capacity > 0) {
+    if (!shared_cache) {
+      shared_cache = _openslide_cache_create(shared_capacity);
+    }
+    cache = _openslide_cache_ref(shared_cache);
+  }
+  g_static_mutex_unlock(&shared_lock);
+
+  return cache;
+}
+
+void _openslide_cache_shared_set_capacity(int64_t capacity_in_bytes) {
+  g_static_mutex_lock(&shared_lock);
+  shared_capacity = MAX(capacity_in_bytes, 0);
+  if (shared_cache) {
+    if (shared_capacity > 0) {
+      _openslide_cache_set_capacity(shared_cache, shared_capacity);
+    } else {
+      // evict everything; slides still attached keep a valid, empty cache
+      _openslide_cache_set_capacity(shared_cache, 0);
+      _openslide_cache_destroy(shared_cache);
+      shared_cache = NULL;
+    }
+  }
+  g_static_mutex_unlock(&shared_lock);
+}
+
+void _openslide_cache_get_stats(struct _openslide_cache *cache,
+				struct _openslide_cache_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    g_mutex_lock(shard->mutex);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->evictions += shard->evictions;
+    stats->puts += shard->puts;
+    g_mutex_unlock(shard->mutex);
+  }
+}
+
+int64_t _openslide_cache_shared_get_capacity(void) {
+  g_static_mutex_lock(&shared_lock);
+  int64_t capacity = shared_capacity;
+  g_static_mutex_unlock(&shared_lock);
+  return capacity;
+}
+
+// cache bypass
+
+// Per-thread "don't pollute" hint for batch jobs that sweep a slide
+// once: lookups still see existing entries, but nothing the thread
+// decodes is inserted and hits are not promoted, so the sweep cannot
+// displace interactive working sets.
+static GStaticPrivate bypass_key = G_STATIC_PRIVATE_INIT;
+
+void openslide_set_cache_bypass(int bypass) {
+  g_static_private_set(&bypass_key, GINT_TO_POINTER(!!bypass), NULL);
+}
+
+static bool cache_bypassed(void) {
+  return GPOINTER_TO_INT(g_static_private_get(&bypass_key));
+}
+
+// for propagating the calling thread's hint to decode workers
+bool _openslide_cache_get_bypass(void) {
+  return cache_bypassed();
 }
 
 // put and get
@@ -192,35 +375,52 @@ void _openslide_cache_set_capacity(struct _openslide_cache *cache,
 // the cache retains one reference, and the caller gets another one.  the
 // entry must be unreffed when the caller is done with it.
 void _openslide_cache_put(struct _openslide_cache *cache,
+			  void *owner,
 			  void *plane,
 			  int64_t x,
 			  int64_t y,
 			  void *data,
 			  int size_in_bytes,
 			  struct _openslide_cache_entry **_entry) {
+  _OPENSLIDE_PROBE5(cache__put, cache, plane, x, y, size_in_bytes);
+
   // always create cache entry for caller's reference
   struct _openslide_cache_entry *entry =
       g_slice_new(struct _openslide_cache_entry);
   // one ref for the caller
   g_atomic_int_set(&entry->refcount, 1);
   entry->data = data;
+  entry->surface = NULL;
   entry->size = size_in_bytes;
   *_entry = entry;
 
-  // lock
-  g_mutex_lock(cache->mutex);
+  // don't insert on behalf of a thread that asked not to pollute
+  if (cache_bypassed()) {
+    return;
+  }
+
+  // find shard
+  struct _openslide_cache_key shard_key = { .plane = plane, .x = x, .y = y };
+  struct cache_shard *shard = get_shard(cache, &shard_key);
 
-  // don't try to put anything in the cache that cannot possibly fit
-  if (size_in_bytes > cache->capacity) {
+  // lock
+  g_mutex_lock(shard->mutex);
+
+  // Don't try to put anything in the cache that cannot possibly fit.
+  // Compare against the whole cache budget, not this shard's slice:
+  // entries larger than a slice (e.g. associated images) are still
+  // worth caching, so the owning shard transiently overshoots and is
+  // evicted back down by subsequent puts.
+  if (size_in_bytes > shard->capacity * CACHE_SHARDS) {
     //g_debug("refused %p", entry);
-    g_mutex_unlock(cache->mutex);
+    g_mutex_unlock(shard->mutex);
     _openslide_performance_warn_once(&cache->warned_overlarge_entry,
                                      "Rejecting overlarge cache entry of "
                                      "size %d bytes", size_in_bytes);
     return;
   }
 
-  possibly_evict(cache, size_in_bytes); // already checks for size >= 0
+  possibly_evict(shard, size_in_bytes); // already checks for size >= 0
 
   // create key
   struct _openslide_cache_key *key = g_slice_new(struct _openslide_cache_key);
@@ -232,24 +432,28 @@ void _openslide_cache_put(struct _openslide_cache *cache,
   struct _openslide_cache_value *value =
     g_slice_new(struct _openslide_cache_value);
   value->key = key;
-  value->cache = cache;
+  value->shard = shard;
+  value->owner = owner;
   value->entry = entry;
 
-  // insert at head of queue
-  g_queue_push_head(cache->list, value);
-  value->link = g_queue_peek_head_link(cache->list);
+  // insert at head of the probationary segment; a subsequent hit will
+  // promote it
+  g_queue_push_head(shard->probation, value);
+  value->link = g_queue_peek_head_link(shard->probation);
+  value->queue = shard->probation;
 
   // insert into hash table
-  g_hash_table_replace(cache->hashtable, key, value);
+  g_hash_table_replace(shard->hashtable, key, value);
 
   // increase size
-  cache->total_size += size_in_bytes;
+  shard->total_size += size_in_bytes;
+  shard->puts++;
 
   // another ref for the cache
   g_atomic_int_inc(&entry->refcount);
 
   // unlock
-  g_mutex_unlock(cache->mutex);
+  g_mutex_unlock(shard->mutex);
 
   //g_debug("insert %p", entry);
 }
@@ -260,25 +464,37 @@ void *_openslide_cache_get(struct _openslide_cache *cache,
 			   int64_t x,
 			   int64_t y,
 			   struct _openslide_cache_entry **_entry) {
-  // lock
-  g_mutex_lock(cache->mutex);
-
-  // create key
+  // create key and find shard
   struct _openslide_cache_key key = { .plane = plane, .x = x, .y = y };
+  struct cache_shard *shard = get_shard(cache, &key);
+
+  // lock
+  g_mutex_lock(shard->mutex);
 
   // lookup key, maybe return NULL
-  struct _openslide_cache_value *value = g_hash_table_lookup(cache->hashtable,
+  struct _openslide_cache_value *value = g_hash_table_lookup(shard->hashtable,
 							     &key);
   if (value == NULL) {
-    g_mutex_unlock(cache->mutex);
+    shard->misses++;
+    g_mutex_unlock(shard->mutex);
+    _OPENSLIDE_PROBE5(cache__get, cache, plane, x, y, 0);
     *_entry = NULL;
     return NULL;
   }
-
-  // if found, move to front of list
-  GList *link = value->link;
-  g_queue_unlink(cache->list, link);
-  g_queue_push_head_link(cache->list, link);
+  shard->hits++;
+
+  // if found, promote to the front of the protected segment; bypassing
+  // threads leave the segments untouched
+  if (!cache_bypassed()) {
+    GList *link = value->link;
+    g_queue_unlink(value->queue, link);
+    g_queue_push_head_link(shard->protected, link);
+    if (value->queue != shard->protected) {
+      value->queue = shard->protected;
+      shard->protected_size += value->entry->size;
+      possibly_demote(shard);
+    }
+  }
 
   // acquire entry reference for the caller
   struct _openslide_cache_entry *entry = value->entry;
@@ -287,20 +503,89 @@ void *_openslide_cache_get(struct _openslide_cache *cache,
   //g_debug("cache hit! %p %p %"PRId64" %"PRId64, (void *) entry, (void *) plane, x, y);
 
   // unlock
-  g_mutex_unlock(cache->mutex);
+  g_mutex_unlock(shard->mutex);
+
+  _OPENSLIDE_PROBE5(cache__get, cache, plane, x, y, 1);
 
   // return data
   *_entry = entry;
   return entry->data;
 }
 
+static gboolean value_has_owner(gpointer key G_GNUC_UNUSED,
+                                gpointer data,
+                                gpointer owner) {
+  struct _openslide_cache_value *value = data;
+  return value->owner == owner;
+}
+
+// Remove every entry the owner inserted.  Planes are per-slide heap
+// pointers, so entries must not outlive their slide: once its structs
+// are freed, the allocator can recycle those addresses for another
+// slide, which would then be handed stale pixels as valid hits from a
+// shared cache.
+void _openslide_cache_purge_owner(struct _openslide_cache *cache,
+                                  void *owner) {
+  for (int i = 0; i < CACHE_SHARDS; i++) {
+    struct cache_shard *shard = &cache->shards[i];
+    g_mutex_lock(shard->mutex);
+    g_hash_table_foreach_remove(shard->hashtable, value_has_owner, owner);
+    g_mutex_unlock(shard->mutex);
+  }
+}
+
+// read-only residency probe: no reference is taken, no hit is counted,
+// and the replacement state is left untouched
+bool _openslide_cache_contains(struct _openslide_cache *cache,
+                               void *plane,
+                               int64_t x,
+                               int64_t y) {
+  struct _openslide_cache_key key = { .plane = plane, .x = x, .y = y };
+  struct cache_shard *shard = get_shard(cache, &key);
+
+  g_mutex_lock(shard->mutex);
+  bool found = g_hash_table_lookup(shard->hashtable, &key) != NULL;
+  g_mutex_unlock(shard->mutex);
+
+  return found;
+}
+
+int _openslide_cache_entry_size(struct _openslide_cache_entry *entry) {
+  return entry->size;
+}
+
+cairo_surface_t *_openslide_cache_entry_surface(struct _openslide_cache_entry *entry,
+                                                cairo_format_t format,
+                                                int64_t w,
+                                                int64_t h) {
+  cairo_surface_t *surface = g_atomic_pointer_get(&entry->surface);
+  if (surface) {
+    return surface;
+  }
+
+  surface = cairo_image_surface_create_for_data((unsigned char *) entry->data,
+                                                format, w, h, w * 4);
+  if (!g_atomic_pointer_compare_and_exchange((gpointer *) &entry->surface,
+                                             NULL, surface)) {
+    // lost a race with another paint thread; use the winner's surface
+    cairo_surface_destroy(surface);
+    surface = g_atomic_pointer_get(&entry->surface);
+  }
+  return surface;
+}
+
 // value unref
 void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry) {
   //g_debug("unref %p, refs %d", entry, g_atomic_int_get(&entry->refcount));
 
   if (g_atomic_int_dec_and_test(&entry->refcount)) {
-    // free the data
-    g_slice_free1(entry->size, entry->data);
+    // release the surface before the data it wraps
+    if (entry->surface) {
+      cairo_surface_destroy(entry->surface);
+    }
+
+    // recycle the data
+    _openslide_tile_free(entry->size, entry->data);
 
     // free the entry
     g_slice_free(struct _openslide_cache_entry, entry);
@@ -308,3 +593,127 @@ void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry) {
     //g_debug("free %p", entry);
   }
 }
+
+// Pool of tile-sized buffers.  Decoded ARGB tiles are all the same few
+// sizes per slide, and at high tile rates the allocator would otherwise
+// do one large alloc/free pair per tile; instead, buffers released by
+// cache eviction are recycled into new decodes.  The pool is a layer
+// over g_slice with identical semantics, so pooled and unpooled buffers
+// of the same size are interchangeable.
+
+// don't pool buffers small enough for g_slice's own magazines
+#define TILE_POOL_MIN_SIZE (64 << 10)
+// bound on retained buffers of each size
+#define TILE_POOL_MAX_PER_SIZE 32
+
+static GStaticMutex tile_pool_lock = G_STATIC_MUTEX_INIT;
+static GHashTable *tile_pool;  // size -> GQueue of buffers
+
+// Each thread also keeps a small private magazine in front of the shared
+// pool, so a buffer is preferentially reused by the thread that last
+// released it.  This skips the pool lock on the hot path, and on NUMA
+// machines it keeps a decode thread writing into pages it first touched
+// on its own node instead of buffers another node's threads populated.
+#define TILE_MAGAZINE_MAX_PER_SIZE 4
+
+static GStaticPrivate tile_magazine_key = G_STATIC_PRIVATE_INIT;
+
+static void tile_magazine_drain(void *key, void *value,
+                                void *data G_GNUC_UNUSED) {
+  gsize size = GPOINTER_TO_SIZE(key);
+  GQueue *queue = value;
+  void *buf;
+  while ((buf = g_queue_pop_head(queue))) {
+    g_slice_free1(size, buf);
+  }
+  g_queue_free(queue);
+}
+
+// thread exit
+static void tile_magazine_destroy(void *data) {
+  GHashTable *magazine = data;
+  g_hash_table_foreach(magazine, tile_magazine_drain, NULL);
+  g_hash_table_destroy(magazine);
+}
+
+void *_openslide_tile_alloc(int64_t size) {
+  void *buf = NULL;
+  if (size >= TILE_POOL_MIN_SIZE) {
+    // thread-private magazine first
+    GHashTable *magazine = g_static_private_get(&tile_magazine_key);
+    if (magazine) {
+      GQueue *queue = g_hash_table_lookup(magazine,
+                                          GSIZE_TO_POINTER((gsize) size));
+      if (queue) {
+        buf = g_queue_pop_head(queue);
+      }
+    }
+
+    // then the shared pool
+    if (!buf) {
+      g_static_mutex_lock(&tile_pool_lock);
+      if (tile_pool) {
+        GQueue *queue = g_hash_table_lookup(tile_pool,
+                                            GSIZE_TO_POINTER((gsize) size));
+        if (queue) {
+          buf = g_queue_pop_head(queue);
+        }
+      }
+      g_static_mutex_unlock(&tile_pool_lock);
+    }
+  }
+  if (!buf) {
+    buf = g_slice_alloc(size);
+  }
+  return buf;
+}
+
+void *_openslide_tile_alloc0(int64_t size) {
+  // recycled buffers contain stale pixels
+  void *buf = _openslide_tile_alloc(size);
+  memset(buf, 0, size);
+  return buf;
+}
+
+void _openslide_tile_free(int64_t size, void *buf) {
+  if (size >= TILE_POOL_MIN_SIZE) {
+    // thread-private magazine first
+    GHashTable *magazine = g_static_private_get(&tile_magazine_key);
+    if (!magazine) {
+      magazine = g_hash_table_new(g_direct_hash, g_direct_equal);
+      g_static_private_set(&tile_magazine_key, magazine,
+                           tile_magazine_destroy);
+    }
+    GQueue *mag_queue = g_hash_table_lookup(magazine,
+                                            GSIZE_TO_POINTER((gsize) size));
+    if (!mag_queue) {
+      mag_queue = g_queue_new();
+      g_hash_table_insert(magazine, GSIZE_TO_POINTER((gsize) size),
+                          mag_queue);
+    }
+    if (g_queue_get_length(mag_queue) < TILE_MAGAZINE_MAX_PER_SIZE) {
+      g_queue_push_head(mag_queue, buf);
+      return;
+    }
+
+    // magazine full; overflow to the shared pool
+    g_static_mutex_lock(&tile_pool_lock);
+    if (!tile_pool) {
+      tile_pool = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    GQueue *queue = g_hash_table_lookup(tile_pool,
+                                        GSIZE_TO_POINTER((gsize) size));
+    if (!queue) {
+      queue = g_queue_new();
+      g_hash_table_insert(tile_pool, GSIZE_TO_POINTER((gsize) size), queue);
+    }
+    if (g_queue_get_length(queue) < TILE_POOL_MAX_PER_SIZE) {
+      g_queue_push_head(queue, buf);
+      buf = NULL;
+    }
+    g_static_mutex_unlock(&tile_pool_lock);
+  }
+  if (buf) {
+    g_slice_free1(size, buf);
+  }
+}
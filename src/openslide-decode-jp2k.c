@@ -35,6 +35,28 @@ struct buffer_state {
   int32_t length;
 };
 
+// number of OpenJPEG worker threads per tile.  Tiles of a region are
+// already decoded concurrently by the library's decode pool, so the
+// default is single-threaded; raise this for latency-sensitive callers
+// that read one tile at a time
+static const char THREADS_ENV_VAR[] = "OPENSLIDE_JP2K_THREADS";
+
+#if defined(HAVE_OPENJPEG2) && defined(HAVE_OPJ_CODEC_SET_THREADS)
+static int get_decode_threads(void) {
+  static gsize threads;
+  if (g_once_init_enter(&threads)) {
+    int value = 1;
+    const char *env = g_getenv(THREADS_ENV_VAR);
+    if (env) {
+      value = (int) g_ascii_strtoll(env, NULL, 10);
+      value = CLAMP(value, 1, _openslide_num_processors());
+    }
+    g_once_init_leave(&threads, value);
+  }
+  return threads;
+}
+#endif
+
 static inline void write_pixel_ycbcr(uint32_t *dest, uint8_t Y,
                                      int16_t R_chroma, int16_t G_chroma,
                                      int16_t B_chroma) {
@@ -72,30 +94,11 @@ static void unpack_argb(enum _openslide_jp2k_colorspace space,
       c0_sub_y == 1 && c1_sub_y == 1 && c2_sub_y == 1) {
     // Aperio 33003
     for (int32_t y = 0; y < h; y++) {
-      int32_t c0_row_base = y * comps[0].w;
-      int32_t c1_row_base = y * comps[1].w;
-      int32_t c2_row_base = y * comps[2].w;
-      int32_t x;
-      for (x = 0; x < w - 1; x += 2) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + (x / 2)];
-        uint8_t c2 = comps[2].data[c2_row_base + (x / 2)];
-        int16_t R_chroma = _openslide_R_Cr[c2];
-        int16_t G_chroma = (_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16;
-        int16_t B_chroma = _openslide_B_Cb[c1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
-        c0 = comps[0].data[c0_row_base + x + 1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
-      }
-      if (x < w) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + (x / 2)];
-        uint8_t c2 = comps[2].data[c2_row_base + (x / 2)];
-        int16_t R_chroma = _openslide_R_Cr[c2];
-        int16_t G_chroma = (_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16;
-        int16_t B_chroma = _openslide_B_Cb[c1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
-      }
+      _openslide_ycbcr422_to_argb(comps[0].data + y * comps[0].w,
+                                  comps[1].data + y * comps[1].w,
+                                  comps[2].data + y * comps[2].w,
+                                  dest, w);
+      dest += w;
     }
 
   } else if (space == OPENSLIDE_JP2K_YCBCR) {
@@ -220,6 +223,7 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
                                    int32_t w, int32_t h,
                                    void *data, int32_t datalen,
                                    enum _openslide_jp2k_colorspace space,
+                                   int32_t reduce,
                                    GError **err) {
   opj_image_t *image = NULL;
   GError *tmp_err = NULL;
@@ -227,6 +231,7 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
 
   g_assert(data != NULL);
   g_assert(datalen >= 0);
+  g_assert(reduce >= 0);
 
   // init stream
   // avoid tracking stream offset (and implementing skip callback) by having
@@ -246,8 +251,17 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   opj_codec_t *codec = opj_create_decompress(OPJ_CODEC_J2K);
   opj_dparameters_t parameters;
   opj_set_default_decoder_parameters(&parameters);
+  parameters.cp_reduce = reduce;
   opj_setup_decoder(codec, &parameters);
 
+#ifdef HAVE_OPJ_CODEC_SET_THREADS
+  // parallelize the wavelet transform stages within the tile
+  int threads = get_decode_threads();
+  if (threads > 1) {
+    opj_codec_set_threads(codec, threads);
+  }
+#endif
+
   // enable error handlers
   // note: don't use info_handler, it outputs lots of junk
   opj_set_warning_handler(codec, warning_callback, &tmp_err);
@@ -293,7 +307,9 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   g_clear_error(&tmp_err);  // clear any spurious message
 
   // copy pixels
-  unpack_argb(space, image->comps, dest, w, h);
+  unpack_argb(space, image->comps, dest,
+              _OPENSLIDE_JP2K_REDUCED_DIM(w, reduce),
+              _OPENSLIDE_JP2K_REDUCED_DIM(h, reduce));
 
   success = true;
 
@@ -310,12 +326,14 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
                                    int32_t w, int32_t h,
                                    void *data, int32_t datalen,
                                    enum _openslide_jp2k_colorspace space,
+                                   int32_t reduce,
                                    GError **err) {
   GError *tmp_err = NULL;
   bool success = false;
 
   // opj_cio_open interprets a NULL buffer as opening for write
   g_assert(data != NULL);
+  g_assert(reduce >= 0);
 
   // init decompressor
   opj_cio_t *stream = NULL;
@@ -331,6 +349,7 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   opj_dparameters_t parameters;
   dinfo = opj_create_decompress(CODEC_J2K);
   opj_set_default_decoder_parameters(&parameters);
+  parameters.cp_reduce = reduce;
   opj_setup_decoder(dinfo, &parameters);
   stream = opj_cio_open((opj_common_ptr) dinfo, data, datalen);
   opj_set_event_mgr((opj_common_ptr) dinfo, &event_callbacks, &tmp_err);
@@ -381,7 +400,9 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
 
   // TODO more checks?
 
-  unpack_argb(space, image->comps, dest, w, h);
+  unpack_argb(space, image->comps, dest,
+              _OPENSLIDE_JP2K_REDUCED_DIM(w, reduce),
+              _OPENSLIDE_JP2K_REDUCED_DIM(h, reduce));
 
   success = true;
 
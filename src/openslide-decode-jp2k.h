@@ -32,10 +32,20 @@ enum _openslide_jp2k_colorspace {
   OPENSLIDE_JP2K_YCBCR,
 };
 
+// number of pixels across a reduced decode, for a full-resolution
+// dimension of d
+#define _OPENSLIDE_JP2K_REDUCED_DIM(d, reduce) \
+  ((((d) - 1) >> (reduce)) + 1)
+
+// w and h are the full-resolution codestream dimensions.  reduce discards
+// that many of the highest-resolution wavelet levels; dest receives
+// _OPENSLIDE_JP2K_REDUCED_DIM(w, reduce) x _OPENSLIDE_JP2K_REDUCED_DIM(h,
+// reduce) pixels.  Fails if the codestream has too few resolution levels.
 bool _openslide_jp2k_decode_buffer(uint32_t *dest,
                                    int32_t w, int32_t h,
                                    void *data, int32_t datalen,
                                    enum _openslide_jp2k_colorspace space,
+                                   int32_t reduce,
                                    GError **err);
 
 #endif
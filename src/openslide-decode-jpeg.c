@@ -66,10 +66,21 @@ struct openslide_jpeg_error_mgr {
 struct _openslide_jpeg_decompress {
   struct jpeg_decompress_struct cinfo;
   struct openslide_jpeg_error_mgr jerr;
-  JSAMPROW rows[MAX_SAMP_FACTOR];
+  JSAMPROW rows[MAX_SAMP_FACTOR];  // scanline buffers, owned by us
   gsize allocated_row_size;
+  bool created;  // jpeg_create_decompress() has run
 };
 
+// Each thread caches one initialized decompress struct between decodes,
+// so the steady-state tile decode avoids the create/destroy cycle and
+// the row buffer allocations.  The source manager inside the object is
+// allocated from the permanent libjpeg pool and is reused as well.
+struct decompress_slot {
+  struct _openslide_jpeg_decompress *dc;
+};
+
+static GStaticPrivate cached_decompress = G_STATIC_PRIVATE_INIT;
+
 struct associated_image {
   struct _openslide_associated_image base;
   char *filename;
@@ -153,10 +164,45 @@ static void *detect_jcs_alpha_extensions(void *arg G_GNUC_UNUSED) {
   return GINT_TO_POINTER(alpha_extensions);
 }
 
+static void decompress_free(struct _openslide_jpeg_decompress *dc) {
+  if (dc->created) {
+    jpeg_destroy_decompress(&dc->cinfo);
+  }
+  if (dc->allocated_row_size) {
+    for (uint32_t row = 0; row < G_N_ELEMENTS(dc->rows); row++) {
+      g_slice_free1(dc->allocated_row_size, dc->rows[row]);
+    }
+  }
+  g_slice_free(struct _openslide_jpeg_decompress, dc);
+}
+
+static void decompress_slot_free(gpointer data) {
+  struct decompress_slot *slot = data;
+  if (slot->dc) {
+    decompress_free(slot->dc);
+  }
+  g_slice_free(struct decompress_slot, slot);
+}
+
+static struct decompress_slot *decompress_slot_get(void) {
+  struct decompress_slot *slot = g_static_private_get(&cached_decompress);
+  if (!slot) {
+    slot = g_slice_new0(struct decompress_slot);
+    g_static_private_set(&cached_decompress, slot, decompress_slot_free);
+  }
+  return slot;
+}
+
 // the caller must assign the struct _openslide_jpeg_decompress * before
 // calling setjmp() so that nothing will be clobbered by a longjmp()
 struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_create(struct jpeg_decompress_struct **out_cinfo) {
-  struct _openslide_jpeg_decompress *dc = g_slice_new0(struct _openslide_jpeg_decompress);
+  struct decompress_slot *slot = decompress_slot_get();
+  struct _openslide_jpeg_decompress *dc = slot->dc;
+  if (dc) {
+    slot->dc = NULL;
+  } else {
+    dc = g_slice_new0(struct _openslide_jpeg_decompress);
+  }
   *out_cinfo = &dc->cinfo;
   return dc;
 }
@@ -165,7 +211,12 @@ struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_create(struct jpeg
 void _openslide_jpeg_decompress_init(struct _openslide_jpeg_decompress *dc,
                                      jmp_buf *env) {
   dc->cinfo.err = error_handler_init(&dc->jerr, env);
-  jpeg_create_decompress(&dc->cinfo);
+  if (!dc->created) {
+    // set the flag first; jpeg_abort()/jpeg_destroy() are documented to
+    // cope with a partially-constructed object if create longjmps
+    dc->created = true;
+    jpeg_create_decompress(&dc->cinfo);
+  }
 }
 
 bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
@@ -198,24 +249,22 @@ bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
     return false;
   }
 
-  // verify we haven't run already
-  g_assert(dc->rows[0] == NULL);
-
   if (cinfo->out_color_space != JCS_RGB) {
     // decode directly to output
 
+    JSAMPROW rows[MAX_SAMP_FACTOR];
     uint8_t *dest = _dest;
     int bytes_per_pixel = cinfo->output_components == 1 ? 1 : 4;
     while (cinfo->output_scanline < cinfo->output_height) {
       // set row pointers
       for (int32_t i = 0; i < cinfo->rec_outbuf_height; i++) {
-        dc->rows[i] = cinfo->output_scanline + i < cinfo->output_height ?
-                      dest + i * cinfo->output_width * bytes_per_pixel : NULL;
+        rows[i] = cinfo->output_scanline + i < cinfo->output_height ?
+                  dest + i * cinfo->output_width * bytes_per_pixel : NULL;
       }
 
       // decompress
       JDIMENSION rows_read = jpeg_read_scanlines(cinfo,
-                                                 dc->rows,
+                                                 rows,
                                                  cinfo->rec_outbuf_height);
       dest += rows_read * cinfo->output_width * bytes_per_pixel;
     }
@@ -223,11 +272,18 @@ bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
   } else {
     // decode into temporary buffer, then reformat
 
-    // allocate scanline buffers
-    dc->allocated_row_size = sizeof(JSAMPLE) * cinfo->output_width *
-                             cinfo->output_components;
-    for (int i = 0; i < cinfo->rec_outbuf_height; i++) {
-      dc->rows[i] = g_slice_alloc(dc->allocated_row_size);
+    // allocate scanline buffers, reusing those cached from a previous
+    // decode when the geometry matches
+    gsize row_size = sizeof(JSAMPLE) * cinfo->output_width *
+                     cinfo->output_components;
+    if (dc->allocated_row_size != row_size) {
+      for (uint32_t i = 0; i < G_N_ELEMENTS(dc->rows); i++) {
+        if (dc->allocated_row_size) {
+          g_slice_free1(dc->allocated_row_size, dc->rows[i]);
+        }
+        dc->rows[i] = g_slice_alloc(row_size);
+      }
+      dc->allocated_row_size = row_size;
     }
 
     // decompress
@@ -263,14 +319,16 @@ void _openslide_jpeg_propagate_error(GError **err,
 }
 
 void _openslide_jpeg_decompress_destroy(struct _openslide_jpeg_decompress *dc) {
-  jpeg_destroy_decompress(&dc->cinfo);
   g_assert(dc->jerr.err == NULL);
-  if (dc->allocated_row_size) {
-    for (uint32_t row = 0; row < G_N_ELEMENTS(dc->rows); row++) {
-      g_slice_free1(dc->allocated_row_size, dc->rows[row]);
-    }
+  struct decompress_slot *slot = decompress_slot_get();
+  if (!slot->dc && dc->created) {
+    // discard per-image state but keep the initialized object and row
+    // buffers for the next decode on this thread
+    jpeg_abort_decompress(&dc->cinfo);
+    slot->dc = dc;
+  } else {
+    decompress_free(dc);
   }
-  g_slice_free(struct _openslide_jpeg_decompress, dc);
 }
 
 static bool jpeg_get_dimensions(FILE *f,  // or:
@@ -320,6 +378,26 @@ bool _openslide_jpeg_read_dimensions(const char *filename,
                                      int64_t offset,
                                      int32_t *w, int32_t *h,
                                      GError **err) {
+  // map the file and parse a single contiguous span, avoiding the
+  // stdio source's per-4K refill copies
+  GMappedFile *mapped = g_mapped_file_new(filename, false, NULL);
+  if (mapped) {
+    gsize len = g_mapped_file_get_length(mapped);
+    bool success = false;
+    if (offset >= 0 && (gsize) offset < len) {
+      const char *buf = g_mapped_file_get_contents(mapped) + offset;
+      success = jpeg_get_dimensions(NULL, buf,
+                                    MIN(len - offset, (gsize) G_MAXUINT32),
+                                    w, h, err);
+    } else {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Cannot seek to offset");
+    }
+    g_mapped_file_unref(mapped);
+    return success;
+  }
+
+  // couldn't map (e.g. 32-bit address space); stream through stdio
   FILE *f = _openslide_fopen(filename, "rb", err);
   if (f == NULL) {
     return false;
@@ -394,6 +472,26 @@ bool _openslide_jpeg_read(const char *filename,
                           GError **err) {
   //g_debug("read JPEG: %s %"PRId64, filename, offset);
 
+  // map the file and decode a single contiguous span, avoiding the
+  // stdio source's per-4K refill copies
+  GMappedFile *mapped = g_mapped_file_new(filename, false, NULL);
+  if (mapped) {
+    gsize len = g_mapped_file_get_length(mapped);
+    bool success = false;
+    if (offset >= 0 && (gsize) offset < len) {
+      const char *buf = g_mapped_file_get_contents(mapped) + offset;
+      success = jpeg_decode(NULL, buf,
+                            MIN(len - offset, (gsize) G_MAXUINT32),
+                            dest, false, w, h, err);
+    } else {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Cannot seek to offset");
+    }
+    g_mapped_file_unref(mapped);
+    return success;
+  }
+
+  // couldn't map (e.g. 32-bit address space); stream through stdio
   FILE *f = _openslide_fopen(filename, "rb", err);
   if (f == NULL) {
     return false;
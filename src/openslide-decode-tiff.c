@@ -38,11 +38,30 @@
 
 #define HANDLE_CACHE_MAX 32
 
+// pool tuning for many-threaded readers: cap on pooled handles per slide,
+// and the number of handles opened eagerly at open time
+static const char HANDLE_CACHE_MAX_ENV_VAR[] = "OPENSLIDE_TIFF_HANDLES";
+static const char HANDLE_PREWARM_ENV_VAR[] = "OPENSLIDE_TIFF_PREWARM";
+
+// readahead tuning: merge raw tile extents separated by gaps up to
+// READAHEAD_MAX_GAP, read at most READAHEAD_MAX_BYTES per region in
+// READAHEAD_CHUNK pieces
+#define READAHEAD_MAX_GAP (64 << 10)
+#define READAHEAD_MAX_BYTES ((uint64_t) 32 << 20)
+#define READAHEAD_CHUNK ((size_t) 1 << 20)
+
+struct tile_extent {
+  uint64_t offset;
+  uint64_t length;
+};
+
 struct _openslide_tiffcache {
   char *filename;
   GQueue *cache;
   GMutex *lock;
+  int max_handles;
   int outstanding;
+  void *budget_pool;  // process-wide idle handle accounting
 };
 
 // not thread-safe, like libtiff
@@ -193,10 +212,7 @@ static bool tiff_read_region(TIFF *tiff,
   // draw it
   if (TIFFRGBAImageGet(&img, dest, w, h)) {
     // convert ABGR -> ARGB
-    for (uint32_t *p = dest; p < dest + w * h; p++) {
-      uint32_t val = GUINT32_SWAP_LE_BE(*p);
-      *p = (val << 24) | (val >> 8);
-    }
+    _openslide_abgr_to_argb(dest, (int64_t) w * h);
     success = true;
   } else {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -264,7 +280,8 @@ DONE:
   return result;
 }
 
-bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
+bool _openslide_tiff_read_tile(openslide_t *osr,
+                               struct _openslide_tiff_level *tiffl,
                                TIFF *tiff,
                                uint32_t *dest,
                                int64_t tile_col, int64_t tile_row,
@@ -272,6 +289,8 @@ bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
   // set directory
   SET_DIR_OR_FAIL(tiff, tiffl->dir);
 
+  int64_t start = _openslide_now_usec();
+
   if (tiffl->tile_read_direct) {
     // Fast path: read raw data, decode through libjpeg
     // Reading through tiff_read_region() reformats pixel data in three
@@ -289,10 +308,33 @@ bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
       tables_len = 0;
     }
 
+    // check the compressed tier of the cache; compressed tiles are an
+    // order of magnitude smaller than decoded ones, so many more survive
+    // eviction, and a hit here skips the I/O entirely.  keyed on the
+    // tiff level struct, which is distinct from the vendor's level
+    // pointer used for decoded tiles
+    void *buf = NULL;
+    int32_t buflen = 0;
+    struct _openslide_cache_entry *raw_entry = NULL;
+    if (osr) {
+      buf = _openslide_cache_get(osr->cache, tiffl, tile_col, tile_row,
+                                 &raw_entry);
+      if (buf) {
+        buflen = _openslide_cache_entry_size(raw_entry);
+      }
+    }
+
+    // then the persistent cache, if one is configured
+    bool from_disk = false;
+    if (!buf && osr && osr->diskcache) {
+      buf = _openslide_diskcache_get(osr->diskcache, tiffl->dir,
+                                     tile_col, tile_row, &buflen);
+      from_disk = (buf != NULL);
+    }
+
     // read data
-    void *buf;
-    int32_t buflen;
-    if (!_openslide_tiff_read_tile_data(tiffl, tiff,
+    if (!buf &&
+        !_openslide_tiff_read_tile_data(tiffl, tiff,
                                         &buf, &buflen,
                                         tile_col, tile_row,
                                         err)) {
@@ -305,16 +347,43 @@ bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
                            dest,
                            tiffl->tile_w, tiffl->tile_h,
                            err);
-    g_free(buf);
+    if (raw_entry) {
+      _openslide_cache_entry_unref(raw_entry);
+    } else {
+      if (ret && osr) {
+        // save the compressed bytes for the next decoded-tier miss
+        void *copy = g_slice_copy(buflen, buf);
+        _openslide_cache_put(osr->cache, osr, tiffl, tile_col, tile_row,
+                             copy, buflen, &raw_entry);
+        _openslide_cache_entry_unref(raw_entry);
+        if (osr->diskcache && !from_disk) {
+          _openslide_diskcache_put(osr->diskcache, tiffl->dir,
+                                   tile_col, tile_row, buf, buflen);
+        }
+      }
+      g_free(buf);
+    }
+    if (ret) {
+      _openslide_stats_record_decode(osr, _OPENSLIDE_CODEC_JPEG, buflen,
+                                     _openslide_now_usec() - start);
+    }
     return ret;
   } else {
     // Fallback: read tile through libtiff
     _openslide_performance_warn_once(&tiffl->warned_read_indirect,
                                      "Using slow libtiff read path for "
                                      "directory %d", tiffl->dir);
-    return tiff_read_region(tiff, dest,
-                            tile_col * tiffl->tile_w, tile_row * tiffl->tile_h,
-                            tiffl->tile_w, tiffl->tile_h, err);
+    bool ret = tiff_read_region(tiff, dest,
+                                tile_col * tiffl->tile_w,
+                                tile_row * tiffl->tile_h,
+                                tiffl->tile_w, tiffl->tile_h, err);
+    if (ret) {
+      // compressed size isn't visible on this path; count the tile and
+      // its decode time
+      _openslide_stats_record_decode(osr, _OPENSLIDE_CODEC_TIFF, 0,
+                                     _openslide_now_usec() - start);
+    }
+    return ret;
   }
 }
 
@@ -359,6 +428,176 @@ bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
   return true;
 }
 
+static int tile_extent_compare(gconstpointer a, gconstpointer b) {
+  const struct tile_extent *ea = a;
+  const struct tile_extent *eb = b;
+
+  if (ea->offset < eb->offset) {
+    return -1;
+  } else if (ea->offset > eb->offset) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+// Warm the page cache with the raw data for a rectangle of tiles before
+// the per-tile decode loop runs.  The tile extents are sorted and
+// coalesced so that a region covering many tiles costs a few large
+// sequential reads rather than one synchronous round trip per tile,
+// which matters on network filesystems.  Purely advisory: all failures
+// are ignored and the decode path proceeds as before.
+void _openslide_tiff_readahead(openslide_t *osr,
+                               struct _openslide_level *level,
+                               struct _openslide_tiff_level *tiffl,
+                               TIFF *tiff,
+                               int64_t start_col, int64_t start_row,
+                               int64_t end_col, int64_t end_row) {
+  // set directory
+  if (!_openslide_tiff_set_dir(tiff, tiffl->dir, NULL)) {
+    return;
+  }
+
+  // clamp to the level
+  start_col = MAX(start_col, 0);
+  start_row = MAX(start_row, 0);
+  end_col = MIN(end_col, tiffl->tiles_across - 1);
+  end_row = MIN(end_row, tiffl->tiles_down - 1);
+  if (end_col < start_col || end_row < start_row ||
+      (end_col - start_col + 1) * (end_row - start_row + 1) < 2) {
+    // nothing to batch
+    return;
+  }
+
+  // get offset/length arrays
+  toff_t *offsets;
+  toff_t *lengths;
+  if (!TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets) ||
+      !TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &lengths)) {
+    return;
+  }
+
+  // collect extents for tiles we will actually have to decode
+  GArray *extents = g_array_new(false, false, sizeof(struct tile_extent));
+  for (int64_t row = start_row; row <= end_row; row++) {
+    for (int64_t col = start_col; col <= end_col; col++) {
+      // skip tiles already decoded into the cache
+      struct _openslide_cache_entry *cache_entry;
+      if (_openslide_cache_get(osr->cache, level, col, row, &cache_entry)) {
+        _openslide_cache_entry_unref(cache_entry);
+        continue;
+      }
+
+      ttile_t tile_no = TIFFComputeTile(tiff,
+                                        col * tiffl->tile_w,
+                                        row * tiffl->tile_h,
+                                        0, 0);
+      if (!lengths[tile_no]) {
+        // missing tile
+        continue;
+      }
+      struct tile_extent ext = {
+        .offset = offsets[tile_no],
+        .length = lengths[tile_no],
+      };
+      g_array_append_val(extents, ext);
+    }
+  }
+  if (!extents->len) {
+    g_array_free(extents, true);
+    return;
+  }
+  g_array_sort(extents, tile_extent_compare);
+
+  // open our own handle; the TIFF's I/O callbacks are not reentrant
+  struct tiff_file_handle *hdl = TIFFClientdata(tiff);
+  FILE *f = _openslide_fopen(hdl->tc->filename, "rb", NULL);
+  if (f == NULL) {
+    g_array_free(extents, true);
+    return;
+  }
+  _openslide_fadvise_sequential(f);
+
+  // issue coalesced reads
+  void *scratch = g_malloc(READAHEAD_CHUNK);
+  uint64_t total = 0;
+  uint32_t i = 0;
+  while (i < extents->len && total < READAHEAD_MAX_BYTES) {
+    struct tile_extent *ext = &g_array_index(extents, struct tile_extent, i);
+    uint64_t start = ext->offset;
+    uint64_t end = ext->offset + ext->length;
+    // merge extents separated by small gaps
+    while (++i < extents->len) {
+      ext = &g_array_index(extents, struct tile_extent, i);
+      if (ext->offset > end + READAHEAD_MAX_GAP) {
+        break;
+      }
+      end = MAX(end, ext->offset + ext->length);
+    }
+
+    if (fseeko(f, start, SEEK_SET)) {
+      break;
+    }
+    bool ok = true;
+    while (start < end && total < READAHEAD_MAX_BYTES) {
+      size_t count = MIN(end - start, READAHEAD_CHUNK);
+      if (fread(scratch, 1, count, f) != count) {
+        ok = false;
+        break;
+      }
+      start += count;
+      total += count;
+    }
+    if (!ok) {
+      break;
+    }
+  }
+
+  g_free(scratch);
+  fclose(f);
+  g_array_free(extents, true);
+}
+
+// build a bitmap of zero-length tiles from the bytecount array, so that
+// _openslide_tiff_check_missing_tile() becomes a bit probe rather than a
+// TIFFGetField call per tile visit
+bool _openslide_tiff_init_missing_tilemap(struct _openslide_tiff_level *tiffl,
+                                          TIFF *tiff,
+                                          GError **err) {
+  // set directory
+  if (!_openslide_tiff_set_dir(tiff, tiffl->dir, err)) {
+    return false;
+  }
+
+  // get tile sizes
+  toff_t *sizes;
+  if (!TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot get tile size");
+    return false;
+  }
+
+  // tile numbering for sample 0 is row-major, matching TIFFComputeTile()
+  int64_t count = tiffl->tiles_across * tiffl->tiles_down;
+  uint32_t *bitmap = g_new0(uint32_t, (count + 31) / 32);
+  bool any_missing = false;
+  for (int64_t tile_no = 0; tile_no < count; tile_no++) {
+    if (sizes[tile_no] == 0) {
+      bitmap[tile_no / 32] |= 1U << (tile_no % 32);
+      any_missing = true;
+    }
+  }
+
+  if (any_missing) {
+    tiffl->missing_tiles = bitmap;
+  } else {
+    // dense level; a NULL bitmap means no tiles are missing
+    g_free(bitmap);
+  }
+  tiffl->missing_tiles_valid = true;
+  return true;
+}
+
 // sets out-argument to indicate whether the tile data is zero bytes long
 // returns false on error
 bool _openslide_tiff_check_missing_tile(struct _openslide_tiff_level *tiffl,
@@ -366,6 +605,15 @@ bool _openslide_tiff_check_missing_tile(struct _openslide_tiff_level *tiffl,
                                         int64_t tile_col, int64_t tile_row,
                                         bool *is_missing,
                                         GError **err) {
+  // probe the bitmap if we have one; avoids libtiff directory churn in
+  // the paint loop
+  if (tiffl->missing_tiles_valid) {
+    int64_t tile_no = tile_row * tiffl->tiles_across + tile_col;
+    *is_missing = tiffl->missing_tiles &&
+      (tiffl->missing_tiles[tile_no / 32] & (1U << (tile_no % 32)));
+    return true;
+  }
+
   // set directory
   if (!_openslide_tiff_set_dir(tiff, tiffl->dir, err)) {
     return false;
@@ -499,12 +747,16 @@ bool _openslide_tiff_add_associated_image(openslide_t *osr,
 static tsize_t tiff_do_read(thandle_t th, tdata_t buf, tsize_t size) {
   struct tiff_file_handle *hdl = th;
 
+  _OPENSLIDE_PROBE3(io_read__start, hdl->tc, hdl->offset, (int64_t) size);
+
   // don't leave the file handle open between calls
   // also ensures FD_CLOEXEC is set
   FILE *f = _openslide_fopen(hdl->tc->filename, "rb", NULL);
   if (f == NULL) {
     return 0;
   }
+  // tile reads are small and scattered; don't let readahead overfetch
+  _openslide_fadvise_random(f);
   if (fseeko(f, hdl->offset, SEEK_SET)) {
     fclose(f);
     return 0;
@@ -512,6 +764,9 @@ static tsize_t tiff_do_read(thandle_t th, tdata_t buf, tsize_t size) {
   int64_t rsize = fread(buf, 1, size, f);
   hdl->offset += rsize;
   fclose(f);
+
+  _OPENSLIDE_PROBE4(io_read__done, hdl->tc, hdl->offset, (int64_t) size,
+                    rsize);
   return rsize;
 }
 
@@ -637,11 +892,56 @@ NOT_TIFF:
 }
 #define TIFFClientOpen _OPENSLIDE_POISON(_openslide_tiffcache_get)
 
+// close one idle handle on behalf of the process-wide budget
+static void tiffcache_trim(void *data) {
+  struct _openslide_tiffcache *tc = data;
+
+  g_mutex_lock(tc->lock);
+  TIFF *tiff = g_queue_pop_tail(tc->cache);
+  g_mutex_unlock(tc->lock);
+
+  if (tiff) {
+    TIFFClose(tiff);
+    _openslide_handle_pool_release(tc->budget_pool);
+  }
+}
+
 struct _openslide_tiffcache *_openslide_tiffcache_create(const char *filename) {
   struct _openslide_tiffcache *tc = g_slice_new0(struct _openslide_tiffcache);
   tc->filename = g_strdup(filename);
   tc->cache = g_queue_new();
   tc->lock = g_mutex_new();
+  tc->budget_pool = _openslide_handle_pool_register(tiffcache_trim, tc);
+
+  tc->max_handles = HANDLE_CACHE_MAX;
+  const char *max_handles_str = g_getenv(HANDLE_CACHE_MAX_ENV_VAR);
+  if (max_handles_str) {
+    int max_handles = (int) g_ascii_strtoll(max_handles_str, NULL, 10);
+    if (max_handles > 0) {
+      tc->max_handles = max_handles;
+    }
+  }
+
+  // optionally open handles now so the first readers don't all run
+  // tiff_open on their critical path.  best effort; a bad file will
+  // produce a real error from the first _openslide_tiffcache_get
+  const char *prewarm_str = g_getenv(HANDLE_PREWARM_ENV_VAR);
+  if (prewarm_str) {
+    int prewarm = (int) g_ascii_strtoll(prewarm_str, NULL, 10);
+    prewarm = MIN(prewarm, tc->max_handles);
+    for (int i = 0; i < prewarm; i++) {
+      if (!_openslide_handle_pool_retain(tc->budget_pool)) {
+        break;
+      }
+      TIFF *tiff = tiff_open(tc, NULL);
+      if (tiff == NULL) {
+        _openslide_handle_pool_release(tc->budget_pool);
+        break;
+      }
+      g_queue_push_head(tc->cache, tiff);
+    }
+  }
+
   return tc;
 }
 
@@ -652,6 +952,9 @@ TIFF *_openslide_tiffcache_get(struct _openslide_tiffcache *tc, GError **err) {
   TIFF *tiff = g_queue_pop_head(tc->cache);
   g_mutex_unlock(tc->lock);
 
+  if (tiff) {
+    _openslide_handle_pool_release(tc->budget_pool);
+  }
   if (tiff == NULL) {
     //g_debug("create TIFF");
     // Does not check that we have the same file.  Then again, neither does
@@ -675,11 +978,17 @@ void _openslide_tiffcache_put(struct _openslide_tiffcache *tc, TIFF *tiff) {
   g_mutex_lock(tc->lock);
   g_assert(tc->outstanding);
   tc->outstanding--;
-  if (g_queue_get_length(tc->cache) < HANDLE_CACHE_MAX) {
+  bool want = (int) g_queue_get_length(tc->cache) < tc->max_handles;
+  g_mutex_unlock(tc->lock);
+
+  // account against the process-wide budget outside our lock, since
+  // this can trim another pool which takes its own lock
+  if (want && _openslide_handle_pool_retain(tc->budget_pool)) {
+    g_mutex_lock(tc->lock);
     g_queue_push_head(tc->cache, tiff);
+    g_mutex_unlock(tc->lock);
     tiff = NULL;
   }
-  g_mutex_unlock(tc->lock);
 
   if (tiff) {
     //g_debug("too many TIFFs");
@@ -695,9 +1004,11 @@ void _openslide_tiffcache_destroy(struct _openslide_tiffcache *tc) {
   TIFF *tiff;
   while ((tiff = g_queue_pop_head(tc->cache)) != NULL) {
     TIFFClose(tiff);
+    _openslide_handle_pool_release(tc->budget_pool);
   }
   g_assert(tc->outstanding == 0);
   g_mutex_unlock(tc->lock);
+  _openslide_handle_pool_unregister(tc->budget_pool);
   g_queue_free(tc->cache);
   g_mutex_free(tc->lock);
   g_free(tc->filename);
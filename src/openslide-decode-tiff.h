@@ -41,6 +41,12 @@ struct _openslide_tiff_level {
   bool tile_read_direct;
   gint warned_read_indirect;
   uint16_t photometric;
+
+  // bitmap of zero-length tiles built by
+  // _openslide_tiff_init_missing_tilemap(), or NULL if no tiles are
+  // missing or the bitmap was never built; owned by the vendor driver
+  uint32_t *missing_tiles;
+  bool missing_tiles_valid;
 };
 
 struct _openslide_tiffcache;
@@ -51,18 +57,30 @@ bool _openslide_tiff_level_init(TIFF *tiff,
                                 struct _openslide_tiff_level *tiffl,
                                 GError **err);
 
+bool _openslide_tiff_init_missing_tilemap(struct _openslide_tiff_level *tiffl,
+                                          TIFF *tiff,
+                                          GError **err);
+
 bool _openslide_tiff_check_missing_tile(struct _openslide_tiff_level *tiffl,
                                         TIFF *tiff,
                                         int64_t tile_col, int64_t tile_row,
                                         bool *is_missing,
                                         GError **err);
 
-bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
+bool _openslide_tiff_read_tile(openslide_t *osr,
+                               struct _openslide_tiff_level *tiffl,
                                TIFF *tiff,
                                uint32_t *dest,
                                int64_t tile_col, int64_t tile_row,
                                GError **err);
 
+void _openslide_tiff_readahead(openslide_t *osr,
+                               struct _openslide_level *level,
+                               struct _openslide_tiff_level *tiffl,
+                               TIFF *tiff,
+                               int64_t start_col, int64_t start_row,
+                               int64_t end_col, int64_t end_row);
+
 bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
                                     TIFF *tiff,
                                     void **buf, int32_t *len,
@@ -48,15 +48,50 @@
 
 struct _openslide_tifflike {
   char *filename;
+  GMappedFile *mapped;  // optional; value reads fall back to stdio
   bool big_endian;
+  bool bigtiff;
   bool ndpi;
   GPtrArray *directories;
   GMutex *value_lock;
 };
 
+// Sequential reader over either a memory-mapped view or a FILE.  Mapping
+// avoids a syscall per field while walking directory entries; if the
+// file can't be mapped we parse through stdio as before.
+struct reader {
+  FILE *f;  // only used when map is NULL
+  const uint8_t *map;
+  int64_t size;
+  int64_t pos;
+};
+
+static bool reader_seek(struct reader *r, int64_t offset) {
+  if (r->map) {
+    if (offset < 0 || offset > r->size) {
+      return false;
+    }
+    r->pos = offset;
+    return true;
+  }
+  return fseeko(r->f, offset, SEEK_SET) == 0;
+}
+
+static bool reader_read(struct reader *r, void *buf, int64_t len) {
+  if (r->map) {
+    if (len < 0 || r->pos > r->size - len) {
+      return false;
+    }
+    memcpy(buf, r->map + r->pos, len);
+    r->pos += len;
+    return true;
+  }
+  return fread(buf, len, 1, r->f) == 1;
+}
+
 struct tiff_directory {
-  GHashTable *items;
-  uint64_t offset;  // only for NDPI fixups
+  GHashTable *items;  // NULL until the entries have been parsed
+  uint64_t offset;
 };
 
 struct tiff_item {
@@ -106,11 +141,12 @@ static void fix_byte_order(void *data, int32_t size, int64_t count,
 }
 
 // only sets *ok on failure
-static uint64_t read_uint(FILE *f, int32_t size, bool big_endian, bool *ok) {
+static uint64_t read_uint(struct reader *r, int32_t size, bool big_endian,
+                          bool *ok) {
   g_assert(ok != NULL);
 
   uint8_t buf[size];
-  if (fread(buf, size, 1, f) != 1) {
+  if (!reader_read(r, buf, size)) {
     *ok = false;
     return 0;
   }
@@ -340,9 +376,19 @@ static bool populate_item(struct _openslide_tifflike *tl,
     return true;
   }
 
-  FILE *f = _openslide_fopen(tl->filename, "rb", err);
-  if (!f) {
-    goto FAIL;
+  // read from the mapping if we have one; otherwise reopen the file,
+  // since the FILE from _openslide_tifflike_create is long gone
+  FILE *f = NULL;
+  struct reader reader = { NULL, NULL, 0, 0 };
+  if (tl->mapped) {
+    reader.map = (const uint8_t *) g_mapped_file_get_contents(tl->mapped);
+    reader.size = g_mapped_file_get_length(tl->mapped);
+  } else {
+    f = _openslide_fopen(tl->filename, "rb", err);
+    if (!f) {
+      goto FAIL;
+    }
+    reader.f = f;
   }
 
   uint64_t count = item->count;
@@ -358,11 +404,11 @@ static bool populate_item(struct _openslide_tifflike *tl,
   }
 
   //g_debug("reading tiff value: len: %"PRId64", offset %"PRIu64, len, item->offset);
-  if (fseeko(f, item->offset, SEEK_SET)) {
+  if (!reader_seek(&reader, item->offset)) {
     _openslide_io_error(err, "Couldn't seek to read TIFF value");
     goto FAIL;
   }
-  if (fread(buf, len, 1, f) != 1) {
+  if (!reader_read(&reader, buf, len)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Couldn't read TIFF value");
     goto FAIL;
@@ -388,7 +434,9 @@ static void tiff_directory_destroy(struct tiff_directory *d) {
   if (d == NULL) {
     return;
   }
-  g_hash_table_unref(d->items);
+  if (d->items) {
+    g_hash_table_unref(d->items);
+  }
   g_slice_free(struct tiff_directory, d);
 }
 
@@ -402,7 +450,7 @@ static void tiff_item_destroy(gpointer data) {
   g_slice_free(struct tiff_item, item);
 }
 
-static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
+static struct tiff_directory *read_directory(struct reader *r, int64_t *diroff,
                                              struct tiff_directory *first_dir,
                                              GHashTable *loop_detector,
                                              bool bigtiff,
@@ -422,25 +470,27 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
     goto FAIL;
   }
 
-  // loop detection
-  if (g_hash_table_lookup_extended(loop_detector, &off, NULL, NULL)) {
-    // loop
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Loop detected");
-    goto FAIL;
+  // loop detection; NULL when reparsing a directory already walked once
+  if (loop_detector) {
+    if (g_hash_table_lookup_extended(loop_detector, &off, NULL, NULL)) {
+      // loop
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Loop detected");
+      goto FAIL;
+    }
+    int64_t *key = g_slice_new(int64_t);
+    *key = off;
+    g_hash_table_insert(loop_detector, key, NULL);
   }
-  int64_t *key = g_slice_new(int64_t);
-  *key = off;
-  g_hash_table_insert(loop_detector, key, NULL);
 
   // no loop, let's seek
-  if (fseeko(f, off, SEEK_SET) != 0) {
+  if (!reader_seek(r, off)) {
     _openslide_io_error(err, "Cannot seek to offset");
     goto FAIL;
   }
 
   // read directory count
-  uint64_t dircount = read_uint(f, bigtiff ? 8 : 2, big_endian, &ok);
+  uint64_t dircount = read_uint(r, bigtiff ? 8 : 2, big_endian, &ok);
   if (!ok) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Cannot read dircount");
@@ -458,9 +508,9 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
 
   // read all directory entries
   for (uint64_t n = 0; n < dircount; n++) {
-    uint16_t tag = read_uint(f, 2, big_endian, &ok);
-    uint16_t type = read_uint(f, 2, big_endian, &ok);
-    uint64_t count = read_uint(f, bigtiff ? 8 : 4, big_endian, &ok);
+    uint16_t tag = read_uint(r, 2, big_endian, &ok);
+    uint16_t type = read_uint(r, 2, big_endian, &ok);
+    uint64_t count = read_uint(r, bigtiff ? 8 : 4, big_endian, &ok);
 
     if (!ok) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -493,7 +543,7 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
 
     // read in the value/offset
     uint8_t value[bigtiff ? 8 : 4];
-    if (fread(value, sizeof(value), 1, f) != 1) {
+    if (!reader_read(r, value, sizeof(value))) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Cannot read value/offset");
       goto FAIL;
@@ -535,7 +585,7 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
   }
 
   // read the next dir offset
-  int64_t nextdiroff = read_uint(f, (bigtiff || ndpi) ? 8 : 4,
+  int64_t nextdiroff = read_uint(r, (bigtiff || ndpi) ? 8 : 4,
                                  big_endian, &ok);
   if (!ok) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -553,20 +603,98 @@ FAIL:
   return NULL;
 }
 
+// record a directory's offset and advance the chain without parsing the
+// entries; ensure_directory() parses them on first access.  this keeps
+// opens fast on files with hundreds of directories.
+static struct tiff_directory *skim_directory(struct reader *r, int64_t *diroff,
+                                             GHashTable *loop_detector,
+                                             bool bigtiff,
+                                             bool ndpi,
+                                             bool big_endian,
+                                             GError **err) {
+  int64_t off = *diroff;
+  *diroff = 0;
+  bool ok = true;
+
+  if (off <= 0) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Bad offset");
+    return NULL;
+  }
+
+  // loop detection
+  if (g_hash_table_lookup_extended(loop_detector, &off, NULL, NULL)) {
+    // loop
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Loop detected");
+    return NULL;
+  }
+  int64_t *key = g_slice_new(int64_t);
+  *key = off;
+  g_hash_table_insert(loop_detector, key, NULL);
+
+  // no loop, let's seek
+  if (!reader_seek(r, off)) {
+    _openslide_io_error(err, "Cannot seek to offset");
+    return NULL;
+  }
+
+  // read directory count
+  const int32_t count_size = bigtiff ? 8 : 2;
+  uint64_t dircount = read_uint(r, count_size, big_endian, &ok);
+  if (!ok) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot read dircount");
+    return NULL;
+  }
+
+  // seek past the entries to the next directory offset
+  const int32_t entry_size = bigtiff ? 20 : 12;
+  if (dircount > (uint64_t) (INT64_MAX - off - count_size) / entry_size ||
+      !reader_seek(r, off + count_size + dircount * entry_size)) {
+    _openslide_io_error(err, "Cannot seek past directory entries");
+    return NULL;
+  }
+
+  // read the next dir offset
+  int64_t nextdiroff = read_uint(r, (bigtiff || ndpi) ? 8 : 4,
+                                 big_endian, &ok);
+  if (!ok) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot read next directory offset");
+    return NULL;
+  }
+  *diroff = nextdiroff;
+
+  struct tiff_directory *d = g_slice_new0(struct tiff_directory);
+  d->offset = off;
+  return d;
+}
+
 struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
                                                        GError **err) {
   struct _openslide_tifflike *tl = NULL;
   GHashTable *loop_detector = NULL;
-
-  // open file
-  FILE *f = _openslide_fopen(filename, "rb", err);
-  if (!f) {
-    goto FAIL;
+  FILE *f = NULL;
+  struct reader reader = { NULL, NULL, 0, 0 };
+
+  // map the file; fall back to stdio if the platform or filesystem
+  // refuses (e.g. the file is larger than the address space)
+  GMappedFile *mapped = g_mapped_file_new(filename, false, NULL);
+  if (mapped) {
+    reader.map = (const uint8_t *) g_mapped_file_get_contents(mapped);
+    reader.size = g_mapped_file_get_length(mapped);
+  } else {
+    f = _openslide_fopen(filename, "rb", err);
+    if (!f) {
+      goto FAIL;
+    }
+    reader.f = f;
   }
 
   // read and check magic
   uint16_t magic;
-  if (fread(&magic, sizeof magic, 1, f) != 1) {
+  if (!reader_read(&reader, &magic, sizeof magic)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Can't read TIFF magic number");
     goto FAIL;
@@ -582,16 +710,16 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
 
   // read rest of header
   bool ok = true;
-  uint16_t version = read_uint(f, 2, big_endian, &ok);
+  uint16_t version = read_uint(&reader, 2, big_endian, &ok);
   bool bigtiff = (version == TIFF_VERSION_BIG);
   uint16_t offset_size = 0;
   uint16_t pad = 0;
   if (bigtiff) {
-    offset_size = read_uint(f, 2, big_endian, &ok);
-    pad = read_uint(f, 2, big_endian, &ok);
+    offset_size = read_uint(&reader, 2, big_endian, &ok);
+    pad = read_uint(&reader, 2, big_endian, &ok);
   }
   // for classic TIFF, will mask off the high bytes after NDPI detection
-  int64_t diroff = read_uint(f, 8, big_endian, &ok);
+  int64_t diroff = read_uint(&reader, 8, big_endian, &ok);
 
   if (!ok) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -617,7 +745,10 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
   // allocate struct
   tl = g_slice_new0(struct _openslide_tifflike);
   tl->filename = g_strdup(filename);
+  tl->mapped = mapped;
+  mapped = NULL;  // now owned by tl
   tl->big_endian = big_endian;
+  tl->bigtiff = bigtiff;
   tl->directories = g_ptr_array_new();
   tl->value_lock = g_mutex_new();
 
@@ -634,7 +765,7 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
   // valid directory containing the NDPI_TAG.
   if (!bigtiff && diroff != 0) {
     int64_t trial_diroff = diroff;
-    struct tiff_directory *d = read_directory(f, &trial_diroff,
+    struct tiff_directory *d = read_directory(&reader, &trial_diroff,
                                               NULL,
                                               loop_detector,
                                               bigtiff, true, big_endian,
@@ -665,14 +796,23 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
     }
   }
 
-  // read all the directories
+  // read all the directories.  fully parse the first, since format
+  // detection probes it and NDPI offset fixups need its items; only skim
+  // the rest, deferring entry parsing until first access
   while (diroff != 0) {
-    // read a directory
-    struct tiff_directory *d = read_directory(f, &diroff,
-                                              first_dir,
-                                              loop_detector,
-                                              bigtiff, tl->ndpi, big_endian,
-                                              err);
+    struct tiff_directory *d;
+    if (!first_dir) {
+      d = read_directory(&reader, &diroff,
+                         first_dir,
+                         loop_detector,
+                         bigtiff, tl->ndpi, big_endian,
+                         err);
+    } else {
+      d = skim_directory(&reader, &diroff,
+                         loop_detector,
+                         bigtiff, tl->ndpi, big_endian,
+                         err);
+    }
 
     // was the directory successfully read?
     if (d == NULL) {
@@ -694,7 +834,9 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
   }
 
   g_hash_table_unref(loop_detector);
-  fclose(f);
+  if (f) {
+    fclose(f);
+  }
   return tl;
 
 FAIL:
@@ -702,6 +844,9 @@ FAIL:
   if (loop_detector) {
     g_hash_table_unref(loop_detector);
   }
+  if (mapped) {
+    g_mapped_file_unref(mapped);
+  }
   if (f) {
     fclose(f);
   }
@@ -719,23 +864,83 @@ void _openslide_tifflike_destroy(struct _openslide_tifflike *tl) {
   }
   g_mutex_unlock(tl->value_lock);
   g_ptr_array_free(tl->directories, true);
+  if (tl->mapped) {
+    g_mapped_file_unref(tl->mapped);
+  }
   g_free(tl->filename);
   g_mutex_free(tl->value_lock);
   g_slice_free(struct _openslide_tifflike, tl);
 }
 
-static struct tiff_item *get_item(struct _openslide_tifflike *tl,
-                                  int64_t dir, int32_t tag) {
+// parse a skimmed directory's entries on first access.  the first
+// directory is always parsed eagerly in _openslide_tifflike_create, so
+// NDPI offset fixups can consult it here.
+static struct tiff_directory *ensure_directory(struct _openslide_tifflike *tl,
+                                               int64_t dir,
+                                               GError **err) {
   if (dir < 0 || dir >= tl->directories->len) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "No such TIFF directory: %"PRId64, dir);
     return NULL;
   }
+
+  g_mutex_lock(tl->value_lock);
   struct tiff_directory *d = tl->directories->pdata[dir];
+  if (d->items) {
+    g_mutex_unlock(tl->value_lock);
+    return d;
+  }
+
+  // read from the mapping if we have one; otherwise reopen the file,
+  // since the FILE from _openslide_tifflike_create is long gone
+  FILE *f = NULL;
+  struct reader reader = { NULL, NULL, 0, 0 };
+  if (tl->mapped) {
+    reader.map = (const uint8_t *) g_mapped_file_get_contents(tl->mapped);
+    reader.size = g_mapped_file_get_length(tl->mapped);
+  } else {
+    f = _openslide_fopen(tl->filename, "rb", err);
+    if (!f) {
+      g_mutex_unlock(tl->value_lock);
+      return NULL;
+    }
+    reader.f = f;
+  }
+
+  int64_t diroff = d->offset;
+  struct tiff_directory *parsed = read_directory(&reader, &diroff,
+                                                 tl->directories->pdata[0],
+                                                 NULL,
+                                                 tl->bigtiff, tl->ndpi,
+                                                 tl->big_endian,
+                                                 err);
+  if (parsed) {
+    d->items = parsed->items;
+    parsed->items = NULL;
+    tiff_directory_destroy(parsed);
+  }
+  g_mutex_unlock(tl->value_lock);
+  if (f) {
+    fclose(f);
+  }
+
+  return d->items ? d : NULL;
+}
+
+// only sets *err if the directory can't be read, not if the tag is absent
+static struct tiff_item *get_item(struct _openslide_tifflike *tl,
+                                  int64_t dir, int32_t tag,
+                                  GError **err) {
+  struct tiff_directory *d = ensure_directory(tl, dir, err);
+  if (d == NULL) {
+    return NULL;
+  }
   return g_hash_table_lookup(d->items, GINT_TO_POINTER(tag));
 }
 
 static void print_tag(struct _openslide_tifflike *tl,
                       int64_t dir, int32_t tag) {
-  struct tiff_item *item = get_item(tl, dir, tag);
+  struct tiff_item *item = get_item(tl, dir, tag, NULL);
   g_assert(item != NULL);
 
   printf(" %d: type: %d, count: %"PRId64"\n ", tag, item->type, item->count);
@@ -819,7 +1024,10 @@ static int tag_compare(gconstpointer a, gconstpointer b) {
 
 static void print_directory(struct _openslide_tifflike *tl,
                             int64_t dir) {
-  struct tiff_directory *d = tl->directories->pdata[dir];
+  struct tiff_directory *d = ensure_directory(tl, dir, NULL);
+  if (d == NULL) {
+    return;
+  }
   GList *keys = g_hash_table_get_keys(d->items);
   keys = g_list_sort(keys, tag_compare);
   for (GList *el = keys; el; el = el->next) {
@@ -843,7 +1051,7 @@ int64_t _openslide_tifflike_get_directory_count(struct _openslide_tifflike *tl)
 
 int64_t _openslide_tifflike_get_value_count(struct _openslide_tifflike *tl,
                                             int64_t dir, int32_t tag) {
-  struct tiff_item *item = get_item(tl, dir, tag);
+  struct tiff_item *item = get_item(tl, dir, tag, NULL);
   if (item == NULL) {
     return 0;
   }
@@ -853,7 +1061,14 @@ int64_t _openslide_tifflike_get_value_count(struct _openslide_tifflike *tl,
 static struct tiff_item *get_and_check_item(struct _openslide_tifflike *tl,
                                             int64_t dir, int32_t tag,
                                             GError **err) {
-  struct tiff_item *item = get_item(tl, dir, tag);
+  GError *tmp_err = NULL;
+  struct tiff_item *item = get_item(tl, dir, tag, &tmp_err);
+  if (tmp_err) {
+    // a real read failure; don't mask it as a missing value, since
+    // callers treat OPENSLIDE_ERROR_NO_VALUE as "tag not present"
+    g_propagate_error(err, tmp_err);
+    return NULL;
+  }
   if (item == NULL || item->count == 0) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_NO_VALUE,
                 "No such value: directory %"PRId64", tag %d", dir, tag);
@@ -34,6 +34,8 @@
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 
+#define SAX_CHUNK_SIZE (64 << 10)
+
 xmlDoc *_openslide_xml_parse(const char *xml, GError **err) {
   xmlDoc *doc = xmlReadMemory(xml, strlen(xml), "/", NULL,
                               XML_PARSE_NOERROR |
@@ -163,3 +165,155 @@ void _openslide_xml_set_prop_from_xpath(openslide_t *osr,
                         str);
   }
 }
+
+const char *_openslide_xml_sax_get_attr(const xmlChar **atts,
+                                        const char *name) {
+  for (int i = 0; atts && atts[i]; i += 2) {
+    if (!xmlStrcmp(atts[i], BAD_CAST name)) {
+      return (const char *) atts[i + 1];
+    }
+  }
+  return NULL;
+}
+
+bool _openslide_xml_sax_parse_int_attr(const xmlChar **atts, const char *name,
+                                       int64_t *out, GError **err) {
+  const char *value = _openslide_xml_sax_get_attr(atts, name);
+  if (value == NULL) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "No integer attribute \"%s\"", name);
+    return false;
+  }
+
+  gchar *endptr;
+  *out = g_ascii_strtoll(value, &endptr, 10);
+  if (value[0] == 0 || endptr[0] != 0) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Invalid integer attribute \"%s\"", name);
+    return false;
+  }
+  return true;
+}
+
+bool _openslide_xml_sax_parse(const char *xml,
+                              xmlSAXHandler *sax,
+                              void *state,
+                              const bool *stop,
+                              GError **err) {
+  xmlParserCtxt *ctx = xmlCreatePushParserCtxt(sax, state, NULL, 0, "/");
+  if (ctx == NULL) {
+    // allocation error, abort
+    g_error("xmlCreatePushParserCtxt failed");
+    // not reached
+  }
+  xmlCtxtUseOptions(ctx, XML_PARSE_NOERROR |
+                    XML_PARSE_NOWARNING |
+                    XML_PARSE_NONET);
+
+  // feed the document in chunks so the handler can end the parse early
+  size_t remaining = strlen(xml);
+  bool failed = false;
+  while (remaining && !(stop && *stop)) {
+    int count = MIN(remaining, (size_t) SAX_CHUNK_SIZE);
+    if (xmlParseChunk(ctx, xml, count, 0)) {
+      failed = true;
+      break;
+    }
+    xml += count;
+    remaining -= count;
+  }
+
+  bool success;
+  if (stop && *stop) {
+    // the handler has seen everything it needs
+    success = true;
+  } else if (failed) {
+    success = false;
+  } else {
+    xmlParseChunk(ctx, NULL, 0, 1);
+    success = ctx->wellFormed;
+  }
+  if (!success) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Could not parse XML");
+  }
+  xmlFreeParserCtxt(ctx);
+  return success;
+}
+
+struct root_info {
+  char **name;
+  char **ns;
+  const char *attr;
+  char **attr_value;
+  bool seen;
+};
+
+static void root_info_start_element_ns(void *state,
+                                       const xmlChar *localname,
+                                       const xmlChar *prefix G_GNUC_UNUSED,
+                                       const xmlChar *URI,
+                                       int nb_namespaces G_GNUC_UNUSED,
+                                       const xmlChar **namespaces G_GNUC_UNUSED,
+                                       int nb_attributes,
+                                       int nb_defaulted G_GNUC_UNUSED,
+                                       const xmlChar **attributes) {
+  struct root_info *info = state;
+  if (info->seen) {
+    return;
+  }
+  info->seen = true;
+
+  if (info->name) {
+    *info->name = g_strdup((const char *) localname);
+  }
+  if (info->ns && URI) {
+    *info->ns = g_strdup((const char *) URI);
+  }
+  if (info->attr && info->attr_value) {
+    for (int i = 0; i < nb_attributes; i++) {
+      // localname, prefix, URI, value start, value end
+      const xmlChar **attr = attributes + 5 * i;
+      if (!xmlStrcmp(attr[0], BAD_CAST info->attr)) {
+        *info->attr_value = g_strndup((const char *) attr[3],
+                                      attr[4] - attr[3]);
+        break;
+      }
+    }
+  }
+}
+
+bool _openslide_xml_get_root_info(const char *xml,
+                                  char **name, char **ns,
+                                  const char *attr, char **attr_value,
+                                  GError **err) {
+  if (name) {
+    *name = NULL;
+  }
+  if (ns) {
+    *ns = NULL;
+  }
+  if (attr_value) {
+    *attr_value = NULL;
+  }
+
+  struct root_info info = {
+    .name = name,
+    .ns = ns,
+    .attr = attr,
+    .attr_value = attr_value,
+  };
+  xmlSAXHandler sax = {
+    .initialized = XML_SAX2_MAGIC,
+    .startElementNs = root_info_start_element_ns,
+  };
+  if (!_openslide_xml_sax_parse(xml, &sax, &info, &info.seen, err)) {
+    return false;
+  }
+  if (!info.seen) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "No root element");
+    return false;
+  }
+  return true;
+}
@@ -26,6 +26,7 @@
 
 #include <stdint.h>
 #include <glib.h>
+#include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 
@@ -57,4 +58,28 @@ void _openslide_xml_set_prop_from_xpath(openslide_t *osr,
                                         const char *property_name,
                                         const char *xpath);
 
+/* SAX parsing, for documents too large to build a tree */
+
+// run a SAX parse over an in-memory document; parsing ends early once
+// *stop becomes true (stop may be NULL)
+bool _openslide_xml_sax_parse(const char *xml,
+                              xmlSAXHandler *sax,
+                              void *state,
+                              const bool *stop,
+                              GError **err);
+
+// SAX-parse only the start tag of the root element; outputs may be NULL
+// and are returned NULL when absent
+bool _openslide_xml_get_root_info(const char *xml,
+                                  char **name, char **ns,
+                                  const char *attr, char **attr_value,
+                                  GError **err);
+
+// look up an attribute in a SAX1 startElement attribute list
+const char *_openslide_xml_sax_get_attr(const xmlChar **atts,
+                                        const char *name);
+
+bool _openslide_xml_sax_parse_int_attr(const xmlChar **atts, const char *name,
+                                       int64_t *out, GError **err);
+
 #endif
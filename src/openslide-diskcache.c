@@ -0,0 +1,103 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+#include "openslide-hash.h"
+
+#include <glib.h>
+
+// Optional persistent tile cache, intended for a local SSD in front of
+// slides on network storage.  Tiles are stored one per file under
+// <root>/<quickhash1>/, so the cache survives process restarts and is
+// keyed by slide content rather than by path.  The cache is enabled by
+// setting the environment variable to the root directory; it is never
+// pruned by us, on the assumption that the deployment manages the
+// directory (e.g. with a cron job or tmpfiles.d).
+
+static const char CACHE_DIR_ENV_VAR[] = "OPENSLIDE_TILE_CACHE_DIR";
+
+struct _openslide_diskcache {
+  char *dir;  // <root>/<quickhash1>
+};
+
+struct _openslide_diskcache *_openslide_diskcache_open(struct _openslide_hash *quickhash1) {
+  const char *root = g_getenv(CACHE_DIR_ENV_VAR);
+  if (!root || !root[0] || !quickhash1) {
+    return NULL;
+  }
+
+  // only resolve the (lazy) hash once we know the cache is enabled
+  const char *hash_str = _openslide_hash_get_string(quickhash1);
+  if (!hash_str) {
+    return NULL;
+  }
+
+  char *dir = g_build_filename(root, hash_str, NULL);
+  if (g_mkdir_with_parents(dir, 0700)) {
+    g_warning("Couldn't create tile cache directory %s", dir);
+    g_free(dir);
+    return NULL;
+  }
+
+  struct _openslide_diskcache *dc = g_slice_new0(struct _openslide_diskcache);
+  dc->dir = dir;
+  return dc;
+}
+
+void _openslide_diskcache_close(struct _openslide_diskcache *dc) {
+  g_free(dc->dir);
+  g_slice_free(struct _openslide_diskcache, dc);
+}
+
+static char *tile_path(struct _openslide_diskcache *dc,
+                       int32_t plane, int64_t x, int64_t y) {
+  char *name = g_strdup_printf("%d-%"PRId64"-%"PRId64, plane, x, y);
+  char *path = g_build_filename(dc->dir, name, NULL);
+  g_free(name);
+  return path;
+}
+
+// returns a g_malloc'd buffer, or NULL on miss
+void *_openslide_diskcache_get(struct _openslide_diskcache *dc,
+                               int32_t plane, int64_t x, int64_t y,
+                               int32_t *len) {
+  char *path = tile_path(dc, plane, x, y);
+  char *contents = NULL;
+  gsize length;
+  if (g_file_get_contents(path, &contents, &length, NULL)) {
+    *len = length;
+  }
+  g_free(path);
+  return contents;
+}
+
+void _openslide_diskcache_put(struct _openslide_diskcache *dc,
+                              int32_t plane, int64_t x, int64_t y,
+                              const void *buf, int32_t len) {
+  char *path = tile_path(dc, plane, x, y);
+  // g_file_set_contents() writes to a temporary file and renames it, so
+  // concurrent readers never see a partial tile.  failures (e.g. a full
+  // disk) are deliberately ignored; the cache is best-effort
+  g_file_set_contents(path, buf, len, NULL);
+  g_free(path);
+}
@@ -20,15 +20,16 @@
  */
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <glib.h>
 #include <cairo.h>
 #include "openslide-private.h"
 
-#define RANGE_BIN_SIZE_MULTIPLIER 3
+#define RANGE_RTREE_FANOUT 8
 #define COLOR_TILE 0.6, 0,   0,   0.3
-#define COLOR_BIN  0,   0,   0.6, 0.15
+#define COLOR_NODE 0,   0,   0.6, 0.15
 
 struct region {
   double x;
@@ -88,10 +89,35 @@ struct simple_grid {
   _openslide_grid_simple_read_fn read_tile;
 };
 
+struct stride_grid {
+  struct _openslide_grid base;
+
+  int64_t tiles_across;
+  int64_t tiles_down;
+  // tile extent; at least the advance, overhanging the neighboring
+  // cell by the overlap
+  double tile_w;
+  double tile_h;
+  // how many tiles to the left/top can overhang into a cell
+  int32_t extra_tiles_x;
+  int32_t extra_tiles_y;
+  _openslide_grid_simple_read_fn read_tile;
+};
+
+// empty-slot marker for the tilemap tile table; no vendor driver uses
+// this column number
+#define TILEMAP_EMPTY_COL G_MININT64
+
 struct tilemap_grid {
   struct _openslide_grid base;
 
-  GHashTable *tiles;
+  // open-addressing table with tiles stored by value, so a slide with
+  // millions of tiles costs one allocation instead of one per tile and
+  // a lookup is a contiguous linear probe
+  struct tilemap_tile *tiles;
+  int64_t tile_count;
+  int64_t slot_count;  // power of two
+
   _openslide_grid_tilemap_read_fn read_tile;
   GDestroyNotify destroy_tile;
 
@@ -101,6 +127,12 @@ struct tilemap_grid {
   double left;
   double right;
 
+  // occupied tile index range, for clipping paints to the tiled area
+  int64_t min_col;
+  int64_t max_col;
+  int64_t min_row;
+  int64_t max_row;
+
   // how much extra we might need to read to get all relevant tiles
   // computed from tile offsets
   int32_t extra_tiles_top;
@@ -110,10 +142,9 @@ struct tilemap_grid {
 };
 
 struct tilemap_tile {
-  struct tilemap_grid *grid;
   void *data;
 
-  int64_t col;
+  int64_t col;  // TILEMAP_EMPTY_COL if the slot is unused
   int64_t row;
 
   double w;
@@ -123,15 +154,33 @@ struct tilemap_tile {
   double offset_y;
 };
 
+// a node of the packed R-tree over a range grid's tiles, built once in
+// _openslide_grid_range_finish_adding_tiles().  all nodes live in one
+// flat array, with each node's children (tiles for a leaf, nodes
+// otherwise) stored contiguously, so a region query walks a handful of
+// adjacent cache lines rather than chasing per-bin allocations
+struct range_node {
+  // bounding box, half-open
+  double x0;
+  double y0;
+  double x1;
+  double y1;
+
+  int32_t first;  // first tile in sorted if leaf, else first child node
+  int32_t count;
+  bool leaf;
+};
+
 struct range_grid {
   struct _openslide_grid base;
 
-  int bin_width;
-  int bin_height;
-
   GPtrArray *tiles;
-  GHashTable *bins_init;  // address -> GPtrArray<tile>
-  GHashTable *bins_runtime;  // address -> [tile]
+
+  // packed R-tree, built by _openslide_grid_range_finish_adding_tiles()
+  struct range_tile **sorted;  // tiles in tree order
+  struct range_node *nodes;
+  int32_t root;  // -1 if the grid is empty
+  bool finished;
 
   _openslide_grid_range_read_fn read_tile;
   GDestroyNotify destroy_tile;
@@ -143,11 +192,6 @@ struct range_grid {
   double right;
 };
 
-struct range_bin_address {
-  int64_t col;
-  int64_t row;
-};
-
 struct range_tile {
   int64_t id;
   void *data;
@@ -368,26 +412,166 @@ struct _openslide_grid *_openslide_grid_create_simple(openslide_t *osr,
 
 
 
-static guint tilemap_tile_hash_func(gconstpointer key) {
-  const struct tilemap_tile *tile = key;
+static void stride_get_bounds(struct _openslide_grid *_grid,
+                              struct bounds *bounds) {
+  struct stride_grid *grid = (struct stride_grid *) _grid;
+
+  bounds->w = (grid->tiles_across - 1) * grid->base.tile_advance_x +
+    grid->tile_w;
+  bounds->h = (grid->tiles_down - 1) * grid->base.tile_advance_y +
+    grid->tile_h;
+}
+
+static bool stride_read_tile(struct _openslide_grid *_grid,
+                             struct region *region,
+                             cairo_t *cr,
+                             struct _openslide_level *level,
+                             int64_t tile_col, int64_t tile_row,
+                             void *arg,
+                             GError **err) {
+  struct stride_grid *grid = (struct stride_grid *) _grid;
+
+  // skip the tile if it's outside the requested region
+  // (i.e., extra_tiles_* gave us an irrelevant tile)
+  double x = tile_col * grid->base.tile_advance_x;
+  double y = tile_row * grid->base.tile_advance_y;
+  if (x + grid->tile_w <= region->x ||
+      y + grid->tile_h <= region->y ||
+      x >= region->x + region->w ||
+      y >= region->y + region->h) {
+    return true;
+  }
+
+  if (!grid->read_tile(grid->base.osr, cr, level,
+                       tile_col, tile_row, arg, err)) {
+    return false;
+  }
+  if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
+    char *coordinates = g_strdup_printf("%"PRId64", %"PRId64,
+                                        tile_col, tile_row);
+    label_tile(cr, COLOR_TILE, grid->tile_w, grid->tile_h, coordinates);
+    g_free(coordinates);
+  }
+  return true;
+}
+
+static bool stride_paint_region(struct _openslide_grid *_grid,
+                                cairo_t *cr,
+                                void *arg,
+                                double x, double y,
+                                struct _openslide_level *level,
+                                int32_t w, int32_t h,
+                                GError **err) {
+  struct stride_grid *grid = (struct stride_grid *) _grid;
+  struct region region;
+
+  compute_region(_grid, x, y, w, h, &region);
+
+  // save
+  cairo_matrix_t matrix;
+  cairo_get_matrix(cr, &matrix);
+
+  // the overhang of tiles to the left/top can reach into the region;
+  // read_tiles() paints back to front, so they win the overlap band
+  region.start_tile_x -= grid->extra_tiles_x;
+  region.start_tile_y -= grid->extra_tiles_y;
+  cairo_translate(cr,
+                  -grid->extra_tiles_x * grid->base.tile_advance_x,
+                  -grid->extra_tiles_y * grid->base.tile_advance_y);
+
+  // bound on left/top
+  int64_t skipped_tiles_x = -MIN(region.start_tile_x, 0);
+  int64_t skipped_tiles_y = -MIN(region.start_tile_y, 0);
+  cairo_translate(cr,
+                  skipped_tiles_x * grid->base.tile_advance_x,
+                  skipped_tiles_y * grid->base.tile_advance_y);
+  region.start_tile_x += skipped_tiles_x;
+  region.start_tile_y += skipped_tiles_y;
+
+  // bound on right/bottom
+  region.end_tile_x = MIN(region.end_tile_x, grid->tiles_across);
+  region.end_tile_y = MIN(region.end_tile_y, grid->tiles_down);
+
+  // read
+  bool result = true;
+  if (region.start_tile_x < region.end_tile_x &&
+      region.start_tile_y < region.end_tile_y) {
+    result = read_tiles(cr, level, _grid, &region,
+                        stride_read_tile, arg, err);
+  }
+
+  // restore
+  cairo_set_matrix(cr, &matrix);
+
+  return result;
+}
+
+static void stride_destroy(struct _openslide_grid *_grid) {
+  struct stride_grid *grid = (struct stride_grid *) _grid;
+
+  g_slice_free(struct stride_grid, grid);
+}
+
+static const struct grid_ops stride_grid_ops = {
+  .get_bounds = stride_get_bounds,
+  .paint_region = stride_paint_region,
+  .destroy = stride_destroy,
+};
+
+struct _openslide_grid *_openslide_grid_create_stride(openslide_t *osr,
+                                                      int64_t tiles_across,
+                                                      int64_t tiles_down,
+                                                      double tile_w,
+                                                      double tile_h,
+                                                      double tile_advance_x,
+                                                      double tile_advance_y,
+                                                      _openslide_grid_simple_read_fn read_tile) {
+  g_assert(tile_advance_x > 0 && tile_advance_y > 0);
+  g_assert(tile_w >= tile_advance_x && tile_h >= tile_advance_y);
 
-  // assume 32-bit hash
-  return (guint) ((34369 * (uint64_t) tile->row) + ((uint64_t) tile->col));
+  struct stride_grid *grid = g_slice_new0(struct stride_grid);
+  grid->base.osr = osr;
+  grid->base.ops = &stride_grid_ops;
+  grid->base.tile_advance_x = tile_advance_x;
+  grid->base.tile_advance_y = tile_advance_y;
+  grid->tiles_across = tiles_across;
+  grid->tiles_down = tiles_down;
+  grid->tile_w = tile_w;
+  grid->tile_h = tile_h;
+  grid->extra_tiles_x = ceil((tile_w - tile_advance_x) / tile_advance_x);
+  grid->extra_tiles_y = ceil((tile_h - tile_advance_y) / tile_advance_y);
+  grid->read_tile = read_tile;
+  return (struct _openslide_grid *) grid;
 }
 
-static gboolean tilemap_tile_hash_key_equal(gconstpointer a, gconstpointer b) {
-  const struct tilemap_tile *c_a = a;
-  const struct tilemap_tile *c_b = b;
 
-  return (c_a->col == c_b->col) && (c_a->row == c_b->row);
+
+static uint64_t tilemap_tile_hash(int64_t col, int64_t row) {
+  return (34369 * (uint64_t) row) + ((uint64_t) col);
+}
+
+// linear probe; returns the tile at (col, row), or the empty slot where
+// it would be inserted
+static struct tilemap_tile *tilemap_probe(struct tilemap_grid *grid,
+                                          int64_t col, int64_t row) {
+  uint64_t slot = tilemap_tile_hash(col, row) & (grid->slot_count - 1);
+  while (true) {
+    struct tilemap_tile *tile = &grid->tiles[slot];
+    if (tile->col == TILEMAP_EMPTY_COL ||
+        (tile->col == col && tile->row == row)) {
+      return tile;
+    }
+    slot = (slot + 1) & (grid->slot_count - 1);
+  }
 }
 
-static void tilemap_tile_hash_destroy_value(gpointer data) {
-  struct tilemap_tile *tile = data;
-  if (tile->grid->destroy_tile && tile->data) {
-    tile->grid->destroy_tile(tile->data);
+static void tilemap_table_init(struct tilemap_grid *grid,
+                               int64_t slot_count) {
+  grid->slot_count = slot_count;
+  grid->tiles = g_new(struct tilemap_tile, slot_count);
+  for (int64_t i = 0; i < slot_count; i++) {
+    grid->tiles[i].col = TILEMAP_EMPTY_COL;
   }
-  g_slice_free(struct tilemap_tile, tile);
 }
 
 static void tilemap_get_bounds(struct _openslide_grid *_grid,
@@ -411,12 +595,8 @@ static bool tilemap_read_tile(struct _openslide_grid *_grid,
                               GError **err) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
 
-  struct tilemap_tile coords = {
-    .col = tile_col,
-    .row = tile_row,
-  };
-  struct tilemap_tile *tile = g_hash_table_lookup(grid->tiles, &coords);
-  if (tile == NULL) {
+  struct tilemap_tile *tile = tilemap_probe(grid, tile_col, tile_row);
+  if (tile->col == TILEMAP_EMPTY_COL) {
     //g_debug("no tile at %"PRId64", %"PRId64, tile_col, tile_row);
     return true;
   }
@@ -462,6 +642,13 @@ static bool tilemap_paint_region(struct _openslide_grid *_grid,
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
   struct region region;
 
+  // nothing to paint from a grid with no tiles; the occupied-range
+  // bounds below still hold their sentinel values and would overflow
+  // the clip arithmetic
+  if (grid->max_col < grid->min_col) {
+    return true;
+  }
+
   compute_region(_grid, x, y, w, h, &region);
 
   //g_debug("coords: %g %g", x, y);
@@ -481,9 +668,28 @@ static bool tilemap_paint_region(struct _openslide_grid *_grid,
                   -grid->extra_tiles_left * grid->base.tile_advance_x,
                   -grid->extra_tiles_top * grid->base.tile_advance_y);
 
+  // clip to the occupied tile range; indices outside it hold no tiles
+  // and would only generate per-tile lookup misses, and the skipped
+  // area keeps the background already painted by the caller
+  int64_t skipped_tiles_x = MAX(grid->min_col - region.start_tile_x,
+                                (int64_t) 0);
+  int64_t skipped_tiles_y = MAX(grid->min_row - region.start_tile_y,
+                                (int64_t) 0);
+  cairo_translate(cr,
+                  skipped_tiles_x * grid->base.tile_advance_x,
+                  skipped_tiles_y * grid->base.tile_advance_y);
+  region.start_tile_x += skipped_tiles_x;
+  region.start_tile_y += skipped_tiles_y;
+  region.end_tile_x = MIN(region.end_tile_x, grid->max_col + 1);
+  region.end_tile_y = MIN(region.end_tile_y, grid->max_row + 1);
+
   // read
-  bool result = read_tiles(cr, level, _grid, &region,
-                           tilemap_read_tile, arg, err);
+  bool result = true;
+  if (region.start_tile_x < region.end_tile_x &&
+      region.start_tile_y < region.end_tile_y) {
+    result = read_tiles(cr, level, _grid, &region,
+                        tilemap_read_tile, arg, err);
+  }
 
   // restore
   cairo_set_matrix(cr, &matrix);
@@ -494,7 +700,15 @@ static bool tilemap_paint_region(struct _openslide_grid *_grid,
 static void tilemap_destroy(struct _openslide_grid *_grid) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
 
-  g_hash_table_destroy(grid->tiles);
+  if (grid->destroy_tile) {
+    for (int64_t i = 0; i < grid->slot_count; i++) {
+      struct tilemap_tile *tile = &grid->tiles[i];
+      if (tile->col != TILEMAP_EMPTY_COL && tile->data) {
+        grid->destroy_tile(tile->data);
+      }
+    }
+  }
+  g_free(grid->tiles);
   g_slice_free(struct tilemap_grid, grid);
 }
 
@@ -511,9 +725,31 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
                                       void *data) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
   g_assert(grid->base.ops == &tilemap_grid_ops);
+  g_assert(col != TILEMAP_EMPTY_COL);
+
+  // grow at 3/4 load so probe runs stay short
+  if (grid->tile_count + 1 > grid->slot_count - grid->slot_count / 4) {
+    struct tilemap_tile *old_tiles = grid->tiles;
+    int64_t old_slot_count = grid->slot_count;
+    tilemap_table_init(grid, old_slot_count * 2);
+    for (int64_t i = 0; i < old_slot_count; i++) {
+      if (old_tiles[i].col != TILEMAP_EMPTY_COL) {
+        *tilemap_probe(grid, old_tiles[i].col, old_tiles[i].row) =
+          old_tiles[i];
+      }
+    }
+    g_free(old_tiles);
+  }
 
-  struct tilemap_tile *tile = g_slice_new0(struct tilemap_tile);
-  tile->grid = grid;
+  struct tilemap_tile *tile = tilemap_probe(grid, col, row);
+  if (tile->col != TILEMAP_EMPTY_COL) {
+    // replacing an existing tile
+    if (grid->destroy_tile && tile->data) {
+      grid->destroy_tile(tile->data);
+    }
+  } else {
+    grid->tile_count++;
+  }
   tile->col = col;
   tile->row = row;
   tile->offset_x = offset_x;
@@ -522,8 +758,6 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
   tile->h = h;
   tile->data = data;
 
-  g_hash_table_replace(grid->tiles, tile, tile);
-
   grid->left = MIN(col * grid->base.tile_advance_x + offset_x,
                    grid->left);
   grid->top = MIN(row * grid->base.tile_advance_y + offset_y,
@@ -533,6 +767,11 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
   grid->bottom = MAX(row * grid->base.tile_advance_y + offset_y + h,
                      grid->bottom);
 
+  grid->min_col = MIN(grid->min_col, col);
+  grid->max_col = MAX(grid->max_col, col);
+  grid->min_row = MIN(grid->min_row, row);
+  grid->max_row = MAX(grid->max_row, row);
+
   if (offset_x < 0) {
     // extra on right
     int32_t extra_right = ceil(-offset_x / grid->base.tile_advance_x);
@@ -577,37 +816,36 @@ struct _openslide_grid *_openslide_grid_create_tilemap(openslide_t *osr,
   grid->left = INFINITY;
   grid->right = -INFINITY;
 
-  grid->tiles = g_hash_table_new_full(tilemap_tile_hash_func,
-                                      tilemap_tile_hash_key_equal,
-                                      NULL,
-                                      tilemap_tile_hash_destroy_value);
+  grid->min_col = G_MAXINT64;
+  grid->max_col = G_MININT64;
+  grid->min_row = G_MAXINT64;
+  grid->max_row = G_MININT64;
+
+  tilemap_table_init(grid, 64);
 
   return (struct _openslide_grid *) grid;
 }
 
 
 
-static guint range_bin_address_hash_func(gconstpointer key) {
-  const struct range_bin_address *addr = key;
-
-  // assume 32-bit hash
-  return (guint) ((34369 * (uint64_t) addr->row) + ((uint64_t) addr->col));
-}
-
-static gboolean range_bin_address_hash_key_equal(gconstpointer a,
-                                                 gconstpointer b) {
-  const struct range_bin_address *c_a = a;
-  const struct range_bin_address *c_b = b;
+// comparators for Sort-Tile-Recursive bulk loading: tiles are sorted by
+// x-center, sliced, and each slice sorted by y-center
+static int range_compare_tile_center_x(const void *a, const void *b) {
+  const struct range_tile *c_a = *(const struct range_tile *const *) a;
+  const struct range_tile *c_b = *(const struct range_tile *const *) b;
 
-  return (c_a->col == c_b->col) && (c_a->row == c_b->row);
+  double cx_a = c_a->x + c_a->w / 2;
+  double cx_b = c_b->x + c_b->w / 2;
+  return (cx_a > cx_b) - (cx_a < cx_b);
 }
 
-static void range_bin_address_free(void *data) {
-  g_slice_free(struct range_bin_address, data);
-}
+static int range_compare_tile_center_y(const void *a, const void *b) {
+  const struct range_tile *c_a = *(const struct range_tile *const *) a;
+  const struct range_tile *c_b = *(const struct range_tile *const *) b;
 
-static void range_ptr_array_free(void *data) {
-  g_ptr_array_free(data, true);
+  double cy_a = c_a->y + c_a->h / 2;
+  double cy_b = c_b->y + c_b->h / 2;
+  return (cy_a > cy_b) - (cy_a < cy_b);
 }
 
 static int range_compare_tiles(gconstpointer a, gconstpointer b) {
@@ -639,6 +877,51 @@ static void range_get_bounds(struct _openslide_grid *_grid,
   }
 }
 
+// recursively collect tiles intersecting the query rectangle, starting
+// from node node_idx.  labels visited leaves when cr is non-NULL
+static void range_query(struct range_grid *grid, int32_t node_idx,
+                        double x, double y, int32_t w, int32_t h,
+                        GList **tiles, cairo_t *cr) {
+  struct range_node *node = &grid->nodes[node_idx];
+
+  if (node->x1 <= x || node->y1 <= y ||
+      node->x0 >= x + w || node->y0 >= y + h) {
+    return;
+  }
+
+  if (!node->leaf) {
+    for (int32_t i = 0; i < node->count; i++) {
+      range_query(grid, node->first + i, x, y, w, h, tiles, cr);
+    }
+    return;
+  }
+
+  for (int32_t i = 0; i < node->count; i++) {
+    struct range_tile *tile = grid->sorted[node->first + i];
+    // skip tile if it's outside the requested region
+    if (tile->x + tile->w <= x ||
+        tile->y + tile->h <= y ||
+        tile->x >= x + w ||
+        tile->y >= y + h) {
+      //g_debug("skip x %g w %g y %g h %g, region x %g w %d y %g h %d", tile->x, tile->w, tile->y, tile->h, x, w, y, h);
+      continue;
+    }
+    *tiles = g_list_prepend(*tiles, tile);
+  }
+
+  if (cr) {
+    cairo_matrix_t matrix;
+    cairo_get_matrix(cr, &matrix);
+    char *coordinates = g_strdup_printf("%"PRId32, node_idx);
+    cairo_translate(cr, node->x0 - x, node->y0 - y);
+    label_tile(cr, COLOR_NODE,
+               node->x1 - node->x0, node->y1 - node->y0,
+               coordinates);
+    cairo_set_matrix(cr, &matrix);
+    g_free(coordinates);
+  }
+}
+
 static bool range_paint_region(struct _openslide_grid *_grid,
                                cairo_t *cr,
                                void *arg,
@@ -651,62 +934,23 @@ static bool range_paint_region(struct _openslide_grid *_grid,
   bool result = false;
 
   // ensure _openslide_grid_range_finish_adding_tiles() was called
-  g_assert(grid->bins_runtime);
+  g_assert(grid->finished);
 
   // save
   cairo_matrix_t matrix;
   cairo_get_matrix(cr, &matrix);
 
   // accumulate relevant tiles
-  struct range_bin_address addr;
-  for (addr.row = y / grid->bin_height;
-       addr.row < (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
-       addr.row++) {
-    for (addr.col = x / grid->bin_width;
-         addr.col < (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
-         addr.col++) {
-      struct range_tile **cur = g_hash_table_lookup(grid->bins_runtime,
-                                                    &addr);
-      if (cur) {
-        for (; *cur; cur++) {
-          struct range_tile *tile = *cur;
-          // skip tile if it's outside the requested region
-          if (tile->x + tile->w <= x ||
-              tile->y + tile->h <= y ||
-              tile->x >= x + w ||
-              tile->y >= y + h) {
-            //g_debug("skip x %g w %g y %g h %g, region x %g w %d y %g h %d", tile->x, tile->w, tile->y, tile->h, x, w, y, h);
-            continue;
-          }
-          tiles = g_list_prepend(tiles, tile);
-        }
-      }
-      if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
-        char *coordinates = g_strdup_printf("%"PRId64", %"PRId64,
-                                            addr.col, addr.row);
-        cairo_translate(cr,
-                        addr.col * grid->bin_width - x,
-                        addr.row * grid->bin_height - y);
-        label_tile(cr, COLOR_BIN,
-                   grid->bin_width, grid->bin_height,
-                   coordinates);
-        cairo_set_matrix(cr, &matrix);
-        g_free(coordinates);
-      }
-    }
+  if (grid->root != -1) {
+    range_query(grid, grid->root, x, y, w, h, &tiles,
+                _openslide_debug(OPENSLIDE_DEBUG_TILES) ? cr : NULL);
   }
   tiles = g_list_sort(tiles, range_compare_tiles);
 
-  // draw tiles
-  struct range_tile *prev_tile = NULL;
+  // draw tiles; the tree reports each tile exactly once
   for (GList *cur = tiles; cur; cur = cur->next) {
     // get tile struct
     struct range_tile *tile = cur->data;
-    if (tile == prev_tile) {
-      //g_debug("skipping repeated tile");
-      continue;
-    }
-    prev_tile = tile;
 
     // draw
     //g_debug("tile x %g y %g", tile->x, tile->y);
@@ -736,12 +980,8 @@ DONE:
 static void range_destroy(struct _openslide_grid *_grid) {
   struct range_grid *grid = (struct range_grid *) _grid;
 
-  if (grid->bins_init) {
-    g_hash_table_destroy(grid->bins_init);
-  }
-  if (grid->bins_runtime) {
-    g_hash_table_destroy(grid->bins_runtime);
-  }
+  g_free(grid->sorted);
+  g_free(grid->nodes);
   for (uint64_t cur = 0; cur < grid->tiles->len; cur++) {
     struct range_tile *tile = grid->tiles->pdata[cur];
     if (grid->destroy_tile && tile->data) {
@@ -765,7 +1005,7 @@ void _openslide_grid_range_add_tile(struct _openslide_grid *_grid,
                                     void *data) {
   struct range_grid *grid = (struct range_grid *) _grid;
   g_assert(grid->base.ops == &range_grid_ops);
-  g_assert(grid->bins_init);
+  g_assert(!grid->finished);
 
   struct range_tile *tile = g_slice_new0(struct range_tile);
   tile->id = grid->tiles->len;
@@ -776,62 +1016,96 @@ void _openslide_grid_range_add_tile(struct _openslide_grid *_grid,
   tile->h = h;
   g_ptr_array_add(grid->tiles, tile);
 
-  struct range_bin_address addr;
-  for (addr.row = y / grid->bin_height;
-       addr.row < (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
-       addr.row++) {
-    for (addr.col = x / grid->bin_width;
-         addr.col < (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
-         addr.col++) {
-      GPtrArray *bin = g_hash_table_lookup(grid->bins_init, &addr);
-      if (!bin) {
-        bin = g_ptr_array_new();
-        struct range_bin_address *addr2 =
-          g_slice_new(struct range_bin_address);
-        addr2->col = addr.col;
-        addr2->row = addr.row;
-        g_hash_table_insert(grid->bins_init, addr2, bin);
-      }
-      g_ptr_array_add(bin, tile);
-    }
-  }
-
   grid->left = MIN(x, grid->left);
   grid->top = MIN(y, grid->top);
   grid->right = MAX(x + w, grid->right);
   grid->bottom = MAX(y + h, grid->bottom);
 }
 
-static void range_postprocess_bin(void *key, void *value, void *data) {
-  struct range_grid *grid = data;
-  GPtrArray *tiles = value;
-
-  struct range_tile **tile_array = g_new(struct range_tile *, tiles->len + 1);
-  memcpy(tile_array, tiles->pdata, tiles->len * sizeof(struct range_tile *));
-  tile_array[tiles->len] = NULL;
-  g_ptr_array_free(tiles, true);
-
-  g_hash_table_replace(grid->bins_runtime, key, tile_array);
+// build one node over the children in [first, first + count), taking
+// bounding boxes from either the sorted tile array or the child nodes
+static int32_t range_pack_node(struct range_grid *grid, int32_t node_count,
+                               int32_t first, int32_t count, bool leaf) {
+  struct range_node *node = &grid->nodes[node_count];
+  node->first = first;
+  node->count = count;
+  node->leaf = leaf;
+  node->x0 = INFINITY;
+  node->y0 = INFINITY;
+  node->x1 = -INFINITY;
+  node->y1 = -INFINITY;
+  for (int32_t i = first; i < first + count; i++) {
+    if (leaf) {
+      struct range_tile *tile = grid->sorted[i];
+      node->x0 = MIN(node->x0, tile->x);
+      node->y0 = MIN(node->y0, tile->y);
+      node->x1 = MAX(node->x1, tile->x + tile->w);
+      node->y1 = MAX(node->y1, tile->y + tile->h);
+    } else {
+      struct range_node *child = &grid->nodes[i];
+      node->x0 = MIN(node->x0, child->x0);
+      node->y0 = MIN(node->y0, child->y0);
+      node->x1 = MAX(node->x1, child->x1);
+      node->y1 = MAX(node->y1, child->y1);
+    }
+  }
+  return node_count + 1;
 }
 
 void _openslide_grid_range_finish_adding_tiles(struct _openslide_grid *_grid) {
   struct range_grid *grid = (struct range_grid *) _grid;
   g_assert(grid->base.ops == &range_grid_ops);
-  g_assert(grid->bins_init);
+  g_assert(!grid->finished);
+
+  grid->finished = true;
+  grid->root = -1;
+
+  int32_t n = grid->tiles->len;
+  if (!n) {
+    return;
+  }
 
-  grid->bins_runtime = g_hash_table_new_full(range_bin_address_hash_func,
-                                             range_bin_address_hash_key_equal,
-                                             range_bin_address_free,
-                                             g_free);
-  g_hash_table_foreach(grid->bins_init, range_postprocess_bin, grid);
-  g_hash_table_steal_all(grid->bins_init);
-  g_hash_table_destroy(grid->bins_init);
-  grid->bins_init = NULL;
+  // Sort-Tile-Recursive ordering: sort tiles by x-center, cut into
+  // vertical slices, and sort each slice by y-center, so consecutive
+  // runs of tiles have compact bounding boxes
+  grid->sorted = g_new(struct range_tile *, n);
+  memcpy(grid->sorted, grid->tiles->pdata, n * sizeof(struct range_tile *));
+  int32_t leaves = (n + RANGE_RTREE_FANOUT - 1) / RANGE_RTREE_FANOUT;
+  int32_t slices = ceil(sqrt((double) leaves));
+  int32_t per_slice = (n + slices - 1) / slices;
+  qsort(grid->sorted, n, sizeof(struct range_tile *),
+        range_compare_tile_center_x);
+  for (int32_t i = 0; i < n; i += per_slice) {
+    qsort(grid->sorted + i, MIN(per_slice, n - i),
+          sizeof(struct range_tile *), range_compare_tile_center_y);
+  }
+
+  // pack the tree bottom-up; each level groups runs of FANOUT children,
+  // so the node count is bounded by 2 * leaves
+  grid->nodes = g_new(struct range_node, 2 * leaves);
+  int32_t node_count = 0;
+  for (int32_t i = 0; i < n; i += RANGE_RTREE_FANOUT) {
+    node_count = range_pack_node(grid, node_count, i,
+                                 MIN(RANGE_RTREE_FANOUT, n - i), true);
+  }
+  int32_t level_first = 0;
+  int32_t level_count = node_count;
+  while (level_count > 1) {
+    int32_t next_first = node_count;
+    for (int32_t i = 0; i < level_count; i += RANGE_RTREE_FANOUT) {
+      node_count = range_pack_node(grid, node_count, level_first + i,
+                                   MIN(RANGE_RTREE_FANOUT, level_count - i),
+                                   false);
+    }
+    level_first = next_first;
+    level_count = node_count - next_first;
+  }
+  grid->root = node_count - 1;
 }
 
 struct _openslide_grid *_openslide_grid_create_range(openslide_t *osr,
-                                                     int typical_tile_width,
-                                                     int typical_tile_height,
+                                                     int typical_tile_width G_GNUC_UNUSED,
+                                                     int typical_tile_height G_GNUC_UNUSED,
                                                      _openslide_grid_range_read_fn read_tile,
                                                      GDestroyNotify destroy_tile) {
   struct range_grid *grid = g_slice_new0(struct range_grid);
@@ -839,13 +1113,8 @@ struct _openslide_grid *_openslide_grid_create_range(openslide_t *osr,
   grid->base.ops = &range_grid_ops;
   grid->base.tile_advance_x = NAN;  // unused
   grid->base.tile_advance_y = NAN;  // unused
-  grid->bin_width = typical_tile_width * RANGE_BIN_SIZE_MULTIPLIER;
-  grid->bin_height = typical_tile_height * RANGE_BIN_SIZE_MULTIPLIER;
   grid->tiles = g_ptr_array_new();
-  grid->bins_init = g_hash_table_new_full(range_bin_address_hash_func,
-                                          range_bin_address_hash_key_equal,
-                                          range_bin_address_free,
-                                          range_ptr_array_free);
+  grid->root = -1;
   grid->read_tile = read_tile;
   grid->destroy_tile = destroy_tile;
 
@@ -886,7 +1155,12 @@ bool _openslide_grid_paint_region(struct _openslide_grid *grid,
                                   struct _openslide_level *level,
                                   int32_t w, int32_t h,
                                   GError **err) {
-  return grid->ops->paint_region(grid, cr, arg, x, y, level, w, h, err);
+  _OPENSLIDE_PROBE6(paint_region__start, grid->osr, level,
+                    (int64_t) x, (int64_t) y, w, h);
+  bool success = grid->ops->paint_region(grid, cr, arg, x, y, level, w, h,
+                                         err);
+  _OPENSLIDE_PROBE2(paint_region__done, grid->osr, success);
+  return success;
 }
 
 void _openslide_grid_destroy(struct _openslide_grid *grid) {
@@ -29,14 +29,50 @@
 #include <string.h>
 #include <glib.h>
 
+// Hash inputs are recorded during open but not hashed until the value is
+// first requested.  Formats like MIRAX hash the entire lowest-resolution
+// level, which costs hundreds of milliseconds of I/O that many callers
+// never need; recording (filename, offset, size) instead defers that
+// I/O until openslide.quickhash-1 is actually read.  In-memory buffers
+// are copied into the log, since they are only valid during open.
+
+enum hash_op_type {
+  HASH_OP_DATA,
+  HASH_OP_FILE_PART,
+};
+
+struct hash_op {
+  enum hash_op_type type;
+
+  // HASH_OP_DATA
+  void *data;
+  int32_t datalen;
+
+  // HASH_OP_FILE_PART
+  char *filename;
+  int64_t offset;
+  int64_t size;  // -1 for end of file
+};
+
 struct _openslide_hash {
-  GChecksum *checksum;
+  GQueue *ops;  // deferred inputs, in order
+  GMutex *lock;  // guards resolution
+  GChecksum *checksum;  // created during resolution
+  const char *result;  // owned by checksum; NULL if failed
   bool enabled;
+  bool resolved;
 };
 
+static void hash_op_free(struct hash_op *op) {
+  g_free(op->data);
+  g_free(op->filename);
+  g_slice_free(struct hash_op, op);
+}
+
 struct _openslide_hash *_openslide_hash_quickhash1_create(void) {
-  struct _openslide_hash *hash = g_slice_new(struct _openslide_hash);
-  hash->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  struct _openslide_hash *hash = g_slice_new0(struct _openslide_hash);
+  hash->ops = g_queue_new();
+  hash->lock = g_mutex_new();
   hash->enabled = true;
 
   return hash;
@@ -45,7 +81,11 @@ struct _openslide_hash *_openslide_hash_quickhash1_create(void) {
 void _openslide_hash_data(struct _openslide_hash *hash, const void *data,
                           int32_t datalen) {
   if (hash && hash->enabled && data && datalen) {
-    g_checksum_update(hash->checksum, data, datalen);
+    struct hash_op *op = g_slice_new0(struct hash_op);
+    op->type = HASH_OP_DATA;
+    op->data = g_memdup(data, datalen);
+    op->datalen = datalen;
+    g_queue_push_tail(hash->ops, op);
   }
 }
 
@@ -62,7 +102,23 @@ bool _openslide_hash_file(struct _openslide_hash *hash, const char *filename,
 bool _openslide_hash_file_part(struct _openslide_hash *hash,
 			       const char *filename,
 			       int64_t offset, int64_t size,
-			       GError **err) {
+			       GError **err G_GNUC_UNUSED) {
+  if (hash && hash->enabled) {
+    struct hash_op *op = g_slice_new0(struct hash_op);
+    op->type = HASH_OP_FILE_PART;
+    op->filename = g_strdup(filename);
+    op->offset = offset;
+    op->size = size;
+    g_queue_push_tail(hash->ops, op);
+  }
+  // I/O errors are reported when the hash is resolved
+  return true;
+}
+
+static bool checksum_file_part(GChecksum *checksum,
+                               const char *filename,
+                               int64_t offset, int64_t size,
+                               GError **err) {
   bool success = false;
 
   FILE *f = _openslide_fopen(filename, "rb", err);
@@ -91,6 +147,10 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
     goto DONE;
   }
 
+  // a straight scan of a known range
+  _openslide_fadvise_sequential(f);
+  _openslide_fadvise_willneed(f, offset, size);
+
   int64_t bytes_left = size;
   while (bytes_left > 0) {
     int64_t bytes_to_read = MIN((int64_t) sizeof buf, bytes_left);
@@ -106,7 +166,7 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
 
     bytes_left -= bytes_read;
 
-    _openslide_hash_data(hash, buf, bytes_read);
+    g_checksum_update(checksum, buf, bytes_read);
   }
 
   success = true;
@@ -116,6 +176,39 @@ DONE:
   return success;
 }
 
+// run the deferred work log; call with hash->lock held
+static void resolve(struct _openslide_hash *hash) {
+  GError *tmp_err = NULL;
+
+  hash->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+  struct hash_op *op;
+  while ((op = g_queue_pop_head(hash->ops))) {
+    if (hash->result == NULL && tmp_err == NULL) {
+      switch (op->type) {
+      case HASH_OP_DATA:
+        g_checksum_update(hash->checksum, op->data, op->datalen);
+        break;
+      case HASH_OP_FILE_PART:
+        checksum_file_part(hash->checksum, op->filename,
+                           op->offset, op->size, &tmp_err);
+        break;
+      }
+    }
+    hash_op_free(op);
+  }
+
+  if (tmp_err) {
+    // the slide opened successfully, so treat a hash failure like an
+    // unhashable slide rather than an error
+    g_warning("Couldn't compute quickhash-1: %s", tmp_err->message);
+    g_error_free(tmp_err);
+  } else {
+    hash->result = g_checksum_get_string(hash->checksum);
+  }
+  hash->resolved = true;
+}
+
 // Invalidate this hash.  Use if this slide is unhashable for some reason.
 void _openslide_hash_disable(struct _openslide_hash *hash) {
   if (hash) {
@@ -123,15 +216,31 @@ void _openslide_hash_disable(struct _openslide_hash *hash) {
   }
 }
 
+bool _openslide_hash_is_enabled(struct _openslide_hash *hash) {
+  return hash->enabled;
+}
+
 const char *_openslide_hash_get_string(struct _openslide_hash *hash) {
-  if (hash->enabled) {
-    return g_checksum_get_string(hash->checksum);
-  } else {
+  if (!hash->enabled) {
     return NULL;
   }
+  g_mutex_lock(hash->lock);
+  if (!hash->resolved) {
+    resolve(hash);
+  }
+  g_mutex_unlock(hash->lock);
+  return hash->result;
 }
 
 void _openslide_hash_destroy(struct _openslide_hash *hash) {
-  g_checksum_free(hash->checksum);
+  struct hash_op *op;
+  while ((op = g_queue_pop_head(hash->ops))) {
+    hash_op_free(op);
+  }
+  g_queue_free(hash->ops);
+  g_mutex_free(hash->lock);
+  if (hash->checksum) {
+    g_checksum_free(hash->checksum);
+  }
   g_slice_free(struct _openslide_hash, hash);
 }
@@ -50,7 +50,10 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
 // lockout
 void _openslide_hash_disable(struct _openslide_hash *hash);
 
-// accessor
+// accessors
+bool _openslide_hash_is_enabled(struct _openslide_hash *hash);
+
+// runs the deferred work log on first call; thread-safe
 const char *_openslide_hash_get_string(struct _openslide_hash *hash);
 
 // destructor
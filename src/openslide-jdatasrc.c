@@ -219,17 +219,22 @@ void _openslide_jpeg_stdio_src (j_decompress_ptr cinfo, FILE * infile)
    * This makes it unsafe to use this manager and a different source
    * manager serially with the same JPEG object.  Caveat programmer.
    */
+  /* Both source managers allocate the same struct so that a pooled JPEG
+   * object can alternate between them; see _openslide_jpeg_mem_src().
+   */
   if (cinfo->src == NULL) {	/* first time for this JPEG object? */
     cinfo->src = (struct jpeg_source_mgr *)
       (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
 				  sizeof(my_source_mgr));
-    src = (my_src_ptr) cinfo->src;
+    ((my_src_ptr) cinfo->src)->buffer = NULL;
+  }
+
+  src = (my_src_ptr) cinfo->src;
+  if (src->buffer == NULL) {
     src->buffer = (JOCTET *)
       (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
 				  INPUT_BUF_SIZE * sizeof(JOCTET));
   }
-
-  src = (my_src_ptr) cinfo->src;
   src->pub.init_source = init_source;
   src->pub.fill_input_buffer = fill_input_buffer;
   src->pub.skip_input_data = skip_input_data;
@@ -257,11 +262,14 @@ void _openslide_jpeg_mem_src (j_decompress_ptr cinfo,
   /* The source object is made permanent so that a series of JPEG images
    * can be read from the same buffer by calling jpeg_mem_src only before
    * the first one.
+   * Allocate the same struct as _openslide_jpeg_stdio_src() so that a
+   * pooled JPEG object can be handed to either manager in any order.
    */
   if (cinfo->src == NULL) {	/* first time for this JPEG object? */
     cinfo->src = (struct jpeg_source_mgr *)
       (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
-				  sizeof(struct jpeg_source_mgr));
+				  sizeof(my_source_mgr));
+    ((my_src_ptr) cinfo->src)->buffer = NULL;
   }
 
   src = cinfo->src;
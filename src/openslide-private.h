@@ -51,6 +51,23 @@ struct _openslide_associated_image_ops {
   void (*destroy)(struct _openslide_associated_image *img);
 };
 
+/* codec identifiers for decode statistics */
+enum _openslide_codec {
+  _OPENSLIDE_CODEC_JPEG,
+  _OPENSLIDE_CODEC_JP2K,
+  _OPENSLIDE_CODEC_TIFF,
+  _OPENSLIDE_CODEC_PNG,
+  _OPENSLIDE_CODEC_OTHER,
+  _OPENSLIDE_CODEC_LAST
+};
+
+/* per-codec decode counters */
+struct _openslide_decode_stats {
+  int64_t tiles;  // tiles decoded
+  int64_t bytes;  // compressed bytes read
+  int64_t usec;   // cumulative decode time, in microseconds
+};
+
 /* the main structure */
 struct _openslide {
   const struct _openslide_ops *ops;
@@ -69,6 +86,49 @@ struct _openslide {
   // cache
   struct _openslide_cache *cache;
 
+  // optional persistent tile cache, NULL if disabled
+  struct _openslide_diskcache *diskcache;
+
+  // lazily-resolved quickhash-1, NULL if unhashable
+  struct _openslide_hash *quickhash1;
+
+  // worker pool for concurrent tile decode, NULL if disabled
+  GThreadPool *decode_pool;
+
+  // executor for asynchronous region reads, NULL if never used
+  GThreadPool *async_pool;
+  GMutex *async_lock;
+  GCond *async_finished;
+  int async_pending;
+
+  // background tile prefetcher, NULL if never used
+  GThreadPool *prefetch_pool;
+  GHashTable *prefetch_hints;  // id -> struct prefetch_hint
+  GMutex *prefetch_lock;
+  int next_prefetch_id;
+  int prefetch_threads;  // 0 ignores prefetch hints
+
+  // decode statistics, protected by stats_lock
+  GMutex *stats_lock;
+  struct _openslide_decode_stats decode_stats[_OPENSLIDE_CODEC_LAST];
+
+  // handle sharing; all fields protected by the registry lock.
+  // registry_key is NULL for private handles
+  int handle_refs;
+  char *registry_key;
+  int64_t registry_size;   // file size at open, for staleness checks
+  int64_t registry_mtime;  // likewise
+
+  // synthesized pyramid levels spliced into sparse gaps; NULL if none.
+  // levels/level_count then hold the combined array, and the backend's
+  // own array is kept here and restored before ops->destroy
+  GHashTable *synth_levels;  // level pointer -> struct synthetic_level
+  struct _openslide_level **backend_levels;
+  int32_t backend_level_count;
+
+  // access-trace id, 0 when tracing is disabled
+  int64_t trace_id;
+
   // error handling, NULL if no error
   gpointer error; // must use g_atomic_pointer!
 };
@@ -83,6 +143,11 @@ struct _openslide_level {
   // all levels must set these, or none
   int64_t tile_w;
   int64_t tile_h;
+
+  // set by backends whose cached tiles at (level, col, row) are exact
+  // tile_w x tile_h rectangles at (col * tile_w, row * tile_h) in level
+  // coordinates; enables the cairo-bypass fast path for aligned reads
+  bool aligned_tiles;
 };
 
 /* the function pointer structure for backends */
@@ -92,6 +157,15 @@ struct _openslide_ops {
 		       struct _openslide_level *level,
 		       int32_t w, int32_t h,
 		       GError **err);
+  // optional; fetch one tile's raw compressed bytes for zero-decode
+  // serving.  *buf is g_malloc'd and includes codec headers (e.g. JPEG
+  // tables); *codec is a static string naming the compression
+  bool (*read_raw_tile)(openslide_t *osr,
+			struct _openslide_level *level,
+			int64_t tile_col, int64_t tile_row,
+			void **buf, int64_t *len,
+			const char **codec,
+			GError **err);
   void (*destroy)(openslide_t *osr);
 };
 
@@ -116,6 +190,10 @@ struct _openslide_tifflike;
 struct _openslide_format {
   const char *name;
   const char *vendor;
+  // cheap candidate check (filename extension, tifflike presence); must
+  // not do I/O.  NULL means the format is always a candidate.  detect()
+  // is only called when this returns true
+  bool (*sniff)(const char *filename, struct _openslide_tifflike *tl);
   bool (*detect)(const char *filename, struct _openslide_tifflike *tl,
                  GError **err);
   bool (*open)(openslide_t *osr, const char *filename,
@@ -146,6 +224,11 @@ GKeyFile *_openslide_read_key_file(const char *filename, int32_t max_size,
 /* fopen() wrapper which properly sets FD_CLOEXEC */
 FILE *_openslide_fopen(const char *path, const char *mode, GError **err);
 
+// best-effort page-cache access-pattern hints; no-ops where unsupported
+void _openslide_fadvise_random(FILE *f);
+void _openslide_fadvise_sequential(FILE *f);
+void _openslide_fadvise_willneed(FILE *f, int64_t offset, int64_t length);
+
 /* Parse string to double, returning NAN on failure.  Accept both comma
    and period as decimal separator. */
 double _openslide_parse_double(const char *value);
@@ -153,6 +236,64 @@ double _openslide_parse_double(const char *value);
 /* Serialize double to string */
 char *_openslide_format_double(double d);
 
+/* Number of online processors, >= 1 */
+int _openslide_num_processors(void);
+
+/* Current wall-clock time in microseconds, for decode statistics */
+int64_t _openslide_now_usec(void);
+
+/* Process-wide budget for idle pooled handles.  A pool of long-lived
+   handles registers a trim callback, accounts each idle handle it
+   retains with retain()/release(), and closes one idle handle whenever
+   its trim callback runs.  retain() returns false if the budget is
+   exhausted and nothing could be reclaimed, in which case the caller
+   should close the handle instead of pooling it. */
+typedef void (*_openslide_handle_trim_fn)(void *data);
+void *_openslide_handle_pool_register(_openslide_handle_trim_fn trim,
+                                      void *data);
+void _openslide_handle_pool_unregister(void *pool);
+bool _openslide_handle_pool_retain(void *pool);
+void _openslide_handle_pool_release(void *pool);
+
+/* Record a decoded tile in the per-slide statistics; osr may be NULL */
+/* Access tracing (openslide-trace.c): when the OPENSLIDE_TRACE_FILE
+   environment variable is set, every region read is appended to a
+   compact binary log for offline replay with test/replay */
+void _openslide_trace_open(openslide_t *osr, const char *filename);
+void _openslide_trace_read_region(openslide_t *osr,
+                                  int64_t x, int64_t y,
+                                  int32_t level,
+                                  int64_t w, int64_t h);
+void _openslide_trace_flush(void);
+
+void _openslide_stats_record_decode(openslide_t *osr,
+                                    enum _openslide_codec codec,
+                                    int64_t bytes,
+                                    int64_t usec);
+
+/* USDT static tracepoints under provider "openslide", for attaching
+   bpftrace/systemtap/perf to a live process.  Compiled to nothing unless
+   configured with --enable-tracepoints. */
+#ifdef ENABLE_TRACEPOINTS
+#include <sys/sdt.h>
+#define _OPENSLIDE_PROBE2(name, a, b) \
+      DTRACE_PROBE2(openslide, name, a, b)
+#define _OPENSLIDE_PROBE3(name, a, b, c) \
+      DTRACE_PROBE3(openslide, name, a, b, c)
+#define _OPENSLIDE_PROBE4(name, a, b, c, d) \
+      DTRACE_PROBE4(openslide, name, a, b, c, d)
+#define _OPENSLIDE_PROBE5(name, a, b, c, d, e) \
+      DTRACE_PROBE5(openslide, name, a, b, c, d, e)
+#define _OPENSLIDE_PROBE6(name, a, b, c, d, e, f) \
+      DTRACE_PROBE6(openslide, name, a, b, c, d, e, f)
+#else
+#define _OPENSLIDE_PROBE2(name, a, b) do {} while (0)
+#define _OPENSLIDE_PROBE3(name, a, b, c) do {} while (0)
+#define _OPENSLIDE_PROBE4(name, a, b, c, d) do {} while (0)
+#define _OPENSLIDE_PROBE5(name, a, b, c, d, e) do {} while (0)
+#define _OPENSLIDE_PROBE6(name, a, b, c, d, e, f) do {} while (0)
+#endif
+
 /* Duplicate OpenSlide properties */
 void _openslide_duplicate_int_prop(openslide_t *osr, const char *src,
                                    const char *dest);
@@ -203,6 +344,17 @@ struct _openslide_grid *_openslide_grid_create_simple(openslide_t *osr,
                                                       int32_t tile_h,
                                                       _openslide_grid_simple_read_fn read_tile);
 
+// like the simple grid, but with a constant tile advance smaller than
+// the tile size, for formats with perfectly regular overlaps
+struct _openslide_grid *_openslide_grid_create_stride(openslide_t *osr,
+                                                      int64_t tiles_across,
+                                                      int64_t tiles_down,
+                                                      double tile_w,
+                                                      double tile_h,
+                                                      double tile_advance_x,
+                                                      double tile_advance_y,
+                                                      _openslide_grid_simple_read_fn read_tile);
+
 struct _openslide_grid *_openslide_grid_create_tilemap(openslide_t *osr,
                                                        double tile_advance_x,
                                                        double tile_advance_y,
@@ -256,18 +408,39 @@ void _openslide_set_bounds_props_from_grid(openslide_t *osr,
 struct _openslide_cache_entry;
 
 // constructor/destructor
-struct _openslide_cache *_openslide_cache_create(int capacity_in_bytes);
+struct _openslide_cache *_openslide_cache_create(int64_t capacity_in_bytes);
+
+struct _openslide_cache *_openslide_cache_ref(struct _openslide_cache *cache);
 
 void _openslide_cache_destroy(struct _openslide_cache *cache);
 
 // cache size
-int _openslide_cache_get_capacity(struct _openslide_cache *cache);
+int64_t _openslide_cache_get_capacity(struct _openslide_cache *cache);
 
 void _openslide_cache_set_capacity(struct _openslide_cache *cache,
-				   int capacity_in_bytes);
+				   int64_t capacity_in_bytes);
+
+// process-wide shared cache
+struct _openslide_cache *_openslide_cache_shared_ref(void);
+
+void _openslide_cache_shared_set_capacity(int64_t capacity_in_bytes);
+
+int64_t _openslide_cache_shared_get_capacity(void);
+
+// counters
+struct _openslide_cache_stats {
+  int64_t hits;
+  int64_t misses;
+  int64_t evictions;
+  int64_t puts;
+};
+
+void _openslide_cache_get_stats(struct _openslide_cache *cache,
+				struct _openslide_cache_stats *stats);
 
 // put and get
 void _openslide_cache_put(struct _openslide_cache *cache,
+			  void *owner,  // inserting slide, for purging at close
 			  void *plane,  // coordinate plane (level or grid)
 			  int64_t x,
 			  int64_t y,
@@ -275,15 +448,68 @@ void _openslide_cache_put(struct _openslide_cache *cache,
 			  int size_in_bytes,
 			  struct _openslide_cache_entry **entry);
 
+// remove every entry the owner inserted; planes are per-slide heap
+// pointers, so a closing slide must purge its entries from a shared
+// cache before they can alias a later slide's planes
+void _openslide_cache_purge_owner(struct _openslide_cache *cache,
+                                  void *owner);
+
 void *_openslide_cache_get(struct _openslide_cache *cache,
 			   void *plane,
 			   int64_t x,
 			   int64_t y,
 			   struct _openslide_cache_entry **entry);
 
+// read-only residency probe; does not count as a hit or touch the
+// replacement state
+bool _openslide_cache_contains(struct _openslide_cache *cache,
+                               void *plane,
+                               int64_t x,
+                               int64_t y);
+
+// the calling thread's openslide_set_cache_bypass() hint
+bool _openslide_cache_get_bypass(void);
+
 // value unref
 void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry);
 
+int _openslide_cache_entry_size(struct _openslide_cache_entry *entry);
+
+// cairo surface wrapping the entry's pixel data, created on first use
+// and kept for the life of the entry; owned by the entry, do not destroy
+cairo_surface_t *_openslide_cache_entry_surface(struct _openslide_cache_entry *entry,
+                                                cairo_format_t format,
+                                                int64_t w,
+                                                int64_t h);
+
+/* Tile buffer pool: a recycling layer over g_slice for tile-sized
+   buffers.  Interchangeable with g_slice_alloc/g_slice_free1 of the
+   same size; cache entries return their buffers here on eviction */
+void *_openslide_tile_alloc(int64_t size);
+void *_openslide_tile_alloc0(int64_t size);
+void _openslide_tile_free(int64_t size, void *buf);
+
+
+/* Optional persistent tile cache (openslide-diskcache.c), enabled via
+   the OPENSLIDE_TILE_CACHE_DIR environment variable and keyed by
+   quickhash1 so entries survive process restarts */
+struct _openslide_diskcache;
+
+// returns NULL if the cache is disabled or quickhash1 is unavailable;
+// resolves the hash only if the cache is enabled
+struct _openslide_diskcache *_openslide_diskcache_open(struct _openslide_hash *quickhash1);
+
+void _openslide_diskcache_close(struct _openslide_diskcache *dc);
+
+// returns a g_malloc'd buffer, or NULL on miss
+void *_openslide_diskcache_get(struct _openslide_diskcache *dc,
+                               int32_t plane, int64_t x, int64_t y,
+                               int32_t *len);
+
+void _openslide_diskcache_put(struct _openslide_diskcache *dc,
+                              int32_t plane, int64_t x, int64_t y,
+                              const void *buf, int32_t len);
+
 
 /* Internal error propagation */
 enum OpenSlideError {
@@ -339,18 +565,30 @@ extern const int32_t _openslide_G_Cb[256];
 extern const int32_t _openslide_G_Cr[256];
 extern const int16_t _openslide_B_Cb[256];
 
-// deprecated prefetch stuff (maybe we'll undeprecate it someday),
-// still needs these declarations for ABI compat
-// TODO: remove if soname bump
-#undef openslide_give_prefetch_hint
-OPENSLIDE_PUBLIC()
-int openslide_give_prefetch_hint(openslide_t *osr,
-				 int64_t x, int64_t y,
-				 int32_t level,
-				 int64_t w, int64_t h);
-#undef openslide_cancel_prefetch_hint
-OPENSLIDE_PUBLIC()
-void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id);
+/* SIMD kernels with scalar fallbacks */
+// swap R and B channels in place (libtiff RGBA -> cairo ARGB)
+void _openslide_abgr_to_argb(uint32_t *buf, int64_t count);
+
+// one row of 4:2:2 YCbCr from int32 component buffers to 0xffRRGGBB
+void _openslide_ycbcr422_to_argb(const int32_t *Y,
+                                 const int32_t *Cb,
+                                 const int32_t *Cr,
+                                 uint32_t *dest,
+                                 int32_t w);
+
+// packed 48-bit RGB (little-endian words, 12 significant bits) to 0x00RRGGBB
+void _openslide_rgb48_to_xrgb(const uint16_t *src, uint32_t *dest,
+                              int64_t count);
+
+// premultiplied ARGB to packed 3-byte RGB, composited over opaque white
+void _openslide_argb_to_rgb24(const uint32_t *src, uint8_t *dest,
+                              int64_t count);
+
+// box-average packed ARGB down by an integer factor; strides in pixels
+void _openslide_box_downsample_argb(const uint32_t *src, int64_t src_stride,
+                                    uint32_t *dest, int64_t dest_stride,
+                                    int64_t dest_w, int64_t dest_h,
+                                    int32_t factor);
 
 /* Prevent use of dangerous functions and functions with mandatory wrappers.
    Every @p replacement must be unique to avoid conflicting-type errors. */
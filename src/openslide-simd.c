@@ -0,0 +1,273 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2016 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Vectorized pixel kernels.  Each kernel has a scalar fallback, so
+ * callers never need to know whether SIMD is available.
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <glib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+// YCbCr -> RGB coefficients in signed 2.14 fixed point.  The chroma
+// samples are pre-shifted left by 2 so that _mm_mulhi_epi16's >> 16
+// yields the >> 14 we want.
+#define FIX_R_CR  22970   // round(1.402   * 16384)
+#define FIX_G_CB   5638   // round(0.34414 * 16384)
+#define FIX_G_CR  11700   // round(0.71414 * 16384)
+#define FIX_B_CB  29032   // round(1.772   * 16384)
+
+// pack 8 OpenJPEG int32 samples into 8 int16 lanes
+static inline __m128i load_samples(const int32_t *p) {
+  return _mm_packs_epi32(_mm_loadu_si128((const __m128i *) p),
+                         _mm_loadu_si128((const __m128i *) (p + 4)));
+}
+
+// pack 4 chroma samples into 8 int16 lanes, each duplicated for the
+// two luma samples it covers, centered and pre-shifted for mulhi
+static inline __m128i load_chroma422(const int32_t *p) {
+  __m128i c = _mm_packs_epi32(_mm_loadu_si128((const __m128i *) p),
+                              _mm_setzero_si128());
+  c = _mm_unpacklo_epi16(c, c);
+  return _mm_slli_epi16(_mm_sub_epi16(c, _mm_set1_epi16(128)), 2);
+}
+
+// write 8 pixels of 0xffRRGGBB
+static inline void store_argb(uint32_t *dest,
+                              __m128i r, __m128i g, __m128i b) {
+  __m128i r8 = _mm_packus_epi16(r, r);
+  __m128i g8 = _mm_packus_epi16(g, g);
+  __m128i b8 = _mm_packus_epi16(b, b);
+  __m128i a8 = _mm_set1_epi8((char) 0xff);
+
+  __m128i bg = _mm_unpacklo_epi8(b8, g8);
+  __m128i ra = _mm_unpacklo_epi8(r8, a8);
+  _mm_storeu_si128((__m128i *) dest, _mm_unpacklo_epi16(bg, ra));
+  _mm_storeu_si128((__m128i *) (dest + 4), _mm_unpackhi_epi16(bg, ra));
+}
+#endif
+
+// Convert libtiff RGBA output (memory order R, G, B, A) to cairo-style
+// packed ARGB in place, by swapping the R and B channels of each pixel.
+void _openslide_abgr_to_argb(uint32_t *buf, int64_t count) {
+  int64_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i mask_ga = _mm_set1_epi32((int) 0xff00ff00);
+  const __m128i mask_br = _mm_set1_epi32(0x00ff00ff);
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((__m128i *) (buf + i));
+    __m128i br = _mm_and_si128(v, mask_br);
+    br = _mm_or_si128(_mm_srli_epi32(br, 16), _mm_slli_epi32(br, 16));
+    _mm_storeu_si128((__m128i *) (buf + i),
+                     _mm_or_si128(_mm_and_si128(v, mask_ga), br));
+  }
+#endif
+
+  for (; i < count; i++) {
+    uint32_t val = GUINT32_SWAP_LE_BE(buf[i]);
+    buf[i] = (val << 24) | (val >> 8);
+  }
+}
+
+// Convert one row of 4:2:2-subsampled YCbCr (one chroma sample per two
+// luma samples) to 0xffRRGGBB, reading OpenJPEG-style int32 component
+// buffers.  The SIMD path may differ from the lookup tables by one LSB
+// due to rounding.
+void _openslide_ycbcr422_to_argb(const int32_t *Y,
+                                 const int32_t *Cb,
+                                 const int32_t *Cr,
+                                 uint32_t *dest,
+                                 int32_t w) {
+  int32_t x = 0;
+
+#ifdef __SSE2__
+  for (; x + 8 <= w; x += 8) {
+    __m128i y16 = load_samples(Y + x);
+    __m128i cb = load_chroma422(Cb + x / 2);
+    __m128i cr = load_chroma422(Cr + x / 2);
+
+    __m128i r = _mm_add_epi16(y16,
+                              _mm_mulhi_epi16(cr, _mm_set1_epi16(FIX_R_CR)));
+    __m128i g = _mm_sub_epi16(y16,
+                 _mm_add_epi16(_mm_mulhi_epi16(cb, _mm_set1_epi16(FIX_G_CB)),
+                               _mm_mulhi_epi16(cr, _mm_set1_epi16(FIX_G_CR))));
+    __m128i b = _mm_add_epi16(y16,
+                              _mm_mulhi_epi16(cb, _mm_set1_epi16(FIX_B_CB)));
+
+    store_argb(dest + x, r, g, b);
+  }
+#endif
+
+  // scalar tail, and the whole row without SIMD
+  for (; x < w; x++) {
+    uint8_t c0 = Y[x];
+    uint8_t c1 = Cb[x / 2];
+    uint8_t c2 = Cr[x / 2];
+    int16_t R = c0 + _openslide_R_Cr[c2];
+    int16_t G = c0 + ((_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16);
+    int16_t B = c0 + _openslide_B_Cb[c1];
+
+    R = CLAMP(R, 0, 255);
+    G = CLAMP(G, 0, 255);
+    B = CLAMP(B, 0, 255);
+
+    dest[x] = 0xff000000 |
+      ((uint8_t) R << 16) | ((uint8_t) G << 8) | ((uint8_t) B);
+  }
+}
+
+// Convert packed 48-bit RGB (one little-endian 16-bit word per sample,
+// 12 significant bits) to 0x00RRGGBB, as produced by Hamamatsu NGR data.
+void _openslide_rgb48_to_xrgb(const uint16_t *src, uint32_t *dest,
+                              int64_t count) {
+  int64_t i = 0;
+
+#ifdef __SSE2__
+  // per half-register: R*256 + G in one dword, B in the next
+  const __m128i coeff = _mm_setr_epi16(256, 1, 1, 0, 256, 1, 1, 0);
+  for (; i + 4 <= count; i += 4) {
+    const uint16_t *p = src + i * 3;
+    // twelve words: [R0 G0 B0 R1 G1 B1 R2 G2] and [B2 R3 G3 B3]
+    __m128i a = _mm_srli_epi16(_mm_loadu_si128((const __m128i *) p), 4);
+    __m128i b = _mm_srli_epi16(_mm_loadl_epi64((const __m128i *) (p + 8)), 4);
+
+    // regroup so each 64-bit half starts with one pixel's R, G, B
+    __m128i m01 = _mm_unpacklo_epi64(a, _mm_srli_si128(a, 6));
+    __m128i p2 = _mm_or_si128(_mm_srli_si128(a, 12), _mm_slli_si128(b, 4));
+    __m128i m23 = _mm_unpacklo_epi64(p2, _mm_srli_si128(b, 2));
+
+    // dword pairs [R << 8 | G, B] -> [R << 16 | G << 8 | B]
+    __m128i d01 = _mm_madd_epi16(m01, coeff);
+    __m128i d23 = _mm_madd_epi16(m23, coeff);
+    d01 = _mm_or_si128(_mm_slli_epi32(d01, 8), _mm_srli_si128(d01, 4));
+    d23 = _mm_or_si128(_mm_slli_epi32(d23, 8), _mm_srli_si128(d23, 4));
+    _mm_storeu_si128((__m128i *) (dest + i),
+                     _mm_unpacklo_epi64(
+                         _mm_shuffle_epi32(d01, _MM_SHUFFLE(3, 3, 2, 0)),
+                         _mm_shuffle_epi32(d23, _MM_SHUFFLE(3, 3, 2, 0))));
+  }
+#endif
+
+  // scalar tail, and everything without SIMD
+  for (; i < count; i++) {
+    uint8_t r = GINT16_FROM_LE(src[(i * 3)]) >> 4;
+    uint8_t g = GINT16_FROM_LE(src[(i * 3) + 1]) >> 4;
+    uint8_t b = GINT16_FROM_LE(src[(i * 3) + 2]) >> 4;
+
+    dest[i] = (r << 16) | (g << 8) | b;
+  }
+}
+
+// Premultiplied ARGB to packed 3-byte RGB, composited over opaque
+// white (out = c + (255 - a), which is exact for the fully opaque
+// pixels of brightfield slides).  The 4:3 repack is a byte shuffle
+// SSE2 cannot express, so only the composite is vectorized.
+void _openslide_argb_to_rgb24(const uint32_t *src, uint8_t *dest,
+                              int64_t count) {
+  int64_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi32(0xff);
+  for (; i + 4 <= count; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *) (src + i));
+
+    // replicate 255 - alpha into the three color byte lanes
+    __m128i inv = _mm_xor_si128(_mm_srli_epi32(p, 24), mask);
+    inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 8));
+    inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 8));
+    p = _mm_adds_epu8(p, inv);
+
+    uint32_t tmp[4];
+    _mm_storeu_si128((__m128i *) tmp, p);
+    for (int j = 0; j < 4; j++) {
+      uint32_t c = tmp[j];
+      *dest++ = c >> 16;
+      *dest++ = c >> 8;
+      *dest++ = c;
+    }
+  }
+#endif
+
+  // scalar tail, and everything without SIMD
+  for (; i < count; i++) {
+    uint32_t c = src[i];
+    uint32_t inv = 255 - (c >> 24);
+    // premultiplied channels never exceed alpha, but clamp in case of
+    // malformed input
+    *dest++ = MIN(((c >> 16) & 0xff) + inv, (uint32_t) 255);
+    *dest++ = MIN(((c >> 8) & 0xff) + inv, (uint32_t) 255);
+    *dest++ = MIN((c & 0xff) + inv, (uint32_t) 255);
+  }
+}
+
+// Box-average packed ARGB pixels down by an integer factor.  Each dest
+// pixel is the channel-wise mean of the corresponding factor x factor
+// block of src.  Strides are in pixels.  The SIMD path for factor 2 may
+// differ from the scalar mean by one LSB due to rounding.
+void _openslide_box_downsample_argb(const uint32_t *src, int64_t src_stride,
+                                    uint32_t *dest, int64_t dest_stride,
+                                    int64_t dest_w, int64_t dest_h,
+                                    int32_t factor) {
+  for (int64_t dy = 0; dy < dest_h; dy++) {
+    const uint32_t *srow = src + dy * factor * src_stride;
+    uint32_t *drow = dest + dy * dest_stride;
+    int64_t dx = 0;
+
+#ifdef __SSE2__
+    if (factor == 2) {
+      for (; dx + 2 <= dest_w; dx += 2) {
+        // average two rows of four pixels, then adjacent pixel pairs
+        __m128i r0 = _mm_loadu_si128((const __m128i *) (srow + dx * 2));
+        __m128i r1 = _mm_loadu_si128((const __m128i *)
+                                     (srow + src_stride + dx * 2));
+        __m128i v = _mm_avg_epu8(r0, r1);
+        v = _mm_avg_epu8(v, _mm_srli_si128(v, 4));
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 2, 0));
+        _mm_storel_epi64((__m128i *) (drow + dx), v);
+      }
+    }
+#endif
+
+    // scalar tail, and all other factors
+    for (; dx < dest_w; dx++) {
+      const uint32_t *block = srow + dx * factor;
+      uint32_t a = 0, r = 0, g = 0, b = 0;
+      for (int32_t i = 0; i < factor; i++) {
+        for (int32_t j = 0; j < factor; j++) {
+          uint32_t p = block[i * src_stride + j];
+          a += p >> 24;
+          r += (p >> 16) & 0xff;
+          g += (p >> 8) & 0xff;
+          b += p & 0xff;
+        }
+      }
+      uint32_t n = factor * factor;
+      drow[dx] = ((a / n) << 24) | ((r / n) << 16) | ((g / n) << 8) | (b / n);
+    }
+  }
+}
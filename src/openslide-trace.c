@@ -0,0 +1,148 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide.h"
+#include "openslide-private.h"
+
+#include <string.h>
+#include <glib.h>
+
+/* Lightweight access tracing, for capturing production workloads so
+   cache and scheduling changes can be evaluated against replayed real
+   traces (see test/replay.c) instead of synthetic schedules.  Enabled
+   by pointing the environment variable at a log file; every
+   openslide_read_region() call is then appended to a compact binary
+   log.  The log is private to one process; concurrent processes must
+   use distinct files.
+
+   Format: an 8-byte magic, then a stream of records introduced by a
+   type byte.  'S' announces a slide: the id subsequent reads refer to,
+   followed by two length-prefixed strings, quickhash-1 (empty if
+   unavailable) and the path.  'R' is one read: a fixed struct of
+   int64s, in native byte order like everything else. */
+
+static const char TRACE_FILE_ENV_VAR[] = "OPENSLIDE_TRACE_FILE";
+
+#define TRACE_MAGIC "OSTRACE1"
+
+struct trace_read {
+  int64_t slide;      // id from the matching 'S' record
+  int64_t usec;       // since trace start
+  int64_t thread;     // opaque id, stable within the trace
+  int64_t x;          // level 0 plane
+  int64_t y;          // level 0 plane
+  int64_t level;
+  int64_t w;
+  int64_t h;
+};
+
+static GStaticMutex trace_lock = G_STATIC_MUTEX_INIT;
+static FILE *trace_file;
+static GTimer *trace_timer;
+static int64_t next_slide_id = 1;
+
+// call with the lock held; returns NULL if tracing is off or broken
+static FILE *trace_get_file(void) {
+  static bool checked;
+
+  if (!checked) {
+    checked = true;
+    const char *path = g_getenv(TRACE_FILE_ENV_VAR);
+    if (path) {
+      GError *tmp_err = NULL;
+      trace_file = _openslide_fopen(path, "wb", &tmp_err);
+      if (trace_file) {
+        fwrite(TRACE_MAGIC, strlen(TRACE_MAGIC), 1, trace_file);
+        trace_timer = g_timer_new();
+      } else {
+        g_warning("Couldn't open trace log: %s", tmp_err->message);
+        g_clear_error(&tmp_err);
+      }
+    }
+  }
+  return trace_file;
+}
+
+static void trace_write_string(FILE *f, const char *str) {
+  int32_t len = str ? strlen(str) : 0;
+  fwrite(&len, sizeof(len), 1, f);
+  if (len) {
+    fwrite(str, len, 1, f);
+  }
+}
+
+void _openslide_trace_open(openslide_t *osr, const char *filename) {
+  g_static_mutex_lock(&trace_lock);
+  FILE *f = trace_get_file();
+  if (f && !osr->trace_id) {
+    osr->trace_id = next_slide_id++;
+    // resolving the hash reads a few megabytes once per slide, which
+    // is acceptable for an opt-in diagnostic
+    const char *hash =
+      openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_QUICKHASH1);
+
+    fputc('S', f);
+    fwrite(&osr->trace_id, sizeof(osr->trace_id), 1, f);
+    trace_write_string(f, hash);
+    trace_write_string(f, filename);
+    fflush(f);
+  }
+  g_static_mutex_unlock(&trace_lock);
+}
+
+void _openslide_trace_read_region(openslide_t *osr,
+                                  int64_t x, int64_t y,
+                                  int32_t level,
+                                  int64_t w, int64_t h) {
+  if (!osr->trace_id) {
+    // not tracing, or this slide was opened before tracing started
+    return;
+  }
+
+  struct trace_read rec = {
+    .slide = osr->trace_id,
+    .thread = (int64_t) GPOINTER_TO_SIZE(g_thread_self()),
+    .x = x,
+    .y = y,
+    .level = level,
+    .w = w,
+    .h = h,
+  };
+
+  g_static_mutex_lock(&trace_lock);
+  FILE *f = trace_get_file();
+  if (f) {
+    rec.usec = (int64_t) (g_timer_elapsed(trace_timer, NULL) * 1e6);
+    fputc('R', f);
+    fwrite(&rec, sizeof(rec), 1, f);
+  }
+  g_static_mutex_unlock(&trace_lock);
+}
+
+void _openslide_trace_flush(void) {
+  g_static_mutex_lock(&trace_lock);
+  if (trace_file) {
+    fflush(trace_file);
+  }
+  g_static_mutex_unlock(&trace_lock);
+}
@@ -32,11 +32,17 @@
 #include <glib.h>
 #include <cairo.h>
 
-#ifdef HAVE_FCNTL
+#if defined(HAVE_FCNTL) || defined(HAVE_POSIX_FADVISE)
 #include <unistd.h>
 #include <fcntl.h>
 #endif
 
+#ifdef G_OS_WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 #define KEY_FILE_HARD_MAX_SIZE (100 << 20)
 
 static const char DEBUG_ENV_VAR[] = "OPENSLIDE_DEBUG";
@@ -229,6 +235,31 @@ FILE *_openslide_fopen(const char *path, const char *mode, GError **err)
   return f;
 }
 
+/* Best-effort access-pattern hints for the kernel page cache.  Tile
+   reads are small and random, so default readahead only fetches pages
+   that are thrown away; scan passes want the opposite.  No-ops where
+   posix_fadvise() is unavailable, and failures are ignored. */
+
+void _openslide_fadvise_random(FILE *f G_GNUC_UNUSED) {
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(fileno(f), 0, 0, POSIX_FADV_RANDOM);
+#endif
+}
+
+void _openslide_fadvise_sequential(FILE *f G_GNUC_UNUSED) {
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+void _openslide_fadvise_willneed(FILE *f G_GNUC_UNUSED,
+                                 int64_t offset G_GNUC_UNUSED,
+                                 int64_t length G_GNUC_UNUSED) {
+#ifdef HAVE_POSIX_FADVISE
+  posix_fadvise(fileno(f), offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
 #undef g_ascii_strtod
 double _openslide_parse_double(const char *value) {
   // Canonicalize comma to decimal point, since the locale of the
@@ -257,6 +288,40 @@ char *_openslide_format_double(double d) {
   return g_strdup(buf);
 }
 
+int _openslide_num_processors(void) {
+#ifdef G_OS_WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return MAX(1, (int) info.dwNumberOfProcessors);
+#elif defined(_SC_NPROCESSORS_ONLN)
+  return MAX(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+#else
+  return 1;
+#endif
+}
+
+int64_t _openslide_now_usec(void) {
+  GTimeVal now;
+  g_get_current_time(&now);
+  return (int64_t) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+}
+
+void _openslide_stats_record_decode(openslide_t *osr,
+                                    enum _openslide_codec codec,
+                                    int64_t bytes,
+                                    int64_t usec) {
+  _OPENSLIDE_PROBE4(tile_decode__done, osr, codec, bytes, usec);
+  if (!osr) {
+    return;
+  }
+  struct _openslide_decode_stats *stats = &osr->decode_stats[codec];
+  g_mutex_lock(osr->stats_lock);
+  stats->tiles++;
+  stats->bytes += bytes;
+  stats->usec += usec;
+  g_mutex_unlock(osr->stats_lock);
+}
+
 // if the src prop is an int, canonicalize it and copy it to dest
 void _openslide_duplicate_int_prop(openslide_t *osr, const char *src,
                                    const char *dest) {
@@ -401,3 +466,130 @@ void _openslide_performance_warn_once(gint *warned_flag,
     }
   }
 }
+
+// Process-wide budget for idle pooled handles (cached TIFF handles,
+// pooled database connections).  Each open slide may retain a bounded
+// pool of idle handles; with hundreds of slides open the sum can
+// exhaust process limits.  Pools register here and account every idle
+// handle they retain; when the total exceeds the budget, the least
+// recently active pool is asked to close idle handles.  Pools reopen
+// handles transparently on demand, so trimming is always safe.
+
+static const char HANDLE_BUDGET_ENV_VAR[] = "OPENSLIDE_HANDLE_BUDGET";
+#define HANDLE_BUDGET_DEFAULT 512
+
+struct handle_pool {
+  _openslide_handle_trim_fn trim;
+  void *data;
+  int idle;
+  int trimming;  // trim calls in flight without the lock held
+};
+
+static GStaticMutex handle_budget_lock = G_STATIC_MUTEX_INIT;
+static GQueue handle_pools = G_QUEUE_INIT;  // most recently active first
+static GCond *handle_trim_cond;  // signaled when a trim call returns
+static int handle_budget_idle;
+static int handle_budget_max = -1;  // resolved lazily; 0 means unlimited
+
+// handle_budget_lock must be held
+static void handle_pool_touch(struct handle_pool *pool) {
+  if (handle_budget_max == -1) {
+    handle_budget_max = HANDLE_BUDGET_DEFAULT;
+    const char *str = g_getenv(HANDLE_BUDGET_ENV_VAR);
+    if (str) {
+      handle_budget_max = MAX((int) g_ascii_strtoll(str, NULL, 10), 0);
+    }
+  }
+  GList *link = g_queue_find(&handle_pools, pool);
+  if (link) {
+    g_queue_unlink(&handle_pools, link);
+    g_queue_push_head_link(&handle_pools, link);
+  }
+}
+
+void *_openslide_handle_pool_register(_openslide_handle_trim_fn trim,
+                                      void *data) {
+  struct handle_pool *pool = g_slice_new0(struct handle_pool);
+  pool->trim = trim;
+  pool->data = data;
+
+  g_static_mutex_lock(&handle_budget_lock);
+  if (!handle_trim_cond) {
+    handle_trim_cond = g_cond_new();
+  }
+  g_queue_push_head(&handle_pools, pool);
+  g_static_mutex_unlock(&handle_budget_lock);
+  return pool;
+}
+
+void _openslide_handle_pool_unregister(void *_pool) {
+  struct handle_pool *pool = _pool;
+
+  g_static_mutex_lock(&handle_budget_lock);
+  // a retainer may be calling our trim callback without the lock held;
+  // wait it out so neither the pool nor the data behind it is freed
+  // under the call
+  while (pool->trimming) {
+    g_cond_wait(handle_trim_cond,
+                g_static_mutex_get_mutex(&handle_budget_lock));
+  }
+  g_assert(pool->idle == 0);
+  g_queue_remove(&handle_pools, pool);
+  g_static_mutex_unlock(&handle_budget_lock);
+  g_slice_free(struct handle_pool, pool);
+}
+
+bool _openslide_handle_pool_retain(void *_pool) {
+  struct handle_pool *pool = _pool;
+
+  g_static_mutex_lock(&handle_budget_lock);
+  handle_pool_touch(pool);
+  while (handle_budget_max && handle_budget_idle >= handle_budget_max) {
+    // ask the least recently active pool holding idle handles to close
+    // one; trim callbacks take their own locks, so call them without
+    // ours held
+    struct handle_pool *victim = NULL;
+    for (GList *cur = g_queue_peek_tail_link(&handle_pools);
+         cur; cur = cur->prev) {
+      struct handle_pool *candidate = cur->data;
+      if (candidate != pool && candidate->idle > 0) {
+        victim = candidate;
+        break;
+      }
+    }
+    if (!victim) {
+      // every idle handle is our own; don't retain more
+      g_static_mutex_unlock(&handle_budget_lock);
+      return false;
+    }
+    int before = handle_budget_idle;
+    // pin the victim so a concurrent unregister waits for the trim
+    // call instead of freeing the pool (and its data) under us
+    victim->trimming++;
+    g_static_mutex_unlock(&handle_budget_lock);
+    victim->trim(victim->data);
+    g_static_mutex_lock(&handle_budget_lock);
+    victim->trimming--;
+    g_cond_broadcast(handle_trim_cond);
+    if (handle_budget_idle >= before) {
+      // no progress; give up rather than spin
+      g_static_mutex_unlock(&handle_budget_lock);
+      return false;
+    }
+  }
+  pool->idle++;
+  handle_budget_idle++;
+  g_static_mutex_unlock(&handle_budget_lock);
+  return true;
+}
+
+void _openslide_handle_pool_release(void *_pool) {
+  struct handle_pool *pool = _pool;
+
+  g_static_mutex_lock(&handle_budget_lock);
+  handle_pool_touch(pool);
+  g_assert(pool->idle > 0);
+  pool->idle--;
+  handle_budget_idle--;
+  g_static_mutex_unlock(&handle_budget_lock);
+}
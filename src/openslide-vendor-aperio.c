@@ -133,7 +133,8 @@ static bool render_missing_tile(struct level *l,
   return success;
 }
 
-static bool decode_tile(struct level *l,
+static bool decode_tile(openslide_t *osr,
+                        struct level *l,
                         TIFF *tiff,
                         uint32_t *dest,
                         int64_t tile_col, int64_t tile_row,
@@ -159,15 +160,36 @@ static bool decode_tile(struct level *l,
     break;
   default:
     // not for us? fallback
-    return _openslide_tiff_read_tile(tiffl, tiff, dest,
+    return _openslide_tiff_read_tile(osr, tiffl, tiff, dest,
                                      tile_col, tile_row,
                                      err);
   }
 
+  // check the compressed tier of the cache; keyed on the tiff level
+  // struct, distinct from the level pointer used for decoded tiles
+  int64_t start = _openslide_now_usec();
+  void *buf = NULL;
+  int32_t buflen = 0;
+  struct _openslide_cache_entry *raw_entry = NULL;
+  if (osr) {
+    buf = _openslide_cache_get(osr->cache, tiffl, tile_col, tile_row,
+                               &raw_entry);
+    if (buf) {
+      buflen = _openslide_cache_entry_size(raw_entry);
+    }
+  }
+
+  // then the persistent cache, if one is configured
+  bool from_disk = false;
+  if (!buf && osr && osr->diskcache) {
+    buf = _openslide_diskcache_get(osr->diskcache, tiffl->dir,
+                                   tile_col, tile_row, &buflen);
+    from_disk = (buf != NULL);
+  }
+
   // read raw tile
-  void *buf;
-  int32_t buflen;
-  if (!_openslide_tiff_read_tile_data(tiffl, tiff,
+  if (!buf &&
+      !_openslide_tiff_read_tile_data(tiffl, tiff,
                                       &buf, &buflen,
                                       tile_col, tile_row,
                                       err)) {
@@ -179,10 +201,31 @@ static bool decode_tile(struct level *l,
                                                tiffl->tile_w, tiffl->tile_h,
                                                buf, buflen,
                                                space,
+                                               0,
                                                err);
+  if (success) {
+    _openslide_stats_record_decode(osr, _OPENSLIDE_CODEC_JP2K, buflen,
+                                   _openslide_now_usec() - start);
+  }
 
   // clean up
-  g_free(buf);
+  if (raw_entry) {
+    _openslide_cache_entry_unref(raw_entry);
+  } else {
+    if (success && osr) {
+      // save the compressed bytes for the next decoded-tier miss;
+      // skipping the I/O matters even though we pay the JP2K decode again
+      void *copy = g_slice_copy(buflen, buf);
+      _openslide_cache_put(osr->cache, osr, tiffl, tile_col, tile_row,
+                           copy, buflen, &raw_entry);
+      _openslide_cache_entry_unref(raw_entry);
+      if (osr->diskcache && !from_disk) {
+        _openslide_diskcache_put(osr->diskcache, tiffl->dir,
+                                 tile_col, tile_row, buf, buflen);
+      }
+    }
+    g_free(buf);
+  }
 
   return success;
 }
@@ -207,9 +250,9 @@ static bool read_tile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!decode_tile(l, tiff, tiledata, tile_col, tile_row, err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+    tiledata = _openslide_tile_alloc(tw * th * 4);
+    if (!decode_tile(osr, l, tiff, tiledata, tile_col, tile_row, err)) {
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
@@ -217,23 +260,22 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
+    _openslide_cache_put(osr->cache, osr, level, tile_col, tile_row,
 			 tiledata, tw * th * 4,
 			 &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-								 CAIRO_FORMAT_ARGB32,
-								 tw, th,
-								 tw * 4);
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          tw, th),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -419,12 +461,54 @@ static bool test_tile_decoding(struct level *l,
     return true;
   }
 
-  int64_t tw = l->tiffl.tile_w;
-  int64_t th = l->tiffl.tile_h;
+  int32_t tw = l->tiffl.tile_w;
+  int32_t th = l->tiffl.tile_h;
 
-  uint32_t *dest = g_slice_alloc(tw * th * 4);
-  bool ok = decode_tile(l, tiff, dest, 0, 0, err);
-  g_slice_free1(tw * th * 4, dest);
+  // a missing first tile is rendered from a neighboring level instead of
+  // decoded, so probe it through the normal tile path
+  int64_t tile_no = 0;
+  if (g_hash_table_lookup_extended(l->missing_tiles, &tile_no, NULL, NULL)) {
+    uint32_t *dest = _openslide_tile_alloc((int64_t) tw * th * 4);
+    // NULL osr: don't count the probe decode in the statistics
+    bool ok = decode_tile(NULL, l, tiff, dest, 0, 0, err);
+    _openslide_tile_free((int64_t) tw * th * 4, dest);
+    return ok;
+  }
+
+  enum _openslide_jp2k_colorspace space =
+    (l->compression == APERIO_COMPRESSION_JP2K_YCBCR) ?
+    OPENSLIDE_JP2K_YCBCR : OPENSLIDE_JP2K_RGB;
+
+  void *buf;
+  int32_t buflen;
+  if (!_openslide_tiff_read_tile_data(&l->tiffl, tiff,
+                                      &buf, &buflen,
+                                      0, 0,
+                                      err)) {
+    return false;
+  }
+
+  // decode only the lowest wavelet resolutions; the CVE breakage
+  // (mismatched per-component block counts) is reported regardless of
+  // where we stop, and the probe runs once per level at open
+  int32_t reduce = 2;
+  int32_t rw = _OPENSLIDE_JP2K_REDUCED_DIM(tw, reduce);
+  int32_t rh = _OPENSLIDE_JP2K_REDUCED_DIM(th, reduce);
+  GError *tmp_err = NULL;
+  uint32_t *dest = _openslide_tile_alloc((int64_t) rw * rh * 4);
+  bool ok = _openslide_jp2k_decode_buffer(dest, tw, th, buf, buflen,
+                                          space, reduce, &tmp_err);
+  _openslide_tile_free((int64_t) rw * rh * 4, dest);
+  if (!ok) {
+    // perhaps the codestream has fewer resolution levels than we skipped;
+    // retry at full resolution before declaring the slide unreadable
+    g_clear_error(&tmp_err);
+    dest = _openslide_tile_alloc((int64_t) tw * th * 4);
+    ok = _openslide_jp2k_decode_buffer(dest, tw, th, buf, buflen,
+                                       space, 0, err);
+    _openslide_tile_free((int64_t) tw * th * 4, dest);
+  }
+  g_free(buf);
   return ok;
 }
 
@@ -620,9 +704,15 @@ FAIL:
   return false;
 }
 
+static bool aperio_sniff(const char *filename G_GNUC_UNUSED,
+                         struct _openslide_tifflike *tl) {
+  return tl != NULL;
+}
+
 const struct _openslide_format _openslide_format_aperio = {
   .name = "aperio",
   .vendor = "aperio",
+  .sniff = aperio_sniff,
   .detect = aperio_detect,
   .open = aperio_open,
 };
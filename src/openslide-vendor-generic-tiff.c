@@ -81,11 +81,11 @@ static bool read_tile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
+    tiledata = _openslide_tile_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
@@ -93,23 +93,22 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
+    _openslide_cache_put(osr->cache, osr, level, tile_col, tile_row,
                          tiledata, tw * th * 4,
                          &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_ARGB32,
-                                                                 tw, th,
-                                                                 tw * 4);
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          tw, th),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -131,6 +130,15 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
     return false;
   }
 
+  // batch the raw I/O for the covered tiles ahead of the decode loop
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+  int64_t lx = x / l->base.downsample;
+  int64_t ly = y / l->base.downsample;
+  _openslide_tiff_readahead(osr, level, tiffl, tiff,
+                            lx / tiffl->tile_w, ly / tiffl->tile_h,
+                            (lx + w) / tiffl->tile_w,
+                            (ly + h) / tiffl->tile_h);
+
   bool success = _openslide_grid_paint_region(l->grid, cr, tiff,
                                               x / l->base.downsample,
                                               y / l->base.downsample,
@@ -141,8 +149,96 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
   return success;
 }
 
+static bool read_raw_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          void **buf, int64_t *len,
+                          const char **codec,
+                          GError **err) {
+  struct generic_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+  bool success = false;
+
+  if (tile_col < 0 || tile_col >= tiffl->tiles_across ||
+      tile_row < 0 || tile_row >= tiffl->tiles_down) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Tile coordinates out of range");
+    return false;
+  }
+
+  TIFF *tiff = _openslide_tiffcache_get(data->tc, err);
+  if (tiff == NULL) {
+    return false;
+  }
+
+  if (!_openslide_tiff_set_dir(tiff, tiffl->dir, err)) {
+    goto DONE;
+  }
+
+  uint16_t compression;
+  if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &compression)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Can't read compression scheme");
+    goto DONE;
+  }
+
+  void *tile;
+  int32_t tile_len;
+  if (!_openslide_tiff_read_tile_data(tiffl, tiff,
+                                      &tile, &tile_len,
+                                      tile_col, tile_row,
+                                      err)) {
+    goto DONE;
+  }
+  int64_t out_len = tile_len;
+
+  switch (compression) {
+  case COMPRESSION_JPEG: {
+    *codec = "jpeg";
+    // TIFF JPEG tiles are abbreviated streams; splice in the shared
+    // tables so the result is a standalone JPEG: tables minus their
+    // trailing EOI, then the tile minus its leading SOI
+    void *tables;
+    uint32_t tables_len;
+    if (TIFFGetField(tiff, TIFFTAG_JPEGTABLES, &tables_len, &tables) &&
+        tables_len > 4 && tile_len >= 2) {
+      out_len = (int64_t) tables_len - 2 + tile_len - 2;
+      uint8_t *out = g_malloc(out_len);
+      memcpy(out, tables, tables_len - 2);
+      memcpy(out + tables_len - 2, (uint8_t *) tile + 2, tile_len - 2);
+      g_free(tile);
+      tile = out;
+    }
+    break;
+  }
+  case COMPRESSION_LZW:
+    *codec = "lzw";
+    break;
+  case COMPRESSION_DEFLATE:
+  case COMPRESSION_ADOBE_DEFLATE:
+    *codec = "deflate";
+    break;
+  case COMPRESSION_NONE:
+    *codec = "raw";
+    break;
+  default:
+    *codec = "unknown";
+    break;
+  }
+
+  *buf = tile;
+  *len = out_len;
+  success = true;
+
+ DONE:
+  _openslide_tiffcache_put(data->tc, tiff);
+  return success;
+}
+
 static const struct _openslide_ops generic_tiff_ops = {
   .paint_region = paint_region,
+  .read_raw_tile = read_raw_tile,
   .destroy = destroy,
 };
 
@@ -242,6 +338,8 @@ static bool generic_tiff_open(openslide_t *osr,
                                             tiffl->tile_w,
                                             tiffl->tile_h,
                                             read_tile);
+    // cached tiles are exact tile-grid rectangles
+    l->base.aligned_tiles = true;
 
     // add to array
     g_ptr_array_add(level_array, l);
@@ -299,9 +397,15 @@ static bool generic_tiff_open(openslide_t *osr,
   return false;
 }
 
+static bool generic_tiff_sniff(const char *filename G_GNUC_UNUSED,
+                               struct _openslide_tifflike *tl) {
+  return tl != NULL;
+}
+
 const struct _openslide_format _openslide_format_generic_tiff = {
   .name = "generic-tiff",
   .vendor = "generic-tiff",
+  .sniff = generic_tiff_sniff,
   .detect = generic_tiff_detect,
   .open = generic_tiff_open,
 };
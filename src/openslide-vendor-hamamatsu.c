@@ -44,6 +44,7 @@
 #include "openslide-decode-tifflike.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <setjmp.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -75,6 +76,12 @@ static const char KEY_PIXEL_ORDER[] = "PixelOrder";
 // so set the limit conservatively
 static const int KEY_FILE_MAX_SIZE = 64 << 10;
 
+// sidecar index caching the result of a completed restart marker scan,
+// stored next to the first JPEG data file
+static const char MARKER_INDEX_SUFFIX[] = ".openslide-markers";
+#define MARKER_INDEX_MAGIC 0x4f534d49  // "OSMI"
+#define MARKER_INDEX_VERSION 1
+
 // NDPI
 #define NDPI_FORMAT_FLAG 65420
 #define NDPI_SOURCELENS 65421
@@ -591,6 +598,7 @@ static bool read_from_jpeg(openslide_t *osr,
                            int32_t w, int32_t h,
                            GError **err) {
   volatile bool success = false;
+  int64_t start = _openslide_now_usec();
 
   // open file
   FILE *f = _openslide_fopen(jpeg->filename, "rb", err);
@@ -654,6 +662,11 @@ static bool read_from_jpeg(openslide_t *osr,
 OUT:
   _openslide_jpeg_decompress_destroy(dc);
   fclose(f);
+  if (success) {
+    _openslide_stats_record_decode(osr, _OPENSLIDE_CODEC_JPEG,
+                                   stop_position - start_position,
+                                   _openslide_now_usec() - start);
+  }
   return success;
 }
 
@@ -689,31 +702,29 @@ static bool read_jpeg_tile(openslide_t *osr,
                                             &cache_entry);
 
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
+    tiledata = _openslide_tile_alloc(tw * th * 4);
     if (!read_from_jpeg(osr,
                         jp, tileno,
                         l->scale_denom,
                         tiledata, tw, th,
                         err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
-    _openslide_cache_put(osr->cache,
+    _openslide_cache_put(osr->cache, osr,
 			 level, tile_col, tile_row,
 			 tiledata,
 			 tw * th * 4,
 			 &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-								 CAIRO_FORMAT_RGB24,
-								 tw, th,
-								 tw * 4);
-
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_RGB24,
+                                                          tw, th),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -900,6 +911,142 @@ static bool verify_mcu_starts(int32_t num_jpegs, struct jpeg **jpegs,
   return true;
 }
 
+static bool index_read64(FILE *f, int64_t *out) {
+  int64_t v;
+  if (fread(&v, sizeof(v), 1, f) != 1) {
+    return false;
+  }
+  *out = GINT64_FROM_LE(v);
+  return true;
+}
+
+static bool index_write64(FILE *f, int64_t v) {
+  v = GINT64_TO_LE(v);
+  return fwrite(&v, sizeof(v), 1, f) == 1;
+}
+
+static char *marker_index_path(struct jpeg **jpegs) {
+  return g_strconcat(jpegs[0]->filename, MARKER_INDEX_SUFFIX, NULL);
+}
+
+// Load a marker table persisted by a previous scan of the same slide.
+// The scan only depends on the JPEG bitstreams, so the table is
+// validated against the stream positions recorded at open and ignored
+// on any mismatch.  Only commits to the jpeg structs on success.
+static bool marker_index_load(int32_t num_jpegs, struct jpeg **jpegs) {
+  bool success = false;
+  int64_t **tables = g_new0(int64_t *, num_jpegs);
+
+  char *path = marker_index_path(jpegs);
+  FILE *f = _openslide_fopen(path, "rb", NULL);
+  g_free(path);
+  if (f == NULL) {
+    goto DONE;
+  }
+
+  // header
+  int64_t magic, version, count;
+  if (!index_read64(f, &magic) || magic != MARKER_INDEX_MAGIC ||
+      !index_read64(f, &version) || version != MARKER_INDEX_VERSION ||
+      !index_read64(f, &count) || count != num_jpegs) {
+    goto DONE;
+  }
+
+  // per-JPEG tables
+  for (int32_t i = 0; i < num_jpegs; i++) {
+    struct jpeg *jp = jpegs[i];
+    int64_t start, end, header_stop, tiles;
+    if (!index_read64(f, &start) || start != jp->start_in_file ||
+        !index_read64(f, &end) || end != jp->end_in_file ||
+        !index_read64(f, &header_stop) ||
+        header_stop != jp->header_stop_position ||
+        !index_read64(f, &tiles) || tiles != jp->tile_count) {
+      goto DONE;
+    }
+    tables[i] = g_new(int64_t, jp->tile_count);
+    int64_t prev = 0;
+    for (int32_t j = 0; j < jp->tile_count; j++) {
+      int64_t offset;
+      if (!index_read64(f, &offset) ||
+          offset < jp->header_stop_position || offset >= jp->end_in_file ||
+          offset < prev) {
+        goto DONE;
+      }
+      tables[i][j] = offset;
+      prev = offset;
+    }
+  }
+
+  // fully validated; commit
+  for (int32_t i = 0; i < num_jpegs; i++) {
+    memcpy(jpegs[i]->mcu_starts, tables[i],
+           jpegs[i]->tile_count * sizeof(int64_t));
+  }
+  //g_debug("loaded marker index");
+  success = true;
+
+DONE:
+  for (int32_t i = 0; i < num_jpegs; i++) {
+    g_free(tables[i]);
+  }
+  g_free(tables);
+  if (f) {
+    fclose(f);
+  }
+  return success;
+}
+
+// Persist a completed marker table, via a temporary file so that a
+// concurrent open never sees a partial index.  Best-effort: on a
+// read-only filesystem we simply rescan next time.
+static void marker_index_save(int32_t num_jpegs, struct jpeg **jpegs) {
+  char *path = marker_index_path(jpegs);
+  char *tmp_path = g_strconcat(path, ".tmp", NULL);
+
+  FILE *f = _openslide_fopen(tmp_path, "wb", NULL);
+  if (f == NULL) {
+    goto DONE;
+  }
+
+  bool ok = index_write64(f, MARKER_INDEX_MAGIC) &&
+            index_write64(f, MARKER_INDEX_VERSION) &&
+            index_write64(f, num_jpegs);
+  for (int32_t i = 0; ok && i < num_jpegs; i++) {
+    struct jpeg *jp = jpegs[i];
+    ok = index_write64(f, jp->start_in_file) &&
+         index_write64(f, jp->end_in_file) &&
+         index_write64(f, jp->header_stop_position) &&
+         index_write64(f, jp->tile_count);
+    for (int32_t j = 0; ok && j < jp->tile_count; j++) {
+      int64_t offset = jp->mcu_starts[j];
+      if (offset == -1 && j == 0) {
+        // single-tile JPEGs are never scanned; the first MCU always
+        // starts at the end of the header
+        offset = jp->header_stop_position;
+      }
+      if (offset == -1) {
+        // incomplete table; shouldn't happen, but don't persist it
+        ok = false;
+        break;
+      }
+      ok = index_write64(f, offset);
+    }
+  }
+
+  if (fclose(f) || !ok) {
+    g_unlink(tmp_path);
+    goto DONE;
+  }
+  if (g_rename(tmp_path, path)) {
+    g_unlink(tmp_path);
+  }
+  //g_debug("saved marker index");
+
+DONE:
+  g_free(tmp_path);
+  g_free(path);
+}
+
 static gpointer restart_marker_thread_func(gpointer d) {
   openslide_t *osr = d;
   struct hamamatsu_jpeg_ops_data *data = osr->data;
@@ -963,6 +1110,8 @@ static gpointer restart_marker_thread_func(gpointer d) {
 	  //g_debug("restart_marker_thread_func fopen failed");
 	  break;
 	}
+	// the marker scan walks the whole file front to back
+	_openslide_fadvise_sequential(current_file);
       }
 
       if (!compute_mcu_start(osr, jp, current_file, current_mcu_start,
@@ -990,6 +1139,11 @@ static gpointer restart_marker_thread_func(gpointer d) {
     g_mutex_lock(data->restart_marker_cond_mutex);
     data->restart_marker_thread_error = tmp_err;
     g_mutex_unlock(data->restart_marker_cond_mutex);
+  } else if (current_jpeg == data->jpeg_count) {
+    // the table is complete; persist it so future opens can skip the scan
+    g_mutex_lock(data->restart_marker_mutex);
+    marker_index_save(data->jpeg_count, data->all_jpegs);
+    g_mutex_unlock(data->restart_marker_mutex);
   }
 
   //  g_debug("restart_marker_thread_func done!");
@@ -1227,9 +1381,17 @@ static void create_scaled_jpeg_levels(openslide_t *osr,
 
     // try adding scale_denom levels
     for (int scale_denom = 2; scale_denom <= 8; scale_denom <<= 1) {
-      // check to make sure we get an even division
-      if ((l->tile_width % scale_denom) ||
-          (l->tile_height % scale_denom)) {
+      // a level holding a single untiled JPEG (common for intermediate
+      // NDPI levels) can use any scale_denom, since libjpeg rounds the
+      // scaled output dimensions up and there are no neighboring tiles
+      // to misalign with
+      bool single_tile = (l->tiles_across == 1 && l->tiles_down == 1 &&
+                          l->jpegs_across == 1 && l->jpegs_down == 1);
+
+      // otherwise, check to make sure we get an even division
+      if (!single_tile &&
+          ((l->tile_width % scale_denom) ||
+           (l->tile_height % scale_denom))) {
         continue;
       }
 
@@ -1237,14 +1399,22 @@ static void create_scaled_jpeg_levels(openslide_t *osr,
       struct jpeg_level *sd_l = g_slice_new0(struct jpeg_level);
       sd_l->scale_denom = scale_denom;
 
-      sd_l->base.w = l->base.w / scale_denom;
-      sd_l->base.h = l->base.h / scale_denom;
       sd_l->jpegs_across = l->jpegs_across;
       sd_l->jpegs_down = l->jpegs_down;
       sd_l->tiles_across = l->tiles_across;
       sd_l->tiles_down = l->tiles_down;
-      sd_l->tile_width = l->tile_width / scale_denom;
-      sd_l->tile_height = l->tile_height / scale_denom;
+      if (single_tile) {
+        // round up, matching jpeg_calc_output_dimensions()
+        sd_l->tile_width = (l->tile_width + scale_denom - 1) / scale_denom;
+        sd_l->tile_height = (l->tile_height + scale_denom - 1) / scale_denom;
+        sd_l->base.w = sd_l->tile_width;
+        sd_l->base.h = sd_l->tile_height;
+      } else {
+        sd_l->tile_width = l->tile_width / scale_denom;
+        sd_l->tile_height = l->tile_height / scale_denom;
+        sd_l->base.w = l->base.w / scale_denom;
+        sd_l->base.h = l->base.h / scale_denom;
+      }
 
       int32_t num_jpegs = sd_l->jpegs_across * sd_l->jpegs_down;
       sd_l->jpegs = g_new(struct jpeg *, num_jpegs);
@@ -1334,6 +1504,10 @@ static bool init_jpeg_ops(openslide_t *osr,
   data->restart_marker_cond_mutex = g_mutex_new();
   data->restart_marker_thread_throttle =
     !_openslide_debug(OPENSLIDE_DEBUG_JPEG_MARKERS);
+  if (background_thread && marker_index_load(num_jpegs, jpegs)) {
+    // a previous open already completed the scan; skip it
+    background_thread = false;
+  }
   if (background_thread) {
     data->restart_marker_thread = g_thread_create(restart_marker_thread_func,
                                                   osr,
@@ -1606,10 +1780,12 @@ static bool ngr_read_tile(openslide_t *osr,
 
   if (!tiledata) {
     // read the tile data
+    int64_t start = _openslide_now_usec();
     FILE *f = _openslide_fopen(l->filename, "rb", err);
     if (!f) {
       return false;
     }
+    _openslide_fadvise_random(f);
 
     // compute offset to read
     int64_t offset = l->start_in_file +
@@ -1622,45 +1798,41 @@ static bool ngr_read_tile(openslide_t *osr,
       return false;
     }
 
-    // alloc and read
-    int buf_size = tw * th * 6;
-    uint16_t *buf = g_slice_alloc(buf_size);
-
-    if (fread(buf, buf_size, 1, f) != 1) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Cannot read file %s", l->filename);
-      fclose(f);
-      g_slice_free1(buf_size, buf);
-      return false;
+    // read and convert to 8-bit xRGB one row at a time, so the packed
+    // samples are still in cache when they are scaled down
+    int row_size = tw * 6;
+    uint16_t *buf = g_slice_alloc(row_size);
+    tiledata = _openslide_tile_alloc(tilesize);
+    for (int64_t row = 0; row < th; row++) {
+      if (fread(buf, row_size, 1, f) != 1) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Cannot read file %s", l->filename);
+        fclose(f);
+        g_slice_free1(row_size, buf);
+        _openslide_tile_free(tilesize, tiledata);
+        return false;
+      }
+      _openslide_rgb48_to_xrgb(buf, tiledata + row * tw, tw);
     }
+    g_slice_free1(row_size, buf);
     fclose(f);
 
-    // got the data, now convert to 8-bit xRGB
-    tiledata = g_slice_alloc(tilesize);
-    for (int i = 0; i < tw * th; i++) {
-      // scale down from 12 bits
-      uint8_t r = GINT16_FROM_LE(buf[(i * 3)]) >> 4;
-      uint8_t g = GINT16_FROM_LE(buf[(i * 3) + 1]) >> 4;
-      uint8_t b = GINT16_FROM_LE(buf[(i * 3) + 2]) >> 4;
-
-      tiledata[i] = (r << 16) | (g << 8) | b;
-    }
-    g_slice_free1(buf_size, buf);
+    _openslide_stats_record_decode(osr, _OPENSLIDE_CODEC_OTHER, tw * th * 6,
+                                   _openslide_now_usec() - start);
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_x, tile_y,
+    _openslide_cache_put(osr->cache, osr, level, tile_x, tile_y,
                          tiledata,
                          tilesize,
                          &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_RGB24,
-                                                                 tw, th,
-                                                                 tw * 4);
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_RGB24,
+                                                          tw, th),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -2095,9 +2267,16 @@ static bool hamamatsu_vms_vmu_open(openslide_t *osr, const char *filename,
   return success;
 }
 
+static bool hamamatsu_vms_vmu_sniff(const char *filename G_GNUC_UNUSED,
+                                    struct _openslide_tifflike *tl) {
+  // no required extension; detect() parses the key file
+  return tl == NULL;
+}
+
 const struct _openslide_format _openslide_format_hamamatsu_vms_vmu = {
   .name = "hamamatsu-vms-vmu",
   .vendor = "hamamatsu",
+  .sniff = hamamatsu_vms_vmu_sniff,
   .detect = hamamatsu_vms_vmu_detect,
   .open = hamamatsu_vms_vmu_open,
 };
@@ -2450,9 +2629,15 @@ FAIL:
                        restart_marker_scan, err);
 }
 
+static bool hamamatsu_ndpi_sniff(const char *filename G_GNUC_UNUSED,
+                                 struct _openslide_tifflike *tl) {
+  return tl != NULL;
+}
+
 const struct _openslide_format _openslide_format_hamamatsu_ndpi = {
   .name = "hamamatsu-ndpi",
   .vendor = "hamamatsu",
+  .sniff = hamamatsu_ndpi_sniff,
   .detect = hamamatsu_ndpi_detect,
   .open = hamamatsu_ndpi_open,
 };
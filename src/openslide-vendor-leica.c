@@ -39,8 +39,6 @@
 #include <stdlib.h>
 #include <math.h>
 #include <tiffio.h>
-#include <libxml/tree.h>
-#include <libxml/xpath.h>
 
 static const char LEICA_XMLNS_1[] = "http://www.leica-microsystems.com/scn/2010/03/10";
 static const char LEICA_XMLNS_2[] = "http://www.leica-microsystems.com/scn/2010/10/01";
@@ -52,16 +50,6 @@ static const char LEICA_ATTR_IFD[] = "ifd";
 static const char LEICA_ATTR_Z_PLANE[] = "z";
 static const char LEICA_VALUE_BRIGHTFIELD[] = "brightfield";
 
-#define PARSE_INT_ATTRIBUTE_OR_FAIL(NODE, NAME, OUT)		\
-  do {								\
-    GError *tmp_err = NULL;					\
-    OUT = _openslide_xml_parse_int_attr(NODE, NAME, &tmp_err);	\
-    if (tmp_err)  {						\
-      g_propagate_error(err, tmp_err);				\
-      goto FAIL;						\
-    }								\
-  } while (0)
-
 struct leica_ops_data {
   struct _openslide_tiffcache *tc;
 };
@@ -162,11 +150,11 @@ static bool read_tile(openslide_t *osr,
                                             args->area, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, args->tiff,
+    tiledata = _openslide_tile_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, args->tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
@@ -174,24 +162,23 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache,
+    _openslide_cache_put(osr->cache, osr,
 			 args->area, tile_col, tile_row,
 			 tiledata, tw * th * 4,
 			 &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_ARGB32,
-                                                                 tw, th,
-                                                                 tw * 4);
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          tw, th),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -271,22 +258,20 @@ static bool leica_detect(const char *filename G_GNUC_UNUSED,
     return false;
   }
 
-  // try to parse the xml
-  xmlDoc *doc = _openslide_xml_parse(image_desc, err);
-  if (doc == NULL) {
+  // check the root element's default namespace without building a tree
+  char *ns;
+  if (!_openslide_xml_get_root_info(image_desc, NULL, &ns,
+                                    NULL, NULL, err)) {
     return false;
   }
-
-  // check default namespace
-  if (!_openslide_xml_has_default_namespace(doc, LEICA_XMLNS_1) &&
-      !_openslide_xml_has_default_namespace(doc, LEICA_XMLNS_2)) {
+  bool ok = ns && (!strcmp(ns, LEICA_XMLNS_1) || !strcmp(ns, LEICA_XMLNS_2));
+  g_free(ns);
+  if (!ok) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Unexpected XML namespace");
-    xmlFreeDoc(doc);
     return false;
   }
 
-  xmlFreeDoc(doc);
   return true;
 }
 
@@ -385,167 +370,291 @@ static void set_region_bounds_props(openslide_t *osr,
                       g_strdup_printf("%"PRId64, y1 - y0));
 }
 
-static struct collection *parse_xml_description(const char *xml,
-                                                GError **err) {
-  xmlXPathContext *ctx = NULL;
-  xmlXPathObject *images_result = NULL;
-  xmlXPathObject *result = NULL;
-  struct collection *collection = NULL;
-  bool success = false;
+// SAX state for parsing the collection without building a tree.
+// the recognizable structure is the following:
+/*
+  scn (root node)
+    collection
+      barcode		(2010/10/01 namespace only)
+      image
+        dimension
+        dimension
+      image
+        dimension
+        dimension
+*/
+struct scn_parser {
+  struct collection *collection;
+  struct image *image;       // image currently being parsed, or NULL
+
+  int depth;
+  int collection_depth;      // depth of collection element, or 0
+  int image_depth;           // depth of current image element, or 0
+  int scan_settings_depth;
+  int illumination_depth;
+  int objective_depth;
+  int pixels_depth;
+  bool saw_view;
+
+  GString *text;             // accumulator for the element being read
+  int text_depth;
+  char **text_dest;          // where the text goes when the element ends
+
+  char *barcode64;           // barcode element (2010/10/01), if present
+  char *barcode_attr;        // collection barcode attribute (2010/03/10)
+
+  GError **err;
+  bool failed;
+};
 
-  // parse the xml
-  xmlDoc *doc = _openslide_xml_parse(xml, err);
-  if (doc == NULL) {
-    return false;
-  }
+static void scn_capture_text(struct scn_parser *parser, char **dest) {
+  parser->text = g_string_new("");
+  parser->text_depth = parser->depth;
+  parser->text_dest = dest;
+}
 
-  // create XPATH context to query the document
-  ctx = _openslide_xml_xpath_create(doc);
-
-  // the recognizable structure is the following:
-  /*
-    scn (root node)
-      collection
-        barcode		(2010/10/01 namespace only)
-        image
-          dimension
-          dimension
-        image
-          dimension
-          dimension
-  */
-
-  // get collection node
-  xmlNode *collection_node = _openslide_xml_xpath_get_node(ctx,
-                                                           "/d:scn/d:collection");
-  if (!collection_node) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Can't find collection element");
-    goto FAIL;
+static void scn_start_element(void *state, const xmlChar *name,
+                              const xmlChar **atts) {
+  struct scn_parser *parser = state;
+  parser->depth++;
+  if (parser->failed) {
+    return;
   }
 
-  // create collection struct
-  collection = g_slice_new0(struct collection);
-  collection->images = g_ptr_array_new();
-
-  // Get barcode as stored in 2010/10/01 namespace
-  char *barcode = _openslide_xml_xpath_get_string(ctx, "/d:scn/d:collection/d:barcode/text()");
-  if (barcode) {
-    // Decode Base64
-    gsize len;
-    void *decoded = g_base64_decode(barcode, &len);
-    // null-terminate
-    collection->barcode = g_realloc(decoded, len + 1);
-    collection->barcode[len] = 0;
-    g_free(barcode);
-  } else {
-    // Fall back to 2010/03/10 namespace.  It's not clear whether this
-    // namespace also Base64-encodes the barcode, so we avoid performing
-    // a transformation that may not be correct.
-    collection->barcode = _openslide_xml_xpath_get_string(ctx, "/d:scn/d:collection/@barcode");
-  }
+  if (!parser->collection_depth && parser->depth == 2 &&
+      !xmlStrcmp(name, BAD_CAST "collection")) {
+    struct collection *collection = g_slice_new0(struct collection);
+    collection->images = g_ptr_array_new();
+    parser->collection = collection;
+    parser->collection_depth = parser->depth;
+    parser->barcode_attr =
+      g_strdup(_openslide_xml_sax_get_attr(atts, "barcode"));
+    if (!_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_SIZE_X,
+                                           &collection->nm_across,
+                                           parser->err) ||
+        !_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_SIZE_Y,
+                                           &collection->nm_down,
+                                           parser->err)) {
+      parser->failed = true;
+    }
 
-  PARSE_INT_ATTRIBUTE_OR_FAIL(collection_node, LEICA_ATTR_SIZE_X,
-                              collection->nm_across);
-  PARSE_INT_ATTRIBUTE_OR_FAIL(collection_node, LEICA_ATTR_SIZE_Y,
-                              collection->nm_down);
+  } else if (parser->collection_depth &&
+             parser->depth == parser->collection_depth + 1) {
+    if (!xmlStrcmp(name, BAD_CAST "barcode")) {
+      scn_capture_text(parser, &parser->barcode64);
+    } else if (!xmlStrcmp(name, BAD_CAST "image")) {
+      struct image *image = g_slice_new0(struct image);
+      image->dimensions = g_ptr_array_new();
+      g_ptr_array_add(parser->collection->images, image);
+      parser->image = image;
+      parser->image_depth = parser->depth;
+      parser->saw_view = false;
+    }
 
-  // get the image nodes
-  ctx->node = collection_node;
-  images_result = _openslide_xml_xpath_eval(ctx, "d:image");
-  if (!images_result) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Can't find any images");
-    goto FAIL;
-  }
+  } else if (parser->image_depth &&
+             parser->depth == parser->image_depth + 1) {
+    struct image *image = parser->image;
+    if (!xmlStrcmp(name, BAD_CAST "creationDate")) {
+      scn_capture_text(parser, &image->creation_date);
+    } else if (!xmlStrcmp(name, BAD_CAST "device")) {
+      image->device_model =
+        g_strdup(_openslide_xml_sax_get_attr(atts, "model"));
+      image->device_version =
+        g_strdup(_openslide_xml_sax_get_attr(atts, "version"));
+    } else if (!xmlStrcmp(name, BAD_CAST "view")) {
+      parser->saw_view = true;
+      if (!_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_SIZE_X,
+                                             &image->nm_across,
+                                             parser->err) ||
+          !_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_SIZE_Y,
+                                             &image->nm_down,
+                                             parser->err) ||
+          !_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_OFFSET_X,
+                                             &image->nm_offset_x,
+                                             parser->err) ||
+          !_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_OFFSET_Y,
+                                             &image->nm_offset_y,
+                                             parser->err)) {
+        parser->failed = true;
+      }
+    } else if (!xmlStrcmp(name, BAD_CAST "scanSettings")) {
+      parser->scan_settings_depth = parser->depth;
+    } else if (!xmlStrcmp(name, BAD_CAST "pixels")) {
+      parser->pixels_depth = parser->depth;
+    }
 
-  // create image structs
-  for (int i = 0; i < images_result->nodesetval->nodeNr; i++) {
-    xmlNode *image_node = images_result->nodesetval->nodeTab[i];
-    ctx->node = image_node;
+  } else if (parser->scan_settings_depth &&
+             parser->depth == parser->scan_settings_depth + 1) {
+    if (!xmlStrcmp(name, BAD_CAST "illuminationSettings")) {
+      parser->illumination_depth = parser->depth;
+    } else if (!xmlStrcmp(name, BAD_CAST "objectiveSettings")) {
+      parser->objective_depth = parser->depth;
+    }
 
-    // get view node
-    xmlNode *view = _openslide_xml_xpath_get_node(ctx, "d:view");
-    if (!view) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Can't find view node");
-      goto FAIL;
+  } else if (parser->illumination_depth &&
+             parser->depth == parser->illumination_depth + 1) {
+    if (!xmlStrcmp(name, BAD_CAST "illuminationSource")) {
+      scn_capture_text(parser, &parser->image->illumination_source);
+    } else if (!xmlStrcmp(name, BAD_CAST "numericalAperture")) {
+      scn_capture_text(parser, &parser->image->aperture);
     }
 
-    // create image struct
-    struct image *image = g_slice_new0(struct image);
-    image->dimensions = g_ptr_array_new();
-    g_ptr_array_add(collection->images, image);
-
-    image->creation_date = _openslide_xml_xpath_get_string(ctx, "d:creationDate/text()");
-    image->device_model = _openslide_xml_xpath_get_string(ctx, "d:device/@model");
-    image->device_version = _openslide_xml_xpath_get_string(ctx, "d:device/@version");
-    image->illumination_source = _openslide_xml_xpath_get_string(ctx, "d:scanSettings/d:illuminationSettings/d:illuminationSource/text()");
-    image->objective = _openslide_xml_xpath_get_string(ctx, "d:scanSettings/d:objectiveSettings/d:objective/text()");
-    image->aperture = _openslide_xml_xpath_get_string(ctx, "d:scanSettings/d:illuminationSettings/d:numericalAperture/text()");
-
-    PARSE_INT_ATTRIBUTE_OR_FAIL(view, LEICA_ATTR_SIZE_X,
-                                image->nm_across);
-    PARSE_INT_ATTRIBUTE_OR_FAIL(view, LEICA_ATTR_SIZE_Y,
-                                image->nm_down);
-    PARSE_INT_ATTRIBUTE_OR_FAIL(view, LEICA_ATTR_OFFSET_X,
-                                image->nm_offset_x);
-    PARSE_INT_ATTRIBUTE_OR_FAIL(view, LEICA_ATTR_OFFSET_Y,
-                                image->nm_offset_y);
-
-    image->is_macro = (image->nm_offset_x == 0 &&
-                       image->nm_offset_y == 0 &&
-                       image->nm_across == collection->nm_across &&
-                       image->nm_down == collection->nm_down);
-
-    // get dimensions
-    ctx->node = image_node;
-    result = _openslide_xml_xpath_eval(ctx, "d:pixels/d:dimension");
-    if (!result) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Can't find any dimensions in image");
-      goto FAIL;
+  } else if (parser->objective_depth &&
+             parser->depth == parser->objective_depth + 1 &&
+             !xmlStrcmp(name, BAD_CAST "objective")) {
+    scn_capture_text(parser, &parser->image->objective);
+
+  } else if (parser->pixels_depth &&
+             parser->depth == parser->pixels_depth + 1 &&
+             !xmlStrcmp(name, BAD_CAST "dimension")) {
+    // accept only dimensions from z-plane 0
+    // TODO: support multiple z-planes
+    const char *z = _openslide_xml_sax_get_attr(atts, LEICA_ATTR_Z_PLANE);
+    if (z && strcmp(z, "0")) {
+      return;
     }
 
-    // create dimension structs
-    for (int i = 0; i < result->nodesetval->nodeNr; i++) {
-      xmlNode *dimension_node = result->nodesetval->nodeTab[i];
+    struct dimension *dimension = g_slice_new0(struct dimension);
+    g_ptr_array_add(parser->image->dimensions, dimension);
+
+    if (!_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_IFD,
+                                           &dimension->dir,
+                                           parser->err) ||
+        !_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_SIZE_X,
+                                           &dimension->width,
+                                           parser->err) ||
+        !_openslide_xml_sax_parse_int_attr(atts, LEICA_ATTR_SIZE_Y,
+                                           &dimension->height,
+                                           parser->err)) {
+      parser->failed = true;
+    }
+  }
+}
 
-      // accept only dimensions from z-plane 0
-      // TODO: support multiple z-planes
-      xmlChar *z = xmlGetProp(dimension_node, BAD_CAST LEICA_ATTR_Z_PLANE);
-      if (z && strcmp((char *) z, "0")) {
-        xmlFree(z);
-        continue;
-      }
-      xmlFree(z);
+static void scn_characters(void *state, const xmlChar *ch, int len) {
+  struct scn_parser *parser = state;
+  if (parser->text && !parser->failed) {
+    g_string_append_len(parser->text, (const char *) ch, len);
+  }
+}
 
-      struct dimension *dimension = g_slice_new0(struct dimension);
-      g_ptr_array_add(image->dimensions, dimension);
+static void scn_end_element(void *state, const xmlChar *name G_GNUC_UNUSED) {
+  struct scn_parser *parser = state;
+
+  if (parser->text && parser->depth == parser->text_depth) {
+    if (!*parser->text_dest) {
+      *parser->text_dest = g_string_free(parser->text, false);
+    } else {
+      g_string_free(parser->text, true);
+    }
+    parser->text = NULL;
+  }
 
-      PARSE_INT_ATTRIBUTE_OR_FAIL(dimension_node, LEICA_ATTR_IFD,
-                                  dimension->dir);
-      PARSE_INT_ATTRIBUTE_OR_FAIL(dimension_node, LEICA_ATTR_SIZE_X,
-                                  dimension->width);
-      PARSE_INT_ATTRIBUTE_OR_FAIL(dimension_node, LEICA_ATTR_SIZE_Y,
-                                  dimension->height);
+  if (parser->illumination_depth == parser->depth) {
+    parser->illumination_depth = 0;
+  }
+  if (parser->objective_depth == parser->depth) {
+    parser->objective_depth = 0;
+  }
+  if (parser->scan_settings_depth == parser->depth) {
+    parser->scan_settings_depth = 0;
+  }
+  if (parser->pixels_depth == parser->depth) {
+    parser->pixels_depth = 0;
+  }
 
-      dimension->nm_per_pixel = (double) image->nm_across / dimension->width;
+  if (parser->image_depth == parser->depth) {
+    // finish the image
+    struct image *image = parser->image;
+    if (!parser->failed) {
+      if (!parser->saw_view) {
+        g_set_error(parser->err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Can't find view node");
+        parser->failed = true;
+      } else if (!image->dimensions->len) {
+        g_set_error(parser->err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Can't find any dimensions in image");
+        parser->failed = true;
+      } else {
+        image->is_macro =
+          (image->nm_offset_x == 0 &&
+           image->nm_offset_y == 0 &&
+           image->nm_across == parser->collection->nm_across &&
+           image->nm_down == parser->collection->nm_down);
+        for (uint32_t n = 0; n < image->dimensions->len; n++) {
+          struct dimension *dimension = image->dimensions->pdata[n];
+          dimension->nm_per_pixel =
+            (double) image->nm_across / dimension->width;
+        }
+        // sort dimensions
+        g_ptr_array_sort(image->dimensions, dimension_compare);
+      }
     }
-    xmlXPathFreeObject(result);
-    result = NULL;
+    parser->image = NULL;
+    parser->image_depth = 0;
+  }
 
-    // sort dimensions
-    g_ptr_array_sort(image->dimensions, dimension_compare);
+  if (parser->collection_depth == parser->depth) {
+    parser->collection_depth = 0;
   }
 
-  success = true;
+  parser->depth--;
+}
 
-FAIL:
-  xmlXPathFreeObject(result);
-  xmlXPathFreeObject(images_result);
-  xmlXPathFreeContext(ctx);
-  xmlFreeDoc(doc);
+static struct collection *parse_xml_description(const char *xml,
+                                                GError **err) {
+  GError *tmp_err = NULL;
+  struct scn_parser parser = {
+    .err = &tmp_err,
+  };
+  xmlSAXHandler sax = {
+    .startElement = scn_start_element,
+    .endElement = scn_end_element,
+    .characters = scn_characters,
+  };
+
+  // stream the document instead of building a tree and querying it
+  // with XPath
+  bool well_formed = _openslide_xml_sax_parse(xml, &sax, &parser,
+                                              &parser.failed, err);
+
+  struct collection *collection = parser.collection;
+  bool success = false;
+  if (parser.failed) {
+    // the handler stopped the parse; sax_parse did not set an error
+    g_propagate_error(err, tmp_err);
+  } else if (!well_formed) {
+    // err already set
+  } else if (!collection) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Can't find collection element");
+  } else if (!collection->images->len) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Can't find any images");
+  } else {
+    // Prefer the Base64 barcode element stored in the 2010/10/01
+    // namespace.  Fall back to the collection attribute from the
+    // 2010/03/10 namespace; it's not clear whether that namespace also
+    // Base64-encodes the barcode, so we avoid performing a
+    // transformation that may not be correct.
+    if (parser.barcode64) {
+      gsize len;
+      void *decoded = g_base64_decode(parser.barcode64, &len);
+      // null-terminate
+      collection->barcode = g_realloc(decoded, len + 1);
+      collection->barcode[len] = 0;
+    } else {
+      collection->barcode = parser.barcode_attr;
+      parser.barcode_attr = NULL;
+    }
+    success = true;
+  }
+
+  if (parser.text) {
+    g_string_free(parser.text, true);
+  }
+  g_free(parser.barcode64);
+  g_free(parser.barcode_attr);
 
   if (success) {
     return collection;
@@ -900,9 +1009,15 @@ FAIL:
   return false;
 }
 
+static bool leica_sniff(const char *filename G_GNUC_UNUSED,
+                        struct _openslide_tifflike *tl) {
+  return tl != NULL;
+}
+
 const struct _openslide_format _openslide_format_leica = {
   .name = "leica",
   .vendor = "leica",
+  .sniff = leica_sniff,
   .detect = leica_detect,
   .open = leica_open,
 };
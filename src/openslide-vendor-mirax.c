@@ -31,11 +31,12 @@
 #include <config.h>
 
 #include "openslide-private.h"
-#include "openslide-decode-gdkpixbuf.h"
+#include "openslide-decode-bmp.h"
 #include "openslide-decode-jpeg.h"
 #include "openslide-decode-png.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -49,6 +50,12 @@ static const char MRXS_EXT[] = ".mrxs";
 static const char SLIDEDAT_INI[] = "Slidedat.ini";
 static const int SLIDEDAT_MAX_SIZE = 1 << 20;
 
+// sidecar cache of the resolved hierarchy records, so reopening a slide
+// is a single sequential read instead of a page walk through Index.dat
+static const char TILEMAP_CACHE_SUFFIX[] = ".openslide-tilemap";
+#define TILEMAP_CACHE_MAGIC 0x4f53544d  // "OSTM"
+#define TILEMAP_CACHE_VERSION 1
+
 static const char GROUP_GENERAL[] = "GENERAL";
 static const char KEY_SLIDE_VERSION[] = "SLIDE_VERSION";
 static const char KEY_SLIDE_ID[] = "SLIDE_ID";
@@ -179,6 +186,11 @@ struct image {
   int32_t length;
   int32_t imageno;   // used only for cache lookup
   int refcount;
+
+  // neighbors packed adjacently in the same data file, for coalescing
+  // their reads into one sequential I/O; NULL at the ends of a run
+  struct image *prev_in_file;
+  struct image *next_in_file;
 };
 
 struct tile {
@@ -203,6 +215,7 @@ struct level {
 
 struct mirax_ops_data {
   gchar **datafile_paths;
+  GPtrArray *images;  // holds refs; sorted by (fileno, start_in_file)
 };
 
 static void image_unref(struct image *image) {
@@ -217,6 +230,85 @@ static void tile_free(gpointer data) {
   g_slice_free(struct tile, tile);
 }
 
+// Tile JPEGs are packed back-to-back inside the data files, and a
+// region's tiles are usually adjacent there.  On a miss, read the whole
+// run of neighboring images in one sequential I/O and stash the raw
+// bytes of the others in the cache, so their upcoming reads skip the
+// seek entirely.
+#define COALESCE_MAX_BYTES (1 << 20)
+// read through gaps up to this size between near-contiguous images
+#define COALESCE_MAX_GAP 4096
+
+static bool read_image_coalesced(openslide_t *osr,
+                                 struct mirax_ops_data *data,
+                                 struct image *image,
+                                 uint32_t *dest,
+                                 int w, int h,
+                                 GError **err) {
+  // grow the run in both directions while it fits the budget; the grid
+  // paints tiles back to front, so the preceding images are the likelier
+  // upcoming requests, but cover both ends
+  struct image *first = image;
+  struct image *last = image;
+  bool grew = true;
+  while (grew) {
+    grew = false;
+    struct image *p = first->prev_in_file;
+    if (p && (int64_t) last->start_in_file + last->length -
+             p->start_in_file <= COALESCE_MAX_BYTES) {
+      first = p;
+      grew = true;
+    }
+    struct image *n = last->next_in_file;
+    if (n && (int64_t) n->start_in_file + n->length -
+             first->start_in_file <= COALESCE_MAX_BYTES) {
+      last = n;
+      grew = true;
+    }
+  }
+  int64_t run_start = first->start_in_file;
+  int64_t run_len = (int64_t) last->start_in_file + last->length - run_start;
+
+  // one sequential read for the whole run
+  FILE *f = _openslide_fopen(data->datafile_paths[image->fileno], "rb", err);
+  if (!f) {
+    return false;
+  }
+  _openslide_fadvise_willneed(f, run_start, run_len);
+  uint8_t *run = g_malloc(run_len);
+  if (fseeko(f, run_start, SEEK_SET) == -1 ||
+      fread(run, run_len, 1, f) != 1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Can't read %"PRId64" bytes at %"PRId64" in %s",
+                run_len, run_start, data->datafile_paths[image->fileno]);
+    g_free(run);
+    fclose(f);
+    return false;
+  }
+  fclose(f);
+
+  // stash the raw bytes of the other images in the run for their reads
+  for (struct image *n = first; n; n = n->next_in_file) {
+    if (n != image) {
+      struct _openslide_cache_entry *entry;
+      void *copy = g_slice_copy(n->length,
+                                run + (n->start_in_file - run_start));
+      _openslide_cache_put(osr->cache, osr, data, n->imageno, 0,
+                           copy, n->length, &entry);
+      _openslide_cache_entry_unref(entry);
+    }
+    if (n == last) {
+      break;
+    }
+  }
+
+  bool result =
+    _openslide_jpeg_decode_buffer(run + (image->start_in_file - run_start),
+                                  image->length, dest, w, h, err);
+  g_free(run);
+  return result;
+}
+
 static uint32_t *read_image(openslide_t *osr,
                             struct image *image,
                             enum image_format format,
@@ -225,36 +317,51 @@ static uint32_t *read_image(openslide_t *osr,
   struct mirax_ops_data *data = osr->data;
   bool result = false;
 
-  uint32_t *dest = g_slice_alloc(w * h * 4);
+  uint32_t *dest = _openslide_tile_alloc(w * h * 4);
+
+  int64_t start = _openslide_now_usec();
+  enum _openslide_codec codec = _OPENSLIDE_CODEC_OTHER;
 
   switch (format) {
-  case FORMAT_JPEG:
-    result = _openslide_jpeg_read(data->datafile_paths[image->fileno],
-                                  image->start_in_file,
-                                  dest, w, h,
-                                  err);
+  case FORMAT_JPEG: {
+    codec = _OPENSLIDE_CODEC_JPEG;
+    // raw bytes stashed by an earlier coalesced read?
+    struct _openslide_cache_entry *raw_entry = NULL;
+    void *buf = _openslide_cache_get(osr->cache, data, image->imageno, 0,
+                                     &raw_entry);
+    if (buf) {
+      result = _openslide_jpeg_decode_buffer(buf,
+                                             _openslide_cache_entry_size(raw_entry),
+                                             dest, w, h, err);
+      _openslide_cache_entry_unref(raw_entry);
+    } else {
+      result = read_image_coalesced(osr, data, image, dest, w, h, err);
+    }
     break;
+  }
   case FORMAT_PNG:
+    codec = _OPENSLIDE_CODEC_PNG;
     result = _openslide_png_read(data->datafile_paths[image->fileno],
                                  image->start_in_file,
                                  dest, w, h,
                                  err);
     break;
   case FORMAT_BMP:
-    result = _openslide_gdkpixbuf_read("bmp",
-                                       data->datafile_paths[image->fileno],
-                                       image->start_in_file, image->length,
-                                       dest, w, h,
-                                       err);
+    result = _openslide_bmp_read(data->datafile_paths[image->fileno],
+                                 image->start_in_file, image->length,
+                                 dest, w, h,
+                                 err);
     break;
   default:
     g_assert_not_reached();
   }
 
   if (!result) {
-    g_slice_free1(w * h * 4, dest);
+    _openslide_tile_free(w * h * 4, dest);
     return NULL;
   }
+  _openslide_stats_record_decode(osr, codec, image->length,
+                                 _openslide_now_usec() - start);
   return dest;
 }
 
@@ -289,18 +396,19 @@ static bool read_tile(openslide_t *osr,
       return false;
     }
 
-    _openslide_cache_put(osr->cache,
+    _openslide_cache_put(osr->cache, osr,
                          level, tile->image->imageno, 0,
                          tiledata,
                          iw * ih * 4,
                          &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_RGB24,
-                                                                 iw, ih,
-                                                                 iw * 4);
+  // draw it, reusing the surface cached on the entry (take a reference
+  // so the common cleanup below can unconditionally destroy)
+  cairo_surface_t *surface =
+    cairo_surface_reference(_openslide_cache_entry_surface(cache_entry,
+                                                           CAIRO_FORMAT_RGB24,
+                                                           iw, ih));
 
   // if we are drawing a subregion of the tile, we must do an additional copy,
   // because cairo lacks source clipping
@@ -362,6 +470,12 @@ static void destroy(openslide_t *osr) {
   g_free(osr->levels);
 
   // the ops data
+  if (data->images) {
+    for (uint32_t i = 0; i < data->images->len; i++) {
+      image_unref(data->images->pdata[i]);
+    }
+    g_ptr_array_free(data->images, true);
+  }
   g_strfreev(data->datafile_paths);
   g_slice_free(struct mirax_ops_data, data);
 }
@@ -442,6 +556,26 @@ static int32_t read_le_int32_from_file(FILE *f) {
   return i;
 }
 
+static bool write_le_int32_to_file(FILE *f, int32_t i) {
+  i = GINT32_TO_LE(i);
+  return fwrite(&i, 4, 1, f) == 1;
+}
+
+static bool read_le_int64_from_file_with_result(FILE *f, int64_t *OUT) {
+  if (fread(OUT, 8, 1, f) != 1) {
+    return false;
+  }
+
+  *OUT = GINT64_FROM_LE(*OUT);
+
+  return true;
+}
+
+static bool write_le_int64_to_file(FILE *f, int64_t i) {
+  i = GINT64_TO_LE(i);
+  return fwrite(&i, 8, 1, f) == 1;
+}
+
 
 static bool read_nonhier_record(FILE *f,
 				int64_t nonhier_root_position,
@@ -675,31 +809,35 @@ static bool get_tile_position(int32_t *slide_positions,
   }
 }
 
-static bool process_hier_data_pages_from_indexfile(FILE *f,
+// one resolved record from the hierarchical section of Index.dat
+struct image_record {
+  int32_t image_index;
+  int32_t offset;
+  int32_t length;
+  int32_t fileno;
+};
+
+static void record_arrays_free(GPtrArray *record_arrays) {
+  if (record_arrays == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < record_arrays->len; i++) {
+    g_array_free(record_arrays->pdata[i], true);
+  }
+  g_ptr_array_free(record_arrays, true);
+}
+
+// walk the data pages for each zoom level and collect the raw records;
+// validation and tile creation happen in process_image_records
+static GPtrArray *read_hier_records_from_indexfile(FILE *f,
 						   int64_t seek_location,
-						   int datafile_count,
-						   char **datafile_paths,
 						   int zoom_levels,
-						   struct level **levels,
-						   int images_across,
-						   int images_down,
-						   int image_divisions,
-						   const struct slide_zoom_level_params *slide_zoom_level_params,
-						   int32_t *slide_positions,
-						   struct _openslide_hash *quickhash1,
 						   GError **err) {
-  int32_t image_number = 0;
-
-  bool success = false;
-
-  // used for storing which positions actually have data
-  GHashTable *active_positions = g_hash_table_new_full(g_int_hash, g_int_equal,
-						       g_free, NULL);
+  GPtrArray *record_arrays = g_ptr_array_new();
 
   for (int zoom_level = 0; zoom_level < zoom_levels; zoom_level++) {
-    struct level *l = levels[zoom_level];
-    const struct slide_zoom_level_params *lp = slide_zoom_level_params +
-        zoom_level;
+    GArray *records = g_array_new(false, false, sizeof(struct image_record));
+    g_ptr_array_add(record_arrays, records);
     int32_t ptr;
 
     //    g_debug("reading zoom_level %d", zoom_level);
@@ -707,26 +845,26 @@ static bool process_hier_data_pages_from_indexfile(FILE *f,
     if (fseeko(f, seek_location, SEEK_SET) == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Cannot seek to zoom level pointer %d", zoom_level);
-      goto DONE;
+      goto FAIL;
     }
 
     ptr = read_le_int32_from_file(f);
     if (ptr == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Can't read zoom level pointer");
-      goto DONE;
+      goto FAIL;
     }
     if (fseeko(f, ptr, SEEK_SET) == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Cannot seek to start of data pages");
-      goto DONE;
+      goto FAIL;
     }
 
     // read initial 0
     if (read_le_int32_from_file(f) != 0) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Expected 0 value at beginning of data page");
-      goto DONE;
+      goto FAIL;
     }
 
     // read pointer
@@ -734,14 +872,14 @@ static bool process_hier_data_pages_from_indexfile(FILE *f,
     if (ptr == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Can't read initial data page pointer");
-      goto DONE;
+      goto FAIL;
     }
 
     // seek to offset
     if (fseeko(f, ptr, SEEK_SET) == -1) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Can't seek to initial data page");
-      goto DONE;
+      goto FAIL;
     }
 
     int32_t next_ptr;
@@ -751,7 +889,7 @@ static bool process_hier_data_pages_from_indexfile(FILE *f,
       if (page_len == -1) {
         g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                     "Can't read page length");
-        goto DONE;
+        goto FAIL;
       }
 
       //    g_debug("page_len: %d", page_len);
@@ -761,148 +899,200 @@ static bool process_hier_data_pages_from_indexfile(FILE *f,
       if (next_ptr == -1) {
         g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                     "Cannot read \"next\" pointer");
-        goto DONE;
+        goto FAIL;
       }
 
       // read all the data into the list
       for (int i = 0; i < page_len; i++) {
-	int32_t image_index = read_le_int32_from_file(f);
-	int32_t offset = read_le_int32_from_file(f);
-	int32_t length = read_le_int32_from_file(f);
-	int32_t fileno = read_le_int32_from_file(f);
-
-	if (image_index < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "image_index < 0");
-          goto DONE;
-	}
-	if (offset < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "offset < 0");
-          goto DONE;
-	}
-	if (length < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "length < 0");
-          goto DONE;
-	}
-	if (fileno < 0) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "fileno < 0");
-          goto DONE;
-	}
+	struct image_record rec;
+	rec.image_index = read_le_int32_from_file(f);
+	rec.offset = read_le_int32_from_file(f);
+	rec.length = read_le_int32_from_file(f);
+	rec.fileno = read_le_int32_from_file(f);
+	g_array_append_val(records, rec);
+      }
+    } while (next_ptr != 0);
+
+    // advance for next zoom level
+    seek_location += 4;
+  }
 
-	// we have only encountered slides with exactly power-of-two scale
-	// factors, and there appears to be no clear way to specify otherwise,
-	// so require it
-	int32_t x = image_index % images_across;
-	int32_t y = image_index / images_across;
+  return record_arrays;
 
-	if (y >= images_down) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "y (%d) outside of bounds for zoom level (%d)",
-                      y, zoom_level);
-          goto DONE;
-	}
+ FAIL:
+  record_arrays_free(record_arrays);
+  return NULL;
+}
 
-	if (x % lp->image_concat) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "x (%d) not correct multiple for zoom level (%d)",
-                      x, zoom_level);
-          goto DONE;
-	}
-	if (y % lp->image_concat) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "y (%d) not correct multiple for zoom level (%d)",
-                      y, zoom_level);
-          goto DONE;
-	}
+static bool process_image_records(GPtrArray *record_arrays,
+				  int datafile_count,
+				  char **datafile_paths,
+				  int zoom_levels,
+				  struct level **levels,
+				  int images_across,
+				  int images_down,
+				  int image_divisions,
+				  const struct slide_zoom_level_params *slide_zoom_level_params,
+				  int32_t *slide_positions,
+				  GPtrArray *all_images,
+				  struct _openslide_hash *quickhash1,
+				  GError **err) {
+  int32_t image_number = 0;
+
+  bool success = false;
 
-	// save filename
-	if (fileno >= datafile_count) {
-          g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                      "Invalid fileno");
+  // used for storing which positions actually have data
+  GHashTable *active_positions = g_hash_table_new_full(g_int_hash, g_int_equal,
+						       g_free, NULL);
+
+  for (int zoom_level = 0; zoom_level < zoom_levels; zoom_level++) {
+    struct level *l = levels[zoom_level];
+    const struct slide_zoom_level_params *lp = slide_zoom_level_params +
+        zoom_level;
+    GArray *records = record_arrays->pdata[zoom_level];
+
+    for (uint32_t n = 0; n < records->len; n++) {
+      struct image_record *rec = &g_array_index(records,
+                                                struct image_record, n);
+      int32_t image_index = rec->image_index;
+      int32_t offset = rec->offset;
+      int32_t length = rec->length;
+      int32_t fileno = rec->fileno;
+
+      if (image_index < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "image_index < 0");
+        goto DONE;
+      }
+      if (offset < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "offset < 0");
+        goto DONE;
+      }
+      if (length < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "length < 0");
+        goto DONE;
+      }
+      if (fileno < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "fileno < 0");
+        goto DONE;
+      }
+
+      // we have only encountered slides with exactly power-of-two scale
+      // factors, and there appears to be no clear way to specify otherwise,
+      // so require it
+      int32_t x = image_index % images_across;
+      int32_t y = image_index / images_across;
+
+      if (y >= images_down) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "y (%d) outside of bounds for zoom level (%d)",
+                    y, zoom_level);
+        goto DONE;
+      }
+
+      if (x % lp->image_concat) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "x (%d) not correct multiple for zoom level (%d)",
+                    x, zoom_level);
+        goto DONE;
+      }
+      if (y % lp->image_concat) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "y (%d) not correct multiple for zoom level (%d)",
+                    y, zoom_level);
+        goto DONE;
+      }
+
+      // save filename
+      if (fileno >= datafile_count) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Invalid fileno");
+        goto DONE;
+      }
+
+      // hash in the lowest-res images
+      if (zoom_level == zoom_levels - 1) {
+        if (!_openslide_hash_file_part(quickhash1, datafile_paths[fileno],
+                                       offset, length, err)) {
+          g_prefix_error(err, "Can't hash images: ");
           goto DONE;
-	}
+        }
+      }
 
-	// hash in the lowest-res images
-	if (zoom_level == zoom_levels - 1) {
-	  if (!_openslide_hash_file_part(quickhash1, datafile_paths[fileno],
-	                                 offset, length, err)) {
-            g_prefix_error(err, "Can't hash images: ");
-            goto DONE;
-	  }
+      // populate the image structure
+      struct image *image = g_slice_new0(struct image);
+      image->fileno = fileno;
+      image->start_in_file = offset;
+      image->length = length;
+      image->imageno = image_number++;
+      image->refcount = 1;
+
+      /*
+      g_debug("image_concat: %d, tiles_per_image: %d",
+	      lp->image_concat, lp->tiles_per_image);
+      g_debug("found %d %d from file", x, y);
+      */
+
+
+      // start processing 1 image into tiles_per_image^2 tiles
+      for (int yi = 0; yi < lp->tiles_per_image; yi++) {
+	int yy = y + (yi * image_divisions);
+	if (yy >= images_down) {
+	  break;
 	}
 
-	// populate the image structure
-	struct image *image = g_slice_new0(struct image);
-	image->fileno = fileno;
-	image->start_in_file = offset;
-	image->length = length;
-	image->imageno = image_number++;
-	image->refcount = 1;
-
-	/*
-	g_debug("image_concat: %d, tiles_per_image: %d",
-		lp->image_concat, lp->tiles_per_image);
-	g_debug("found %d %d from file", x, y);
-	*/
-
-
-	// start processing 1 image into tiles_per_image^2 tiles
-	for (int yi = 0; yi < lp->tiles_per_image; yi++) {
-	  int yy = y + (yi * image_divisions);
-	  if (yy >= images_down) {
+	for (int xi = 0; xi < lp->tiles_per_image; xi++) {
+	  int xx = x + (xi * image_divisions);
+	  if (xx >= images_across) {
 	    break;
 	  }
 
-	  for (int xi = 0; xi < lp->tiles_per_image; xi++) {
-	    int xx = x + (xi * image_divisions);
-	    if (xx >= images_across) {
-	      break;
-	    }
-
-	    // xx and yy are the image coordinates in level0 space
-
-	    // position in level 0
-            int pos0_x;
-            int pos0_y;
-            if (!get_tile_position(slide_positions,
-                                   active_positions,
-                                   slide_zoom_level_params,
-                                   levels,
-                                   images_across,
-                                   image_divisions,
-                                   zoom_level,
-                                   xx, yy,
-                                   &pos0_x, &pos0_y)) {
-              // no such position
-              continue;
-            }
-
-	    // position in this level
-	    const double pos_x = ((double) pos0_x) / lp->image_concat;
-	    const double pos_y = ((double) pos0_y) / lp->image_concat;
-
-	    //g_debug("pos0: %d %d, pos: %g %g", pos0_x, pos0_y, pos_x, pos_y);
-
-	    insert_tile(l, lp,
-                        image,
-                        pos_x, pos_y,
-                        l->tile_w * xi, l->tile_h * yi,
-                        x / lp->tile_count_divisor + xi,
-                        y / lp->tile_count_divisor + yi,
-                        zoom_level);
-	  }
+	  // xx and yy are the image coordinates in level0 space
+
+	  // position in level 0
+          int pos0_x;
+          int pos0_y;
+          if (!get_tile_position(slide_positions,
+                                 active_positions,
+                                 slide_zoom_level_params,
+                                 levels,
+                                 images_across,
+                                 image_divisions,
+                                 zoom_level,
+                                 xx, yy,
+                                 &pos0_x, &pos0_y)) {
+            // no such position
+            continue;
+          }
+
+	  // position in this level
+	  const double pos_x = ((double) pos0_x) / lp->image_concat;
+	  const double pos_y = ((double) pos0_y) / lp->image_concat;
+
+	  //g_debug("pos0: %d %d, pos: %g %g", pos0_x, pos0_y, pos_x, pos_y);
+
+	  insert_tile(l, lp,
+                      image,
+                      pos_x, pos_y,
+                      l->tile_w * xi, l->tile_h * yi,
+                      x / lp->tile_count_divisor + xi,
+                      y / lp->tile_count_divisor + yi,
+                      zoom_level);
 	}
+      }
 
-	// drop initial reference, possibly free
-	image_unref(image);
+      // index the image for coalesced reads if any tile references it
+      if (image->refcount > 1) {
+        image->refcount++;
+        g_ptr_array_add(all_images, image);
       }
-    } while (next_ptr != 0);
 
-    // advance for next zoom level
-    seek_location += 4;
+      // drop initial reference, possibly free
+      image_unref(image);
+    }
   }
 
   success = true;
@@ -913,6 +1103,186 @@ static bool process_hier_data_pages_from_indexfile(FILE *f,
   return success;
 }
 
+static gint image_compare_file_order(gconstpointer a, gconstpointer b) {
+  const struct image *ia = *(struct image * const *) a;
+  const struct image *ib = *(struct image * const *) b;
+  if (ia->fileno != ib->fileno) {
+    return ia->fileno - ib->fileno;
+  }
+  if (ia->start_in_file != ib->start_in_file) {
+    return ia->start_in_file < ib->start_in_file ? -1 : 1;
+  }
+  return 0;
+}
+
+// sort the image index into file order and link images that are adjacent
+// (or separated by a small gap) into runs for coalesced reads
+static void link_images_in_file_order(GPtrArray *images) {
+  g_ptr_array_sort(images, image_compare_file_order);
+  for (uint32_t i = 1; i < images->len; i++) {
+    struct image *prev = images->pdata[i - 1];
+    struct image *cur = images->pdata[i];
+    if (prev->fileno != cur->fileno) {
+      continue;
+    }
+    int64_t gap = (int64_t) cur->start_in_file -
+                  ((int64_t) prev->start_in_file + prev->length);
+    if (gap < 0 || gap > COALESCE_MAX_GAP) {
+      continue;
+    }
+    prev->next_in_file = cur;
+    cur->prev_in_file = prev;
+  }
+}
+
+static bool tilemap_cache_stat(const char *path,
+                               int64_t *size, int64_t *mtime) {
+  GStatBuf st;
+  if (g_stat(path, &st)) {
+    return false;
+  }
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+  return true;
+}
+
+// load the cached records, validating against the size and mtime of
+// Slidedat.ini and Index.dat.  any mismatch or short read discards the
+// cache and falls back to walking the index pages.
+static GPtrArray *tilemap_cache_load(const char *cache_path,
+                                     const char *slidedat_path,
+                                     const char *index_path,
+                                     int zoom_levels) {
+  GPtrArray *record_arrays = NULL;
+
+  FILE *f = _openslide_fopen(cache_path, "rb", NULL);
+  if (f == NULL) {
+    return NULL;
+  }
+
+  int64_t slidedat_size, slidedat_mtime;
+  int64_t index_size, index_mtime;
+  if (!tilemap_cache_stat(slidedat_path, &slidedat_size, &slidedat_mtime) ||
+      !tilemap_cache_stat(index_path, &index_size, &index_mtime)) {
+    goto FAIL;
+  }
+
+  int32_t val32;
+  int64_t val64;
+  if (!read_le_int32_from_file_with_result(f, &val32) ||
+      val32 != TILEMAP_CACHE_MAGIC) {
+    goto FAIL;
+  }
+  if (!read_le_int32_from_file_with_result(f, &val32) ||
+      val32 != TILEMAP_CACHE_VERSION) {
+    goto FAIL;
+  }
+  if (!read_le_int64_from_file_with_result(f, &val64) ||
+      val64 != slidedat_size) {
+    goto FAIL;
+  }
+  if (!read_le_int64_from_file_with_result(f, &val64) ||
+      val64 != slidedat_mtime) {
+    goto FAIL;
+  }
+  if (!read_le_int64_from_file_with_result(f, &val64) ||
+      val64 != index_size) {
+    goto FAIL;
+  }
+  if (!read_le_int64_from_file_with_result(f, &val64) ||
+      val64 != index_mtime) {
+    goto FAIL;
+  }
+  if (!read_le_int32_from_file_with_result(f, &val32) ||
+      val32 != zoom_levels) {
+    goto FAIL;
+  }
+
+  record_arrays = g_ptr_array_new();
+  for (int zoom_level = 0; zoom_level < zoom_levels; zoom_level++) {
+    int32_t count;
+    if (!read_le_int32_from_file_with_result(f, &count) || count < 0) {
+      goto FAIL;
+    }
+
+    GArray *records = g_array_new(false, false, sizeof(struct image_record));
+    g_ptr_array_add(record_arrays, records);
+    for (int32_t n = 0; n < count; n++) {
+      struct image_record rec;
+      if (!read_le_int32_from_file_with_result(f, &rec.image_index) ||
+          !read_le_int32_from_file_with_result(f, &rec.offset) ||
+          !read_le_int32_from_file_with_result(f, &rec.length) ||
+          !read_le_int32_from_file_with_result(f, &rec.fileno)) {
+        goto FAIL;
+      }
+      // reject anything the index walk could not have produced
+      if (rec.image_index < 0 || rec.offset < 0 ||
+          rec.length < 0 || rec.fileno < 0) {
+        goto FAIL;
+      }
+      g_array_append_val(records, rec);
+    }
+  }
+
+  fclose(f);
+  return record_arrays;
+
+ FAIL:
+  record_arrays_free(record_arrays);
+  fclose(f);
+  return NULL;
+}
+
+// best effort; reopening just falls back to the page walk if this fails
+static void tilemap_cache_save(const char *cache_path,
+                               const char *slidedat_path,
+                               const char *index_path,
+                               GPtrArray *record_arrays) {
+  int64_t slidedat_size, slidedat_mtime;
+  int64_t index_size, index_mtime;
+  if (!tilemap_cache_stat(slidedat_path, &slidedat_size, &slidedat_mtime) ||
+      !tilemap_cache_stat(index_path, &index_size, &index_mtime)) {
+    return;
+  }
+
+  // write to a temporary file and rename so a concurrent open never sees
+  // a partial cache
+  char *tmp_path = g_strconcat(cache_path, ".tmp", NULL);
+  FILE *f = _openslide_fopen(tmp_path, "wb", NULL);
+  if (f == NULL) {
+    g_free(tmp_path);
+    return;
+  }
+
+  bool ok = write_le_int32_to_file(f, TILEMAP_CACHE_MAGIC) &&
+            write_le_int32_to_file(f, TILEMAP_CACHE_VERSION) &&
+            write_le_int64_to_file(f, slidedat_size) &&
+            write_le_int64_to_file(f, slidedat_mtime) &&
+            write_le_int64_to_file(f, index_size) &&
+            write_le_int64_to_file(f, index_mtime) &&
+            write_le_int32_to_file(f, record_arrays->len);
+  for (uint32_t zoom_level = 0;
+       ok && zoom_level < record_arrays->len;
+       zoom_level++) {
+    GArray *records = record_arrays->pdata[zoom_level];
+    ok = write_le_int32_to_file(f, records->len);
+    for (uint32_t n = 0; ok && n < records->len; n++) {
+      struct image_record *rec = &g_array_index(records,
+                                                struct image_record, n);
+      ok = write_le_int32_to_file(f, rec->image_index) &&
+           write_le_int32_to_file(f, rec->offset) &&
+           write_le_int32_to_file(f, rec->length) &&
+           write_le_int32_to_file(f, rec->fileno);
+    }
+  }
+  ok = (fclose(f) == 0) && ok;
+
+  if (!ok || g_rename(tmp_path, cache_path)) {
+    g_unlink(tmp_path);
+  }
+  g_free(tmp_path);
+}
+
 static void *inflate_buffer(const void *src,
                             int64_t src_len,
                             int64_t dst_len,
@@ -1080,6 +1450,8 @@ static bool add_associated_image(openslide_t *osr,
 
 static bool process_indexfile(openslide_t *osr,
 			      const char *uuid,
+			      const char *slidedat_path,
+			      const char *index_path,
 			      int datafile_count,
 			      char **datafile_paths,
 			      int vimslide_position_record,
@@ -1096,6 +1468,7 @@ static bool process_indexfile(openslide_t *osr,
 			      const struct slide_zoom_level_params *slide_zoom_level_params,
 			      FILE *indexfile,
 			      struct level **levels,
+			      GPtrArray *all_images,
 			      struct _openslide_hash *quickhash1,
 			      GError **err) {
   char *teststr = NULL;
@@ -1269,23 +1642,49 @@ static bool process_indexfile(openslide_t *osr,
     goto DONE;
   }
 
-  // read these pages in
-  if (!process_hier_data_pages_from_indexfile(indexfile,
-					      ptr,
-					      datafile_count,
-					      datafile_paths,
-					      zoom_levels,
-					      levels,
-					      images_x,
-					      images_y,
-					      image_divisions,
-					      slide_zoom_level_params,
-					      slide_positions,
-					      quickhash1,
-					      err)) {
+  // get the resolved records, from the sidecar cache if it is still valid
+  char *cache_path = g_strconcat(index_path, TILEMAP_CACHE_SUFFIX, NULL);
+  GPtrArray *record_arrays = tilemap_cache_load(cache_path,
+                                                slidedat_path,
+                                                index_path,
+                                                zoom_levels);
+  bool cached = (record_arrays != NULL);
+  if (!cached) {
+    record_arrays = read_hier_records_from_indexfile(indexfile,
+                                                     ptr,
+                                                     zoom_levels,
+                                                     err);
+    if (!record_arrays) {
+      g_free(cache_path);
+      goto DONE;
+    }
+  }
+
+  // validate the records and build the tile map
+  if (!process_image_records(record_arrays,
+			     datafile_count,
+			     datafile_paths,
+			     zoom_levels,
+			     levels,
+			     images_x,
+			     images_y,
+			     image_divisions,
+			     slide_zoom_level_params,
+			     slide_positions,
+			     all_images,
+			     quickhash1,
+			     err)) {
+    record_arrays_free(record_arrays);
+    g_free(cache_path);
     goto DONE;
   }
 
+  if (!cached) {
+    tilemap_cache_save(cache_path, slidedat_path, index_path, record_arrays);
+  }
+  record_arrays_free(record_arrays);
+  g_free(cache_path);
+
   success = true;
 
  DONE:
@@ -1503,6 +1902,8 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   int objective_magnification = 0;
 
   char *index_filename = NULL;
+  char *slidedat_path = NULL;
+  char *index_path = NULL;
   int zoom_levels = 0;
   int hier_count = 0;
   int nonhier_count = 0;
@@ -1522,6 +1923,8 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   int datafile_count = 0;
   char **datafile_paths = NULL;
 
+  GPtrArray *all_images = g_ptr_array_new();
+
   FILE *indexfile = NULL;
 
   int64_t base_w = 0;
@@ -1533,20 +1936,18 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   dirname = g_strndup(filename, strlen(filename) - strlen(MRXS_EXT));
 
   // first, check slidedat
-  tmp = g_build_filename(dirname, SLIDEDAT_INI, NULL);
+  slidedat_path = g_build_filename(dirname, SLIDEDAT_INI, NULL);
   // hash the slidedat
-  if (!_openslide_hash_file(quickhash1, tmp, err)) {
+  if (!_openslide_hash_file(quickhash1, slidedat_path, err)) {
     goto FAIL;
   }
 
-  slidedat = _openslide_read_key_file(tmp, SLIDEDAT_MAX_SIZE,
+  slidedat = _openslide_read_key_file(slidedat_path, SLIDEDAT_MAX_SIZE,
                                       G_KEY_FILE_NONE, err);
   if (!slidedat) {
     g_prefix_error(err, "Can't load Slidedat.ini file: ");
     goto FAIL;
   }
-  g_free(tmp);
-  tmp = NULL;
 
   // add properties
   add_properties(osr, slidedat);
@@ -1777,10 +2178,8 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   */
 
   // read indexfile
-  tmp = g_build_filename(dirname, index_filename, NULL);
-  indexfile = _openslide_fopen(tmp, "rb", err);
-  g_free(tmp);
-  tmp = NULL;
+  index_path = g_build_filename(dirname, index_filename, NULL);
+  indexfile = _openslide_fopen(index_path, "rb", err);
 
   if (!indexfile) {
     goto FAIL;
@@ -1938,6 +2337,8 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   // load the position map and build up the tiles
   if (!process_indexfile(osr,
 			 slide_id,
+			 slidedat_path,
+			 index_path,
 			 datafile_count, datafile_paths,
 			 position_nonhier_vimslide_offset,
 			 position_nonhier_stitching_offset,
@@ -1952,11 +2353,15 @@ static bool mirax_open(openslide_t *osr, const char *filename,
 			 slide_zoom_level_params,
 			 indexfile,
 			 levels,
+			 all_images,
 			 quickhash1,
 			 err)) {
     goto FAIL;
   }
 
+  // index the images in file order for coalesced reads
+  link_images_in_file_order(all_images);
+
   // set properties
   _openslide_set_bounds_props_from_grid(osr, levels[0]->grid);
   uint32_t fill = slide_zoom_level_sections[0].fill_rgb;
@@ -2009,6 +2414,8 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   struct mirax_ops_data *data = g_slice_new0(struct mirax_ops_data);
   data->datafile_paths = datafile_paths;
   datafile_paths = NULL;
+  data->images = all_images;
+  all_images = NULL;
   osr->data = data;
 
   // set ops
@@ -2032,11 +2439,19 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   success = false;
 
  DONE:
+  if (all_images) {
+    for (uint32_t i = 0; i < all_images->len; i++) {
+      image_unref(all_images->pdata[i]);
+    }
+    g_ptr_array_free(all_images, true);
+  }
   g_free(dirname);
   g_free(tmp);
   g_free(slide_version);
   g_free(slide_id);
   g_free(index_filename);
+  g_free(slidedat_path);
+  g_free(index_path);
   g_strfreev(datafile_paths);
   g_strfreev(slide_zoom_level_section_names);
   g_free(slide_zoom_level_sections);
@@ -2054,9 +2469,15 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   return success;
 }
 
+static bool mirax_sniff(const char *filename,
+                        struct _openslide_tifflike *tl) {
+  return !tl && g_str_has_suffix(filename, MRXS_EXT);
+}
+
 const struct _openslide_format _openslide_format_mirax = {
   .name = "mirax",
   .vendor = "mirax",
+  .sniff = mirax_sniff,
   .detect = mirax_detect,
   .open = mirax_open,
 };
@@ -48,21 +48,21 @@ static const char XML_NAME_ATTR[] = "Name";
 static const char XML_SCANNED_IMAGES_NAME[] = "PIM_DP_SCANNED_IMAGES";
 static const char XML_DATA_REPRESENTATION_NAME[] = "PIIM_PIXEL_DATA_REPRESENTATION_SEQUENCE";
 
+static const char XML_IMAGE_TYPE_NAME[] = "PIM_DP_IMAGE_TYPE";
+static const char XML_IMAGE_DATA_NAME[] = "PIM_DP_IMAGE_DATA";
+
 static const char LABEL_DESCRIPTION[] = "Label";
 static const char MACRO_DESCRIPTION[] = "Macro";
 
+static const char LABEL_IMAGE_TYPE[] = "LABELIMAGE";
+static const char MACRO_IMAGE_TYPE[] = "MACROIMAGE";
+
 #define SCANNED_IMAGE_XPATH(image_type) \
   "/DataObject/Attribute[@Name='PIM_DP_SCANNED_IMAGES']/Array" \
   "/DataObject[Attribute/@Name='PIM_DP_IMAGE_TYPE' and " \
   "Attribute/text()='" image_type "']"
 static const char MAIN_IMAGE_XPATH[] = SCANNED_IMAGE_XPATH("WSI");
 
-#define ASSOCIATED_IMAGE_DATA_XPATH(image_type) \
-  SCANNED_IMAGE_XPATH(image_type) "[1]" \
-  "/Attribute[@Name='PIM_DP_IMAGE_DATA']/text()"
-static const char LABEL_DATA_XPATH[] = ASSOCIATED_IMAGE_DATA_XPATH("LABELIMAGE");
-static const char MACRO_DATA_XPATH[] = ASSOCIATED_IMAGE_DATA_XPATH("MACROIMAGE");
-
 struct philips_ops_data {
   struct _openslide_tiffcache *tc;
 };
@@ -76,7 +76,7 @@ struct level {
 struct xml_associated_image {
   struct _openslide_associated_image base;
   struct _openslide_tiffcache *tc;
-  const char *xpath;  // static string; do not free
+  const char *image_type;  // static string; do not free
 };
 
 static void destroy(openslide_t *osr) {
@@ -87,6 +87,7 @@ static void destroy(openslide_t *osr) {
   for (int32_t i = 0; i < osr->level_count; i++) {
     struct level *l = (struct level *) osr->levels[i];
     _openslide_grid_destroy(l->grid);
+    g_free(l->tiffl.missing_tiles);
     g_slice_free(struct level, l);
   }
   g_free(osr->levels);
@@ -122,14 +123,14 @@ static bool read_tile(openslide_t *osr,
 
     if (is_missing) {
       // fill with transparent
-      tiledata = g_slice_alloc0(tw * th * 4);
+      tiledata = _openslide_tile_alloc0(tw * th * 4);
 
     } else {
-      tiledata = g_slice_alloc(tw * th * 4);
-      if (!_openslide_tiff_read_tile(tiffl, tiff,
+      tiledata = _openslide_tile_alloc(tw * th * 4);
+      if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                      tiledata, tile_col, tile_row,
                                      err)) {
-        g_slice_free1(tw * th * 4, tiledata);
+        _openslide_tile_free(tw * th * 4, tiledata);
         return false;
       }
 
@@ -139,24 +140,23 @@ static bool read_tile(openslide_t *osr,
                                 l->base.w - tile_col * tw,
                                 l->base.h - tile_row * th,
                                 err)) {
-        g_slice_free1(tw * th * 4, tiledata);
+        _openslide_tile_free(tw * th * 4, tiledata);
         return false;
       }
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
+    _openslide_cache_put(osr->cache, osr, level, tile_col, tile_row,
                          tiledata, tw * th * 4,
                          &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_ARGB32,
-                                                                 tw, th,
-                                                                 tw * 4);
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          tw, th),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -223,37 +223,32 @@ static bool philips_detect(const char *filename G_GNUC_UNUSED,
     return false;
   }
 
-  // try to parse the XML
-  xmlDoc *doc = _openslide_xml_parse(image_desc, err);
-  if (doc == NULL) {
+  // check the root element without building a tree; the document embeds
+  // the associated images and can run to many megabytes
+  char *root_name;
+  char *type;
+  if (!_openslide_xml_get_root_info(image_desc, &root_name, NULL,
+                                    XML_ROOT_TYPE_ATTR, &type, err)) {
     return false;
   }
 
-  // check root tag name
-  xmlNode *root = xmlDocGetRootElement(doc);
-  if (xmlStrcmp(root->name, BAD_CAST XML_ROOT)) {
+  bool success = false;
+  if (strcmp(root_name, XML_ROOT)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Root tag not %s", XML_ROOT);
-    xmlFreeDoc(doc);
-    return false;
-  }
-
-  // check root tag type
-  xmlChar *type = xmlGetProp(root, BAD_CAST XML_ROOT_TYPE_ATTR);
-  if (!type || xmlStrcmp(type, BAD_CAST XML_ROOT_TYPE_VALUE)) {
+  } else if (!type || strcmp(type, XML_ROOT_TYPE_VALUE)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Root %s not \"%s\"", XML_ROOT_TYPE_ATTR, XML_ROOT_TYPE_VALUE);
-    xmlFree(type);
-    xmlFreeDoc(doc);
-    return false;
+  } else {
+    success = true;
   }
-  xmlFree(type);
 
-  xmlFreeDoc(doc);
-  return true;
+  g_free(root_name);
+  g_free(type);
+  return success;
 }
 
-static xmlDoc *parse_xml(TIFF *tiff, GError **err) {
+static const char *read_image_desc(TIFF *tiff, GError **err) {
   if (!_openslide_tiff_set_dir(tiff, 0, err)) {
     return NULL;
   }
@@ -264,25 +259,125 @@ static xmlDoc *parse_xml(TIFF *tiff, GError **err) {
                 "Couldn't read ImageDescription");
     return NULL;
   }
+  return image_desc;
+}
+
+static xmlDoc *parse_xml(TIFF *tiff, GError **err) {
+  const char *image_desc = read_image_desc(tiff, err);
+  if (!image_desc) {
+    return NULL;
+  }
   return _openslide_xml_parse(image_desc, err);
 }
 
-static bool get_compressed_xml_associated_image_data(xmlDoc *doc,
-                                                     const char *xpath,
+// SAX state for extracting one associated image payload without
+// building a tree
+struct image_data_parser {
+  const char *image_type;
+
+  int depth;
+  int scanned_depth;  // depth of PIM_DP_SCANNED_IMAGES Attribute, or 0
+  int object_depth;   // depth of current scanned image DataObject, or 0
+  GString *capture;   // accumulator for the Attribute being read, or NULL
+  GString *type;      // PIM_DP_IMAGE_TYPE of the current DataObject
+  GString *data;      // PIM_DP_IMAGE_DATA of the current DataObject
+  char *result;
+  bool done;
+};
+
+static void image_data_start_element(void *state, const xmlChar *name,
+                                     const xmlChar **atts) {
+  struct image_data_parser *parser = state;
+  parser->depth++;
+  if (parser->done) {
+    return;
+  }
+
+  if (!xmlStrcmp(name, BAD_CAST "Attribute")) {
+    const char *attr_name = _openslide_xml_sax_get_attr(atts,
+                                                        XML_NAME_ATTR);
+    if (!parser->scanned_depth && parser->depth == 2 &&
+        !g_strcmp0(attr_name, XML_SCANNED_IMAGES_NAME)) {
+      parser->scanned_depth = parser->depth;
+    } else if (parser->object_depth &&
+               parser->depth == parser->object_depth + 1) {
+      if (!g_strcmp0(attr_name, XML_IMAGE_TYPE_NAME)) {
+        parser->capture = parser->type;
+      } else if (!g_strcmp0(attr_name, XML_IMAGE_DATA_NAME)) {
+        parser->capture = parser->data;
+      }
+    }
+  } else if (parser->scanned_depth && !parser->object_depth &&
+             parser->depth == parser->scanned_depth + 2 &&
+             !xmlStrcmp(name, BAD_CAST XML_ROOT)) {
+    // DataObject for one scanned image
+    parser->object_depth = parser->depth;
+    g_string_truncate(parser->type, 0);
+    g_string_truncate(parser->data, 0);
+  }
+}
+
+static void image_data_characters(void *state, const xmlChar *ch, int len) {
+  struct image_data_parser *parser = state;
+  if (parser->capture && !parser->done) {
+    g_string_append_len(parser->capture, (const char *) ch, len);
+  }
+}
+
+static void image_data_end_element(void *state,
+                                   const xmlChar *name G_GNUC_UNUSED) {
+  struct image_data_parser *parser = state;
+  if (!parser->done) {
+    if (parser->capture && parser->depth == parser->object_depth + 1) {
+      parser->capture = NULL;
+    }
+    if (parser->object_depth && parser->depth == parser->object_depth) {
+      if (!strcmp(parser->type->str, parser->image_type) &&
+          parser->data->len) {
+        parser->result = g_strdup(parser->data->str);
+        parser->done = true;
+      }
+      parser->object_depth = 0;
+    }
+    if (parser->scanned_depth && parser->depth == parser->scanned_depth) {
+      parser->scanned_depth = 0;
+    }
+  }
+  parser->depth--;
+}
+
+static bool get_compressed_xml_associated_image_data(const char *xml,
+                                                     const char *image_type,
                                                      void **out_data,
                                                      gsize *out_len,
                                                      GError **err) {
-  xmlXPathContext *ctx = _openslide_xml_xpath_create(doc);
-  char *b64_data = _openslide_xml_xpath_get_string(ctx, xpath);
-  if (b64_data) {
-    *out_data = g_base64_decode(b64_data, out_len);
-  } else {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Couldn't read associated image data");
+  struct image_data_parser parser = {
+    .image_type = image_type,
+    .type = g_string_new(""),
+    .data = g_string_new(""),
+  };
+  xmlSAXHandler sax = {
+    .startElement = image_data_start_element,
+    .endElement = image_data_end_element,
+    .characters = image_data_characters,
+  };
+
+  bool success = _openslide_xml_sax_parse(xml, &sax, &parser,
+                                          &parser.done, err);
+  if (success) {
+    if (parser.result) {
+      *out_data = g_base64_decode(parser.result, out_len);
+    } else {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't read associated image data");
+      success = false;
+    }
   }
-  g_free(b64_data);
-  xmlXPathFreeContext(ctx);
-  return b64_data != NULL;
+
+  g_free(parser.result);
+  g_string_free(parser.type, true);
+  g_string_free(parser.data, true);
+  return success;
 }
 
 static bool get_xml_associated_image_data(struct _openslide_associated_image *_img,
@@ -297,13 +392,14 @@ static bool get_xml_associated_image_data(struct _openslide_associated_image *_i
     return false;
   }
 
-  xmlDoc *doc = parse_xml(tiff, err);
-  if (!doc) {
+  // stream the XML rather than building a tree
+  const char *xml = read_image_desc(tiff, err);
+  if (!xml) {
     goto DONE;
   }
 
   gsize len;
-  if (!get_compressed_xml_associated_image_data(doc, img->xpath,
+  if (!get_compressed_xml_associated_image_data(xml, img->image_type,
                                                 &data, &len, err)) {
     goto DONE;
   }
@@ -313,9 +409,6 @@ static bool get_xml_associated_image_data(struct _openslide_associated_image *_i
 
 DONE:
   g_free(data);
-  if (doc) {
-    xmlFreeDoc(doc);
-  }
   _openslide_tiffcache_put(img->tc, tiff);
   return success;
 }
@@ -331,12 +424,12 @@ static const struct _openslide_associated_image_ops philips_xml_associated_ops =
   .destroy = destroy_xml_associated_image,
 };
 
-// xpath is not copied (must be a static string)
+// image_type is not copied (must be a static string)
 static bool maybe_add_xml_associated_image(openslide_t *osr,
                                            struct _openslide_tiffcache *tc,
-                                           xmlDoc *doc,
+                                           const char *xml,
                                            const char *name,
-                                           const char *xpath,
+                                           const char *image_type,
                                            GError **err) {
   if (g_hash_table_lookup(osr->associated_images, name)) {
     // already added from TIFF directory
@@ -345,7 +438,7 @@ static bool maybe_add_xml_associated_image(openslide_t *osr,
 
   void *data;
   gsize len;
-  if (!get_compressed_xml_associated_image_data(doc, xpath,
+  if (!get_compressed_xml_associated_image_data(xml, image_type,
                                                 &data, &len, err)) {
     g_prefix_error(err, "Can't locate %s associated image: ", name);
     return false;
@@ -366,7 +459,7 @@ static bool maybe_add_xml_associated_image(openslide_t *osr,
   img->base.w = w;
   img->base.h = h;
   img->tc = tc;
-  img->xpath = xpath;
+  img->image_type = image_type;
 
   g_hash_table_insert(osr->associated_images, g_strdup(name), img);
 
@@ -623,6 +716,12 @@ static bool philips_open(openslide_t *osr,
         g_slice_free(struct level, l);
         goto FAIL;
       }
+      // slides with multiple ROIs are sparse; index the missing tiles
+      // once so the paint loop can skip them without touching libtiff
+      if (!_openslide_tiff_init_missing_tilemap(tiffl, tiff, err)) {
+        g_slice_free(struct level, l);
+        goto FAIL;
+      }
       l->grid = _openslide_grid_create_simple(osr,
                                               tiffl->tiles_across,
                                               tiffl->tiles_down,
@@ -691,10 +790,13 @@ static bool philips_open(openslide_t *osr,
 
   // add associated images from XML
   // errors are non-fatal
-  maybe_add_xml_associated_image(osr, tc, doc,
-                                 "label", LABEL_DATA_XPATH, NULL);
-  maybe_add_xml_associated_image(osr, tc, doc,
-                                 "macro", MACRO_DATA_XPATH, NULL);
+  const char *image_desc = read_image_desc(tiff, NULL);
+  if (image_desc) {
+    maybe_add_xml_associated_image(osr, tc, image_desc,
+                                   "label", LABEL_IMAGE_TYPE, NULL);
+    maybe_add_xml_associated_image(osr, tc, image_desc,
+                                   "macro", MACRO_IMAGE_TYPE, NULL);
+  }
 
   // unwrap level array
   int32_t level_count = level_array->len;
@@ -727,6 +829,7 @@ FAIL:
     for (uint32_t n = 0; n < level_array->len; n++) {
       struct level *l = level_array->pdata[n];
       _openslide_grid_destroy(l->grid);
+      g_free(l->tiffl.missing_tiles);
       g_slice_free(struct level, l);
     }
     g_ptr_array_free(level_array, true);
@@ -743,9 +846,15 @@ DONE:
   return success;
 }
 
+static bool philips_sniff(const char *filename G_GNUC_UNUSED,
+                          struct _openslide_tifflike *tl) {
+  return tl != NULL;
+}
+
 const struct _openslide_format _openslide_format_philips = {
   .name = "philips",
   .vendor = "philips",
+  .sniff = philips_sniff,
   .detect = philips_detect,
   .open = philips_open,
 };
@@ -92,6 +92,20 @@ struct sakura_ops_data {
   char *data_sql;
   int32_t tile_size;
   int32_t focal_plane;
+
+  // pool of database connections with the tile query prepared, reused
+  // across paint_region calls (modeled on the TIFF handle cache)
+  GQueue *db_pool;
+  GMutex *db_pool_lock;
+  int db_pool_max;
+  void *budget_pool;  // process-wide idle handle accounting
+};
+
+// a database connection and its cached prepared statement; not
+// thread-safe, check out of the pool for exclusive use
+struct db_handle {
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
 };
 
 struct level {
@@ -175,6 +189,74 @@ FAIL:
   return result;
 }
 
+static void db_handle_free(struct db_handle *h) {
+  sqlite3_finalize(h->stmt);
+  _openslide_sqlite_close(h->db);
+  g_slice_free(struct db_handle, h);
+}
+
+// close one idle connection on behalf of the process-wide budget
+static void db_pool_trim(void *_data) {
+  struct sakura_ops_data *data = _data;
+
+  g_mutex_lock(data->db_pool_lock);
+  struct db_handle *h = g_queue_pop_tail(data->db_pool);
+  g_mutex_unlock(data->db_pool_lock);
+
+  if (h) {
+    db_handle_free(h);
+    _openslide_handle_pool_release(data->budget_pool);
+  }
+}
+
+static struct db_handle *db_handle_get(struct sakura_ops_data *data,
+                                       GError **err) {
+  g_mutex_lock(data->db_pool_lock);
+  struct db_handle *h = g_queue_pop_head(data->db_pool);
+  g_mutex_unlock(data->db_pool_lock);
+  if (h) {
+    _openslide_handle_pool_release(data->budget_pool);
+    return h;
+  }
+
+  // pool is empty; open a new connection and prepare the tile query
+  sqlite3 *db = _openslide_sqlite_open(data->filename, err);
+  if (!db) {
+    return NULL;
+  }
+  sqlite3_stmt *stmt = _openslide_sqlite_prepare(db, data->data_sql, err);
+  if (!stmt) {
+    _openslide_sqlite_close(db);
+    return NULL;
+  }
+  h = g_slice_new0(struct db_handle);
+  h->db = db;
+  h->stmt = stmt;
+  return h;
+}
+
+static void db_handle_put(struct sakura_ops_data *data, struct db_handle *h) {
+  // release any row the statement still holds
+  sqlite3_reset(h->stmt);
+
+  g_mutex_lock(data->db_pool_lock);
+  bool want = (int) g_queue_get_length(data->db_pool) < data->db_pool_max;
+  g_mutex_unlock(data->db_pool_lock);
+
+  // account against the process-wide budget outside our lock, since
+  // this can trim another pool which takes its own lock
+  if (want && _openslide_handle_pool_retain(data->budget_pool)) {
+    g_mutex_lock(data->db_pool_lock);
+    g_queue_push_head(data->db_pool, h);
+    g_mutex_unlock(data->db_pool_lock);
+    h = NULL;
+  }
+
+  if (h) {
+    db_handle_free(h);
+  }
+}
+
 static void destroy_level(struct level *l) {
   _openslide_grid_destroy(l->grid);
   g_slice_free(struct level, l);
@@ -182,6 +264,14 @@ static void destroy_level(struct level *l) {
 
 static void destroy(openslide_t *osr) {
   struct sakura_ops_data *data = osr->data;
+  struct db_handle *h;
+  while ((h = g_queue_pop_head(data->db_pool))) {
+    db_handle_free(h);
+    _openslide_handle_pool_release(data->budget_pool);
+  }
+  _openslide_handle_pool_unregister(data->budget_pool);
+  g_queue_free(data->db_pool);
+  g_mutex_free(data->db_pool_lock);
   g_free(data->filename);
   g_free(data->data_sql);
   g_slice_free(struct sakura_ops_data, data);
@@ -295,6 +385,7 @@ static bool read_channel(uint8_t *channeldata,
                          int32_t focal_plane,
                          int32_t tile_size,
                          sqlite3_stmt *stmt,
+                         int64_t *bytes_read,
                          GError **err) {
   // compute tile id
   char *tileid = make_tileid(tile_col * tile_size * downsample,
@@ -308,6 +399,7 @@ static bool read_channel(uint8_t *channeldata,
   const void *buf = sqlite3_column_blob(stmt, 0);
   int buflen = sqlite3_column_bytes(stmt, 0);
   g_free(tileid);
+  *bytes_read += buflen;
 
   // decompress
   return _openslide_jpeg_decode_buffer_gray(buf, buflen, channeldata,
@@ -318,7 +410,8 @@ FAIL:
   return false;
 }
 
-static bool read_image(uint32_t *tiledata,
+static bool read_image(openslide_t *osr,
+                       uint32_t *tiledata,
                        int64_t tile_col, int64_t tile_row,
                        int64_t downsample,
                        int32_t focal_plane,
@@ -328,18 +421,23 @@ static bool read_image(uint32_t *tiledata,
   uint8_t *red_channel = g_slice_alloc(tile_size * tile_size);
   uint8_t *green_channel = g_slice_alloc(tile_size * tile_size);
   uint8_t *blue_channel = g_slice_alloc(tile_size * tile_size);
+  int64_t start = _openslide_now_usec();
+  int64_t bytes_read = 0;
   bool success = false;
 
   if (!read_channel(red_channel, tile_col, tile_row, downsample,
-                    INDEX_RED, focal_plane, tile_size, stmt, err)) {
+                    INDEX_RED, focal_plane, tile_size, stmt,
+                    &bytes_read, err)) {
     goto OUT;
   }
   if (!read_channel(green_channel, tile_col, tile_row, downsample,
-                    INDEX_GREEN, focal_plane, tile_size, stmt, err)) {
+                    INDEX_GREEN, focal_plane, tile_size, stmt,
+                    &bytes_read, err)) {
     goto OUT;
   }
   if (!read_channel(blue_channel, tile_col, tile_row, downsample,
-                    INDEX_BLUE, focal_plane, tile_size, stmt, err)) {
+                    INDEX_BLUE, focal_plane, tile_size, stmt,
+                    &bytes_read, err)) {
     goto OUT;
   }
 
@@ -350,6 +448,8 @@ static bool read_image(uint32_t *tiledata,
                   blue_channel[i];
   }
 
+  _openslide_stats_record_decode(osr, _OPENSLIDE_CODEC_JPEG, bytes_read,
+                                 _openslide_now_usec() - start);
   success = true;
 
 OUT:
@@ -377,10 +477,10 @@ static bool read_tile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tile_size * tile_size * 4);
+    tiledata = _openslide_tile_alloc(tile_size * tile_size * 4);
 
     // read tile
-    if (!read_image(tiledata, tile_col, tile_row, l->base.downsample,
+    if (!read_image(osr, tiledata, tile_col, tile_row, l->base.downsample,
                     data->focal_plane, tile_size, stmt, &tmp_err)) {
       if (g_error_matches(tmp_err, OPENSLIDE_ERROR,
                           OPENSLIDE_ERROR_NO_VALUE)) {
@@ -389,7 +489,7 @@ static bool read_tile(openslide_t *osr,
         return true;
       } else {
         g_propagate_error(err, tmp_err);
-        g_slice_free1(tile_size * tile_size * 4, tiledata);
+        _openslide_tile_free(tile_size * tile_size * 4, tiledata);
         return false;
       }
     }
@@ -400,24 +500,24 @@ static bool read_tile(openslide_t *osr,
                               l->base.w - tile_col * tile_size,
                               l->base.h - tile_row * tile_size,
                               err)) {
-      g_slice_free1(tile_size * tile_size * 4, tiledata);
+      _openslide_tile_free(tile_size * tile_size * 4, tiledata);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache,
+    _openslide_cache_put(osr->cache, osr,
 			 level, tile_col, tile_row,
 			 tiledata, tile_size * tile_size * 4,
 			 &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_ARGB32,
-                                                                 tile_size, tile_size,
-                                                                 tile_size * 4);
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          tile_size,
+                                                          tile_size),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -433,24 +533,19 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
                          GError **err) {
   struct sakura_ops_data *data = osr->data;
   struct level *l = (struct level *) level;
-  sqlite3_stmt *stmt = NULL;
-  bool success = false;
 
-  sqlite3 *db = _openslide_sqlite_open(data->filename, err);
-  if (!db) {
+  struct db_handle *h = db_handle_get(data, err);
+  if (!h) {
     return false;
   }
-  PREPARE_OR_FAIL(stmt, db, data->data_sql);
 
-  success = _openslide_grid_paint_region(l->grid, cr, stmt,
-                                         x / l->base.downsample,
-                                         y / l->base.downsample,
-                                         level, w, h,
-                                         err);
+  bool success = _openslide_grid_paint_region(l->grid, cr, h->stmt,
+                                              x / l->base.downsample,
+                                              y / l->base.downsample,
+                                              level, w, h,
+                                              err);
 
-FAIL:
-  sqlite3_finalize(stmt);
-  _openslide_sqlite_close(db);
+  db_handle_put(data, h);
   return success;
 }
 
@@ -995,6 +1090,10 @@ static bool sakura_open(openslide_t *osr, const char *filename,
     g_strdup_printf("SELECT data FROM %s WHERE id=?", unique_table_name);
   data->tile_size = tile_size;
   data->focal_plane = chosen_focal_plane;
+  data->db_pool = g_queue_new();
+  data->db_pool_lock = g_mutex_new();
+  data->db_pool_max = _openslide_num_processors();
+  data->budget_pool = _openslide_handle_pool_register(db_pool_trim, data);
 
   // commit
   g_assert(osr->data == NULL);
@@ -1024,9 +1123,16 @@ FAIL:
   return success;
 }
 
+static bool sakura_sniff(const char *filename G_GNUC_UNUSED,
+                         struct _openslide_tifflike *tl) {
+  // no required extension; detect() probes the SQLite schema
+  return tl == NULL;
+}
+
 const struct _openslide_format _openslide_format_sakura = {
   .name = "sakura",
   .vendor = "sakura",
+  .sniff = sakura_sniff,
   .detect = sakura_detect,
   .open = sakura_open,
 };
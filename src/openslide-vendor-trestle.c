@@ -83,7 +83,6 @@ static bool read_tile(openslide_t *osr,
                       cairo_t *cr,
                       struct _openslide_level *level,
                       int64_t tile_col, int64_t tile_row,
-                      void *tile G_GNUC_UNUSED,
                       void *arg,
                       GError **err) {
   struct level *l = (struct level *) level;
@@ -100,11 +99,11 @@ static bool read_tile(openslide_t *osr,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
+    tiledata = _openslide_tile_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
@@ -112,23 +111,22 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
+    _openslide_cache_put(osr->cache, osr, level, tile_col, tile_row,
                          tiledata, tw * th * 4,
                          &cache_entry);
   }
 
-  // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_ARGB32,
-                                                                 tw, th,
-                                                                 tw * 4);
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          tw, th),
+                           0, 0);
   cairo_paint(cr);
 
   // done with the cache entry, release it
@@ -361,6 +359,11 @@ static bool trestle_open(openslide_t *osr, const char *filename,
     if (i < overlap_count) {
       overlap_x = overlaps[2 * i];
       overlap_y = overlaps[2 * i + 1];
+      // ignore nonsensical overlaps that would leave no tile advance
+      if (overlap_x >= tiffl->tile_w || overlap_y >= tiffl->tile_h) {
+        overlap_x = 0;
+        overlap_y = 0;
+      }
       // if any level has overlaps, reporting tile advances would mislead the
       // application
       if (overlap_x || overlap_y) {
@@ -376,22 +379,16 @@ static bool trestle_open(openslide_t *osr, const char *filename,
       l->base.h -= (tiffl->tiles_down - 1) * overlap_y;
     }
 
-    // create grid
-    l->grid = _openslide_grid_create_tilemap(osr,
-                                             tiffl->tile_w - overlap_x,
-                                             tiffl->tile_h - overlap_y,
-                                             read_tile, NULL);
-
-    // add tiles
-    for (int64_t y = 0; y < tiffl->tiles_down; y++) {
-      for (int64_t x = 0; x < tiffl->tiles_across; x++) {
-        _openslide_grid_tilemap_add_tile(l->grid,
-                                         x, y,
-                                         0, 0,
-                                         tiffl->tile_w, tiffl->tile_h,
-                                         NULL);
-      }
-    }
+    // create grid; the overlap geometry is perfectly regular, so the
+    // paint path can index tiles arithmetically by the constant advance
+    l->grid = _openslide_grid_create_stride(osr,
+                                            tiffl->tiles_across,
+                                            tiffl->tiles_down,
+                                            tiffl->tile_w,
+                                            tiffl->tile_h,
+                                            tiffl->tile_w - overlap_x,
+                                            tiffl->tile_h - overlap_y,
+                                            read_tile);
   }
   g_free(overlaps);
   overlaps = NULL;
@@ -444,9 +441,15 @@ FAIL:
   return false;
 }
 
+static bool trestle_sniff(const char *filename G_GNUC_UNUSED,
+                          struct _openslide_tifflike *tl) {
+  return tl != NULL;
+}
+
 const struct _openslide_format _openslide_format_trestle = {
   .name = "trestle",
   .vendor = "trestle",
+  .sniff = trestle_sniff,
   .detect = trestle_detect,
   .open = trestle_open,
 };
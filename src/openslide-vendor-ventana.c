@@ -98,7 +98,18 @@ struct level {
   struct _openslide_level base;
   struct _openslide_tiff_level tiffl;
   struct _openslide_grid *grid;
-  int64_t subtiles_per_tile;
+};
+
+// precomputed at open for each BIF subtile: the source TIFF tile it
+// belongs to and the window of that tile it covers, so the paint path
+// doesn't rederive the geometry on every read
+struct subtile {
+  int64_t tile_col;
+  int64_t tile_row;
+  double src_x;
+  double src_y;
+  double w;
+  double h;
 };
 
 // structs used during BIF open
@@ -148,37 +159,30 @@ static void destroy(openslide_t *osr) {
 static bool read_subtile(openslide_t *osr,
                          cairo_t *cr,
                          struct _openslide_level *level,
-                         int64_t subtile_col, int64_t subtile_row,
+                         int64_t tile_col, int64_t tile_row,
+                         double src_x, double src_y,
+                         double w, double h,
                          void *arg,
                          GError **err) {
   struct level *l = (struct level *) level;
   struct _openslide_tiff_level *tiffl = &l->tiffl;
   TIFF *tiff = arg;
-  bool success = true;
 
-  // tile size and coordinates
-  int64_t tile_col = subtile_col / l->subtiles_per_tile;
-  int64_t tile_row = subtile_row / l->subtiles_per_tile;
+  // tile size
   int64_t tw = tiffl->tile_w;
   int64_t th = tiffl->tile_h;
 
-  // subtile offset and size
-  double subtile_w = (double) tw / l->subtiles_per_tile;
-  double subtile_h = (double) th / l->subtiles_per_tile;
-  double subtile_x = subtile_col % l->subtiles_per_tile * subtile_w;
-  double subtile_y = subtile_row % l->subtiles_per_tile * subtile_h;
-
   // get tile data, possibly from cache
   struct _openslide_cache_entry *cache_entry;
   uint32_t *tiledata = _openslide_cache_get(osr->cache,
                                             level, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
+    tiledata = _openslide_tile_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
@@ -186,64 +190,68 @@ static bool read_subtile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_free(tw * th * 4, tiledata);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
+    _openslide_cache_put(osr->cache, osr, level, tile_col, tile_row,
                          tiledata, tw * th * 4,
                          &cache_entry);
   }
 
-  // draw
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_ARGB32,
-                                                                 tw, th,
-                                                                 tw * 4);
-
-  // if we are drawing a subtile, we must do an additional copy,
-  // because cairo lacks source clipping
-  if (l->subtiles_per_tile > 1) {
-    cairo_surface_t *surface2 = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-                                                           ceil(subtile_w),
-                                                           ceil(subtile_h));
-    cairo_t *cr2 = cairo_create(surface2);
-    cairo_set_source_surface(cr2, surface, -subtile_x, -subtile_y);
-
-    // replace original image surface
-    cairo_surface_destroy(surface);
-    surface = surface2;
-
-    cairo_rectangle(cr2, 0, 0,
-                    ceil(subtile_w),
-                    ceil(subtile_h));
-    cairo_fill(cr2);
-    success = _openslide_check_cairo_status(cr2, err);
-    cairo_destroy(cr2);
+  // draw, reusing the surface cached on the entry
+  cairo_surface_t *surface = _openslide_cache_entry_surface(cache_entry,
+                                                            CAIRO_FORMAT_ARGB32,
+                                                            tw, th);
+  if (src_x != 0 || src_y != 0 || w != tw || h != th) {
+    // drawing a subtile; clip the destination to its window rather
+    // than copying it out of the tile surface
+    cairo_save(cr);
+    cairo_rectangle(cr, 0, 0, ceil(w), ceil(h));
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, surface, -src_x, -src_y);
+    cairo_paint(cr);
+    cairo_restore(cr);
+  } else {
+    cairo_set_source_surface(cr, surface, 0, 0);
+    cairo_paint(cr);
   }
 
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
-  cairo_paint(cr);
-
   // done with the cache entry, release it
   _openslide_cache_entry_unref(cache_entry);
 
-  return success;
+  return true;
 }
 
-// read_subtile wrapper for BIF that drops the extra argument passed by
-// the tilemap grid
+// read_subtile wrapper for BIF; the tilemap grid hands us the subtile
+// geometry resolved at open by create_bif_grid()
 static bool read_subtile_tilemap(openslide_t *osr,
                                  cairo_t *cr,
                                  struct _openslide_level *level,
-                                 int64_t subtile_col, int64_t subtile_row,
-                                 void *subtile G_GNUC_UNUSED,
+                                 int64_t tile_col G_GNUC_UNUSED,
+                                 int64_t tile_row G_GNUC_UNUSED,
+                                 void *subtile,
                                  void *arg,
                                  GError **err) {
+  struct subtile *st = subtile;
+  return read_subtile(osr, cr, level,
+                      st->tile_col, st->tile_row,
+                      st->src_x, st->src_y, st->w, st->h,
+                      arg, err);
+}
+
+// read_subtile wrapper for Ventana TIFF; whole tiles, no AOI stitching
+static bool read_tile(openslide_t *osr,
+                      cairo_t *cr,
+                      struct _openslide_level *level,
+                      int64_t tile_col, int64_t tile_row,
+                      void *arg,
+                      GError **err) {
+  struct level *l = (struct level *) level;
   return read_subtile(osr, cr, level,
-                      subtile_col, subtile_row,
+                      tile_col, tile_row,
+                      0, 0, l->tiffl.tile_w, l->tiffl.tile_h,
                       arg, err);
 }
 
@@ -727,18 +735,26 @@ DONE:
   return success;
 }
 
+static void subtile_free(gpointer data) {
+  g_slice_free(struct subtile, data);
+}
+
 static struct _openslide_grid *create_bif_grid(openslide_t *osr,
                                                struct bif *bif,
                                                double downsample,
                                                int64_t tile_w, int64_t tile_h) {
+  int64_t subtiles_per_tile = downsample;
   double subtile_w = tile_w / downsample;
   double subtile_h = tile_h / downsample;
+  // size of a subtile in source tile pixels
+  double src_w = (double) tile_w / subtiles_per_tile;
+  double src_h = (double) tile_h / subtiles_per_tile;
 
   struct _openslide_grid *grid =
     _openslide_grid_create_tilemap(osr,
                                    bif->tile_advance_x / downsample,
                                    bif->tile_advance_y / downsample,
-                                   read_subtile_tilemap, NULL);
+                                   read_subtile_tilemap, subtile_free);
 
   for (int32_t i = 0; i < bif->num_areas; i++) {
     struct area *area = bif->areas[i];
@@ -751,11 +767,19 @@ static struct _openslide_grid *create_bif_grid(openslide_t *osr,
          row < area->start_row + area->tiles_down; row++) {
       for (int64_t col = area->start_col;
            col < area->start_col + area->tiles_across; col++) {
+        // resolve the subtile's source geometry once
+        struct subtile *st = g_slice_new0(struct subtile);
+        st->tile_col = col / subtiles_per_tile;
+        st->tile_row = row / subtiles_per_tile;
+        st->src_x = col % subtiles_per_tile * src_w;
+        st->src_y = row % subtiles_per_tile * src_h;
+        st->w = src_w;
+        st->h = src_h;
         _openslide_grid_tilemap_add_tile(grid,
                                          col, row,
                                          offset_x, offset_y,
                                          subtile_w, subtile_h,
-                                         NULL);
+                                         st);
       }
     }
   }
@@ -912,7 +936,6 @@ static bool ventana_open(openslide_t *osr, const char *filename,
         l->grid = create_bif_grid(osr, bif,
                                   downsample,
                                   tiffl->tile_w, tiffl->tile_h);
-        l->subtiles_per_tile = downsample;
         // the format doesn't seem to record the level size, so make it
         // large enough for all the pixels
         double x, y, w, h;
@@ -928,8 +951,7 @@ static bool ventana_open(openslide_t *osr, const char *filename,
                                                 tiffl->tiles_down,
                                                 tiffl->tile_w,
                                                 tiffl->tile_h,
-                                                read_subtile);
-        l->subtiles_per_tile = 1;
+                                                read_tile);
       }
       //g_debug("level %"PRId64": magnification %g, downsample %g, size %"PRId64" %"PRId64, level, magnification, downsample, l->base.w, l->base.h);
 
@@ -1033,9 +1055,15 @@ FAIL:
   return false;
 }
 
+static bool ventana_sniff(const char *filename G_GNUC_UNUSED,
+                          struct _openslide_tifflike *tl) {
+  return tl != NULL;
+}
+
 const struct _openslide_format _openslide_format_ventana = {
   .name = "ventana",
   .vendor = "ventana",
+  .sniff = ventana_sniff,
   .detect = ventana_detect,
   .open = ventana_open,
 };
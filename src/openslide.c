@@ -26,8 +26,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
 #include <libxml/parser.h>
 
@@ -38,6 +40,12 @@ const char _openslide_release_info[] = "OpenSlide " SUFFIXED_VERSION ", copyrigh
 
 static const char * const EMPTY_STRING_ARRAY[] = { NULL };
 
+static const char DECODE_THREADS_ENV_VAR[] = "OPENSLIDE_DECODE_THREADS";
+
+// edge length of a chunk handed to a decode worker, when the level
+// doesn't provide tile size hints
+#define DECODE_CHUNK_DEFAULT 512
+
 static const struct _openslide_format *formats[] = {
   &_openslide_format_mirax,
   &_openslide_format_hamamatsu_vms_vmu,
@@ -93,6 +101,13 @@ static bool level_in_range(openslide_t *osr, int32_t level) {
 
 static openslide_t *create_osr(void) {
   openslide_t *osr = g_slice_new0(openslide_t);
+  osr->handle_refs = 1;
+  osr->async_lock = g_mutex_new();
+  osr->async_finished = g_cond_new();
+  osr->prefetch_lock = g_mutex_new();
+  osr->prefetch_hints = g_hash_table_new(g_direct_hash, g_direct_equal);
+  osr->prefetch_threads = 1;
+  osr->stats_lock = g_mutex_new();
   osr->properties = g_hash_table_new_full(g_str_hash, g_str_equal,
                                           g_free, g_free);
   osr->associated_images = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -101,6 +116,22 @@ static openslide_t *create_osr(void) {
   return osr;
 }
 
+struct detect_task {
+  const struct _openslide_format *format;
+  const char *filename;
+  struct _openslide_tifflike *tl;
+
+  GThread *thread;
+  bool success;
+  GError *err;
+};
+
+static gpointer detect_task_run(gpointer data) {
+  struct detect_task *task = data;
+  task->success = task->format->detect(task->filename, task->tl, &task->err);
+  return NULL;
+}
+
 static const struct _openslide_format *detect_format(const char *filename,
                                                      struct _openslide_tifflike **tl_OUT) {
   GError *tmp_err = NULL;
@@ -114,27 +145,73 @@ static const struct _openslide_format *detect_format(const char *filename,
     g_clear_error(&tmp_err);
   }
 
+  // cheap sniff stage: shortlist candidate formats without doing I/O
+  struct detect_task tasks[G_N_ELEMENTS(formats)];
+  int n_tasks = 0;
   for (const struct _openslide_format **cur = formats; *cur; cur++) {
     const struct _openslide_format *format = *cur;
 
     g_assert(format->name && format->vendor &&
              format->detect && format->open);
 
-    if (format->detect(filename, tl, &tmp_err)) {
-      // success!
-      if (tl_OUT) {
-        *tl_OUT = tl;
-      } else {
-        _openslide_tifflike_destroy(tl);
+    if (format->sniff && !format->sniff(filename, tl)) {
+      if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
+        g_message("%s: rejected by sniff", format->name);
       }
-      return format;
+      continue;
     }
+    struct detect_task *task = &tasks[n_tasks++];
+    memset(task, 0, sizeof(*task));
+    task->format = format;
+    task->filename = filename;
+    task->tl = tl;
+  }
 
-    // reset for next format
-    if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
-      g_message("%s: %s", format->name, tmp_err->message);
+  // Candidate detects on a TIFF are in-memory tag checks, so run them
+  // serially and stop at the first match as before.  Non-TIFF
+  // candidates each parse their own sidecar files, so probe them
+  // concurrently; the match is still the first in formats[] order.
+  if (!tl && n_tasks > 1) {
+    for (int i = 0; i < n_tasks; i++) {
+      tasks[i].thread = g_thread_create(detect_task_run, &tasks[i],
+                                        true, NULL);
+      if (!tasks[i].thread) {
+        // thread creation failed; probe inline
+        detect_task_run(&tasks[i]);
+      }
+    }
+    for (int i = 0; i < n_tasks; i++) {
+      if (tasks[i].thread) {
+        g_thread_join(tasks[i].thread);
+      }
+    }
+  } else {
+    for (int i = 0; i < n_tasks; i++) {
+      detect_task_run(&tasks[i]);
+      if (tasks[i].success) {
+        break;
+      }
     }
-    g_clear_error(&tmp_err);
+  }
+
+  const struct _openslide_format *match = NULL;
+  for (int i = 0; i < n_tasks; i++) {
+    if (!match && tasks[i].success) {
+      match = tasks[i].format;
+    } else if (tasks[i].err &&
+               _openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
+      g_message("%s: %s", tasks[i].format->name, tasks[i].err->message);
+    }
+    g_clear_error(&tasks[i].err);
+  }
+
+  if (match) {
+    if (tl_OUT) {
+      *tl_OUT = tl;
+    } else {
+      _openslide_tifflike_destroy(tl);
+    }
+    return match;
   }
 
   // no match
@@ -234,16 +311,540 @@ static const char **strv_from_hashtable_keys(GHashTable *h) {
   return result;
 }
 
+static bool read_region(openslide_t *osr,
+                        cairo_t *cr,
+                        int64_t x, int64_t y,
+                        int32_t level,
+                        int64_t w, int64_t h,
+                        GError **err);
+
+/* Synthetic pyramid levels.  Some slides ship sparse pyramids (NDPI
+   commonly carries only 1x, 8x and 64x), which forces viewers working
+   near an absent downsample to read and shrink a level many times
+   larger than the viewport.  When enabled, openslide_open_with_options()
+   splices synthesized levels into the gaps at open time; their tiles
+   are materialized on first use by reading the next finer level through
+   the normal paint path and box-filtering the result, then kept in the
+   tile cache and, when configured, the persistent disk cache, so each
+   tile is generated once per slide.  Synthesized levels are
+   indistinguishable from native ones to the public API. */
+
+#define SYNTH_TILE_SIZE 256
+#define SYNTH_FACTOR 4
+// smallest native-to-native downsample ratio considered a gap
+#define SYNTH_MIN_GAP 8.0
+
+struct synthetic_level {
+  struct _openslide_level base;  // must be first
+
+  // index in osr->levels of the next finer level, which may itself be
+  // synthetic for wide gaps
+  int32_t parent;
+
+  // disk cache plane; negative, so it cannot collide with the TIFF
+  // directory numbers backends use
+  int32_t plane;
+};
+
+static void synthetic_level_free(gpointer data) {
+  g_slice_free(struct synthetic_level, data);
+}
+
+static struct synthetic_level *synthetic_level_lookup(openslide_t *osr,
+                                                      struct _openslide_level *l) {
+  if (!osr->synth_levels) {
+    return NULL;
+  }
+  return g_hash_table_lookup(osr->synth_levels, l);
+}
+
+// Fill one tile by reading the parent level through read_region() --
+// so the parent's own tiles land in the cache -- and box-filtering the
+// result.  dest is a zeroed SYNTH_TILE_SIZE square; tiles overhanging
+// the level edge stay transparent past it, like a padded TIFF tile.
+static bool synthesize_tile(openslide_t *osr,
+                            struct synthetic_level *sl,
+                            int64_t tile_col, int64_t tile_row,
+                            uint32_t *dest,
+                            GError **err) {
+  const int64_t tw = SYNTH_TILE_SIZE;
+
+  int64_t w = MIN(tw, sl->base.w - tile_col * tw);
+  int64_t h = MIN(tw, sl->base.h - tile_row * tw);
+  if (w <= 0 || h <= 0) {
+    return true;
+  }
+
+  struct _openslide_level *parent = osr->levels[sl->parent];
+  int64_t pw = w * SYNTH_FACTOR;
+  int64_t ph = h * SYNTH_FACTOR;
+  int64_t x = tile_col * tw * SYNTH_FACTOR * parent->downsample;
+  int64_t y = tile_row * tw * SYNTH_FACTOR * parent->downsample;
+
+  uint32_t *buf = _openslide_tile_alloc0(pw * ph * 4);
+  cairo_surface_t *surface =
+    cairo_image_surface_create_for_data((unsigned char *) buf,
+                                        CAIRO_FORMAT_ARGB32,
+                                        pw, ph, pw * 4);
+  cairo_t *cr = cairo_create(surface);
+  cairo_surface_destroy(surface);
+
+  bool success = read_region(osr, cr, x, y, sl->parent, pw, ph, err);
+  if (success) {
+    success = _openslide_check_cairo_status(cr, err);
+  }
+  cairo_destroy(cr);
+
+  if (success) {
+    _openslide_box_downsample_argb(buf, pw, dest, tw, w, h, SYNTH_FACTOR);
+  }
+  _openslide_tile_free(pw * ph * 4, buf);
+  return success;
+}
+
+static bool synthetic_read_tile(openslide_t *osr,
+                                struct synthetic_level *sl,
+                                int64_t tile_col, int64_t tile_row,
+                                cairo_t *cr,
+                                GError **err) {
+  const int64_t tw = SYNTH_TILE_SIZE;
+  const int64_t tilesize = tw * tw * 4;
+
+  struct _openslide_cache_entry *cache_entry;
+  uint32_t *tiledata = _openslide_cache_get(osr->cache, sl,
+                                            tile_col, tile_row,
+                                            &cache_entry);
+  if (!tiledata) {
+    // previously materialized and persisted?
+    if (osr->diskcache) {
+      int32_t len;
+      void *buf = _openslide_diskcache_get(osr->diskcache, sl->plane,
+                                           tile_col, tile_row, &len);
+      if (buf) {
+        if (len == tilesize) {
+          tiledata = _openslide_tile_alloc(tilesize);
+          memcpy(tiledata, buf, tilesize);
+        }
+        g_free(buf);
+      }
+    }
+
+    if (!tiledata) {
+      tiledata = _openslide_tile_alloc0(tilesize);
+      if (!synthesize_tile(osr, sl, tile_col, tile_row, tiledata, err)) {
+        _openslide_tile_free(tilesize, tiledata);
+        return false;
+      }
+      if (osr->diskcache) {
+        _openslide_diskcache_put(osr->diskcache, sl->plane,
+                                 tile_col, tile_row,
+                                 tiledata, tilesize);
+      }
+    }
+
+    _openslide_cache_put(osr->cache, osr, sl, tile_col, tile_row,
+                         tiledata, tilesize,
+                         &cache_entry);
+  }
+
+  // draw it, reusing the surface cached on the entry
+  cairo_set_source_surface(cr,
+                           _openslide_cache_entry_surface(cache_entry,
+                                                          CAIRO_FORMAT_ARGB32,
+                                                          tw, tw),
+                           0, 0);
+  cairo_paint(cr);
+
+  _openslide_cache_entry_unref(cache_entry);
+  return true;
+}
+
+static bool synthetic_paint_region(openslide_t *osr, cairo_t *cr,
+                                   int64_t x, int64_t y,
+                                   struct synthetic_level *sl,
+                                   int32_t w, int32_t h,
+                                   GError **err) {
+  const int64_t tw = SYNTH_TILE_SIZE;
+  double ds = sl->base.downsample;
+  double dlx = x / ds;
+  double dly = y / ds;
+
+  int64_t start_col = MAX((int64_t) (dlx / tw), 0);
+  int64_t start_row = MAX((int64_t) (dly / tw), 0);
+  int64_t last_col = MIN((int64_t) ((dlx + w) / tw), (sl->base.w - 1) / tw);
+  int64_t last_row = MIN((int64_t) ((dly + h) / tw), (sl->base.h - 1) / tw);
+
+  for (int64_t row = start_row; row <= last_row; row++) {
+    for (int64_t col = start_col; col <= last_col; col++) {
+      cairo_save(cr);
+      cairo_translate(cr, col * tw - dlx, row * tw - dly);
+      bool success = synthetic_read_tile(osr, sl, col, row, cr, err);
+      cairo_restore(cr);
+      if (!success) {
+        return false;
+      }
+    }
+  }
+  return _openslide_check_cairo_status(cr, err);
+}
+
+// route a paint to the backend, or to the downsampling path for
+// synthesized levels, which the backend must never see
+static bool paint_level_region(openslide_t *osr, cairo_t *cr,
+                               int64_t x, int64_t y,
+                               struct _openslide_level *level,
+                               int32_t w, int32_t h,
+                               GError **err) {
+  struct synthetic_level *sl = synthetic_level_lookup(osr, level);
+  if (sl) {
+    return synthetic_paint_region(osr, cr, x, y, sl, w, h, err);
+  }
+  return osr->ops->paint_region(osr, cr, x, y, level, w, h, err);
+}
+
+// Splice synthesized levels into every sparse gap between adjacent
+// native levels.  Called after downsamples are computed and validated,
+// before properties are generated, so the new levels are first-class
+// in the metadata and in openslide_get_best_level_for_downsample().
+static void synthesize_sparse_levels(openslide_t *osr) {
+  bool have_geometry = osr->level_count && osr->levels[0]->tile_w > 0;
+
+  GPtrArray *combined = g_ptr_array_new();
+  int32_t next_plane = -1;
+  for (int32_t i = 0; i < osr->level_count; i++) {
+    struct _openslide_level *fine = osr->levels[i];
+    g_ptr_array_add(combined, fine);
+    if (i + 1 == osr->level_count) {
+      break;
+    }
+
+    struct _openslide_level *coarse = osr->levels[i + 1];
+    while (coarse->downsample / fine->downsample >= SYNTH_MIN_GAP &&
+           fine->w / SYNTH_FACTOR > 0 && fine->h / SYNTH_FACTOR > 0) {
+      struct synthetic_level *sl = g_slice_new0(struct synthetic_level);
+      sl->base.downsample = fine->downsample * SYNTH_FACTOR;
+      sl->base.w = fine->w / SYNTH_FACTOR;
+      sl->base.h = fine->h / SYNTH_FACTOR;
+      if (have_geometry) {
+        // cached tiles are full padded squares, so the aligned-read
+        // fast path applies
+        sl->base.tile_w = SYNTH_TILE_SIZE;
+        sl->base.tile_h = SYNTH_TILE_SIZE;
+        sl->base.aligned_tiles = true;
+      }
+      sl->parent = combined->len - 1;
+      sl->plane = next_plane--;
+
+      if (!osr->synth_levels) {
+        osr->synth_levels = g_hash_table_new_full(g_direct_hash,
+                                                  g_direct_equal,
+                                                  NULL,
+                                                  synthetic_level_free);
+      }
+      g_hash_table_insert(osr->synth_levels, sl, sl);
+      g_ptr_array_add(combined, sl);
+      fine = &sl->base;
+    }
+  }
+
+  if (!osr->synth_levels) {
+    g_ptr_array_free(combined, true);
+    return;
+  }
+
+  // publish the combined array; the backend's own array is kept aside
+  // and restored before ops->destroy
+  osr->backend_levels = osr->levels;
+  osr->backend_level_count = osr->level_count;
+  osr->level_count = combined->len;
+  osr->levels = (struct _openslide_level **) g_ptr_array_free(combined, false);
+}
+
+struct decode_batch {
+  openslide_t *osr;
+  struct _openslide_level *level;
+  bool bypass;  // requesting thread's cache-bypass hint
+
+  GMutex *lock;
+  GCond *finished;
+  int remaining;
+};
+
+struct decode_job {
+  struct decode_batch *batch;
+
+  int64_t x;  // level 0 plane
+  int64_t y;  // level 0 plane
+  int32_t w;  // level plane
+  int32_t h;  // level plane
+};
+
+static void decode_worker(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct decode_job *job = data;
+  struct decode_batch *batch = job->batch;
+  openslide_t *osr = batch->osr;
+  GError *tmp_err = NULL;
+
+  // Decode through the backend into the tile cache.  Paint to a nil
+  // surface; the compositing is discarded but the decoded tiles stay
+  // cached for the serial paint that follows.
+  cairo_surface_t *surface =
+    cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 0, 0);
+  cairo_t *cr = cairo_create(surface);
+  cairo_surface_destroy(surface);
+  // carry a bypassing caller's hint onto this pool thread, so its
+  // decodes are not inserted either
+  if (batch->bypass) {
+    openslide_set_cache_bypass(1);
+  }
+  if (!paint_level_region(osr, cr, job->x, job->y, batch->level,
+                          job->w, job->h, &tmp_err)) {
+    // the serial pass will re-encounter and report the error
+    g_clear_error(&tmp_err);
+  }
+  if (batch->bypass) {
+    openslide_set_cache_bypass(0);
+  }
+  cairo_destroy(cr);
+
+  g_mutex_lock(batch->lock);
+  if (!--batch->remaining) {
+    g_cond_signal(batch->finished);
+  }
+  g_mutex_unlock(batch->lock);
+  g_slice_free(struct decode_job, job);
+}
+
+// Warm the tile cache for a region by decoding its tiles concurrently.
+// The backend paint path acquires per-thread file handles and decode
+// state, so the grid read_tile callbacks can run in parallel; the
+// caller's serial paint then composites from the cache in order.
+static void prewarm_region(openslide_t *osr,
+                           int64_t x, int64_t y,
+                           int32_t level,
+                           int64_t w, int64_t h) {
+  if (!osr->decode_pool || !level_in_range(osr, level)) {
+    return;
+  }
+  struct _openslide_level *l = osr->levels[level];
+  double ds = l->downsample;
+
+  // mirror the negative-coordinate handling in read_region()
+  if (x < 0) {
+    w -= (-x) / ds;
+    x = 0;
+  }
+  if (y < 0) {
+    h -= (-y) / ds;
+    y = 0;
+  }
+  if (w <= 0 || h <= 0) {
+    return;
+  }
+
+  // chunk size: one tile if the backend told us its geometry
+  int64_t cw = l->tile_w > 0 ? l->tile_w : DECODE_CHUNK_DEFAULT;
+  int64_t ch = l->tile_h > 0 ? l->tile_h : DECODE_CHUNK_DEFAULT;
+  int64_t cols = (w + cw - 1) / cw;
+  int64_t rows = (h + ch - 1) / ch;
+  if (cols * rows < 2) {
+    // nothing to overlap
+    return;
+  }
+
+  // With aligned tile geometry and a tile-aligned region, probe the
+  // cache so only the chunks that actually miss are dispatched; a
+  // fully warm region then skips the thread-pool round trip entirely.
+  bool probe = false;
+  int64_t tile_col0 = 0;
+  int64_t tile_row0 = 0;
+  if (l->aligned_tiles && cw == l->tile_w && ch == l->tile_h) {
+    double dlx = x / ds;
+    double dly = y / ds;
+    int64_t lx = (int64_t) dlx;
+    int64_t ly = (int64_t) dly;
+    if (dlx == (double) lx && dly == (double) ly &&
+        !(lx % cw) && !(ly % ch)) {
+      probe = true;
+      tile_col0 = lx / cw;
+      tile_row0 = ly / ch;
+    }
+  }
+
+  GArray *misses = g_array_new(FALSE, FALSE, sizeof(struct decode_job));
+  for (int64_t row = 0; row < rows; row++) {
+    for (int64_t col = 0; col < cols; col++) {
+      if (probe && _openslide_cache_contains(osr->cache, l,
+                                             tile_col0 + col,
+                                             tile_row0 + row)) {
+        continue;
+      }
+      struct decode_job job = {
+        .x = x + col * cw * ds,
+        .y = y + row * ch * ds,
+        .w = MIN(w - col * cw, cw),
+        .h = MIN(h - row * ch, ch),
+      };
+      g_array_append_val(misses, job);
+    }
+  }
+  if (misses->len < 2) {
+    // nothing to overlap
+    g_array_free(misses, TRUE);
+    return;
+  }
+
+  struct decode_batch batch = {
+    .osr = osr,
+    .level = l,
+    .bypass = _openslide_cache_get_bypass(),
+    .lock = g_mutex_new(),
+    .finished = g_cond_new(),
+    .remaining = misses->len,
+  };
+
+  for (guint i = 0; i < misses->len; i++) {
+    struct decode_job *job = g_slice_new0(struct decode_job);
+    *job = g_array_index(misses, struct decode_job, i);
+    job->batch = &batch;
+    // on thread-creation failure the job is still queued
+    g_thread_pool_push(osr->decode_pool, job, NULL);
+  }
+  g_array_free(misses, TRUE);
+
+  g_mutex_lock(batch.lock);
+  while (batch.remaining) {
+    g_cond_wait(batch.finished, batch.lock);
+  }
+  g_mutex_unlock(batch.lock);
+  g_cond_free(batch.finished);
+  g_mutex_free(batch.lock);
+}
+
+// Optional registry deduplicating repeated opens of the same file into
+// one refcounted handle, so N request contexts share one cache, one
+// TIFF handle pool, and one parsed tilemap.  Entries are validated
+// against the file's size and mtime at open, so a replaced file gets a
+// fresh handle while the stale one lives on until its last closer.
+static const char SHARED_HANDLES_ENV_VAR[] = "OPENSLIDE_SHARED_HANDLES";
+
+static const char SYNTHETIC_LEVELS_ENV_VAR[] = "OPENSLIDE_SYNTHETIC_LEVELS";
+
+static GStaticMutex registry_lock = G_STATIC_MUTEX_INIT;
+static GHashTable *handle_registry;  // key -> openslide_t
+
+// best-effort canonicalization: absolutize relative paths.  symlinked
+// duplicates of the same file get separate handles
+static char *registry_key_for_path(const char *filename) {
+  if (g_path_is_absolute(filename)) {
+    return g_strdup(filename);
+  }
+  char *dir = g_get_current_dir();
+  char *key = g_build_filename(dir, filename, NULL);
+  g_free(dir);
+  return key;
+}
+
+static bool registry_stat(const char *filename,
+                          int64_t *size, int64_t *mtime) {
+  GStatBuf st;
+  if (g_stat(filename, &st)) {
+    return false;
+  }
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+  return true;
+}
+
+// per-open tuning knobs, filled in from an option list
+struct open_options {
+  int64_t decode_threads;  // -1 for the default
+  int64_t cache_size;      // -1 for the default
+  int64_t prefetch_threads;  // -1 for the default
+  int64_t shared;          // -1 for the default
+  int64_t synthetic;       // -1 for the default
+};
+
+static void parse_open_options(const char *const *options,
+                               struct open_options *opts) {
+  opts->decode_threads = -1;
+  opts->cache_size = -1;
+  opts->prefetch_threads = -1;
+  opts->shared = -1;
+  opts->synthetic = -1;
+
+  for (const char *const *cur = options; cur && *cur; cur++) {
+    char **kv = g_strsplit(*cur, "=", 2);
+    if (kv[0] && kv[1]) {
+      int64_t value = g_ascii_strtoll(kv[1], NULL, 10);
+      if (!strcmp(kv[0], "decode-threads")) {
+        opts->decode_threads = MAX(value, 0);
+      } else if (!strcmp(kv[0], "cache-size")) {
+        opts->cache_size = MAX(value, 0);
+      } else if (!strcmp(kv[0], "prefetch-threads")) {
+        opts->prefetch_threads = MAX(value, 0);
+      } else if (!strcmp(kv[0], "shared-handle")) {
+        opts->shared = !!value;
+      } else if (!strcmp(kv[0], "synthetic-levels")) {
+        opts->synthetic = !!value;
+      } else {
+        g_warning("Unrecognized open option \"%s\"", kv[0]);
+      }
+    } else {
+      g_warning("Malformed open option \"%s\"", *cur);
+    }
+    g_strfreev(kv);
+  }
+}
+
 openslide_t *openslide_open(const char *filename) {
+  return openslide_open_with_options(filename, NULL);
+}
+
+openslide_t *openslide_open_with_options(const char *filename,
+                                         const char *const *options) {
   GError *tmp_err = NULL;
 
   g_assert(openslide_was_dynamically_loaded);
 
+  struct open_options opts;
+  parse_open_options(options, &opts);
+
+  // handle sharing: the option wins, the environment is the default
+  bool share = (opts.shared != -1) ? opts.shared :
+               (g_getenv(SHARED_HANDLES_ENV_VAR) != NULL);
+  char *key = NULL;
+  int64_t reg_size = 0;
+  int64_t reg_mtime = 0;
+  if (share && registry_stat(filename, &reg_size, &reg_mtime)) {
+    key = registry_key_for_path(filename);
+    g_static_mutex_lock(&registry_lock);
+    if (handle_registry) {
+      openslide_t *existing = g_hash_table_lookup(handle_registry, key);
+      if (existing) {
+        if (existing->registry_size == reg_size &&
+            existing->registry_mtime == reg_mtime) {
+          existing->handle_refs++;
+          g_static_mutex_unlock(&registry_lock);
+          g_free(key);
+          return existing;
+        }
+        // the file was replaced; detach the stale handle so its last
+        // closer destroys it normally
+        g_hash_table_remove(handle_registry, existing->registry_key);
+        g_free(existing->registry_key);
+        existing->registry_key = NULL;
+      }
+    }
+    g_static_mutex_unlock(&registry_lock);
+  }
+
   // detect format
   struct _openslide_tifflike *tl;
   const struct _openslide_format *format = detect_format(filename, &tl);
   if (!format) {
     // not a slide file
+    g_free(key);
     return NULL;
   }
 
@@ -258,6 +859,7 @@ openslide_t *openslide_open(const char *filename) {
   if (!success) {
     // failed to read slide
     _openslide_propagate_error(osr, tmp_err);
+    g_free(key);
     return osr;
   }
   g_assert(osr->levels);
@@ -287,18 +889,31 @@ openslide_t *openslide_open(const char *filename) {
 		osr->levels[i]->downsample, osr->levels[i - 1]->downsample);
       openslide_close(osr);
       _openslide_hash_destroy(quickhash1);
+      g_free(key);
       return NULL;
     }
   }
 
-  // set hash property
-  const char *hash_str = _openslide_hash_get_string(quickhash1);
-  if (hash_str != NULL) {
+  // synthesize intermediate levels for sparse pyramids
+  bool synth = (opts.synthetic != -1) ? opts.synthetic :
+               (g_getenv(SYNTHETIC_LEVELS_ENV_VAR) != NULL);
+  if (synth) {
+    synthesize_sparse_levels(osr);
+  }
+
+  // set hash property.  the hash itself is computed lazily on first
+  // access; insert a placeholder so the name is listed
+  if (_openslide_hash_is_enabled(quickhash1)) {
     g_hash_table_insert(osr->properties,
                         g_strdup(OPENSLIDE_PROPERTY_NAME_QUICKHASH1),
-                        g_strdup(hash_str));
+                        g_strdup(""));
+    osr->quickhash1 = quickhash1;
+  } else {
+    _openslide_hash_destroy(quickhash1);
   }
-  _openslide_hash_destroy(quickhash1);
+
+  // start persistent tile cache, if configured; this resolves the hash
+  osr->diskcache = _openslide_diskcache_open(osr->quickhash1);
 
   // set other properties
   g_hash_table_insert(osr->properties,
@@ -343,15 +958,104 @@ openslide_t *openslide_open(const char *filename) {
   osr->associated_image_names = strv_from_hashtable_keys(osr->associated_images);
   osr->property_names = strv_from_hashtable_keys(osr->properties);
 
-  // start cache
-  osr->cache = _openslide_cache_create(_OPENSLIDE_USEFUL_CACHE_SIZE);
-  //osr->cache = _openslide_cache_create(0);
+  // start cache: an explicit per-slide budget always gets a private
+  // cache; otherwise attach to the process-wide shared cache if one has
+  // been configured, else use a private one with the default budget
+  if (opts.cache_size != -1) {
+    osr->cache = _openslide_cache_create(opts.cache_size);
+  } else {
+    osr->cache = _openslide_cache_shared_ref();
+    if (!osr->cache) {
+      osr->cache = _openslide_cache_create(_OPENSLIDE_USEFUL_CACHE_SIZE);
+      //osr->cache = _openslide_cache_create(0);
+    }
+  }
+
+  // start decode pool
+  int decode_threads = _openslide_num_processors();
+  const char *decode_threads_str = g_getenv(DECODE_THREADS_ENV_VAR);
+  if (decode_threads_str) {
+    decode_threads = (int) g_ascii_strtoll(decode_threads_str, NULL, 10);
+  }
+  if (opts.decode_threads != -1) {
+    decode_threads = opts.decode_threads;
+  }
+  if (decode_threads > 1) {
+    osr->decode_pool = g_thread_pool_new(decode_worker, NULL,
+                                         decode_threads, false, NULL);
+  }
+
+  // prefetch aggressiveness
+  if (opts.prefetch_threads != -1) {
+    osr->prefetch_threads = opts.prefetch_threads;
+  }
+
+  // publish the handle for sharing
+  if (key) {
+    g_static_mutex_lock(&registry_lock);
+    if (!handle_registry) {
+      handle_registry = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    if (!g_hash_table_lookup(handle_registry, key)) {
+      osr->registry_key = key;
+      osr->registry_size = reg_size;
+      osr->registry_mtime = reg_mtime;
+      g_hash_table_insert(handle_registry, osr->registry_key, osr);
+      key = NULL;  // now owned by osr
+    }
+    // if a concurrent open won the race, this handle stays private
+    g_static_mutex_unlock(&registry_lock);
+    g_free(key);
+  }
+
+  _openslide_trace_open(osr, filename);
 
   return osr;
 }
 
 
 void openslide_close(openslide_t *osr) {
+  // shared handles are destroyed by their last closer
+  g_static_mutex_lock(&registry_lock);
+  bool last = (--osr->handle_refs == 0);
+  if (last && osr->registry_key) {
+    g_hash_table_remove(handle_registry, osr->registry_key);
+    g_free(osr->registry_key);
+  }
+  g_static_mutex_unlock(&registry_lock);
+  if (!last) {
+    return;
+  }
+
+  if (osr->prefetch_pool) {
+    // wait for in-progress prefetches; queued ones still run, but
+    // against a warm cache this is cheap
+    g_thread_pool_free(osr->prefetch_pool, false, true);
+  }
+  g_hash_table_unref(osr->prefetch_hints);
+  g_mutex_free(osr->prefetch_lock);
+
+  if (osr->async_pool) {
+    // drain any asynchronous reads the caller failed to wait for
+    g_thread_pool_free(osr->async_pool, false, true);
+  }
+  g_cond_free(osr->async_finished);
+  g_mutex_free(osr->async_lock);
+  g_mutex_free(osr->stats_lock);
+
+  if (osr->decode_pool) {
+    // wait for stray prefetch work before tearing down the backend
+    g_thread_pool_free(osr->decode_pool, false, true);
+  }
+
+  if (osr->synth_levels) {
+    // hand the backend back its own level array before it walks it
+    g_free(osr->levels);
+    osr->levels = osr->backend_levels;
+    osr->level_count = osr->backend_level_count;
+    g_hash_table_unref(osr->synth_levels);
+  }
+
   if (osr->ops) {
     (osr->ops->destroy)(osr);
   }
@@ -363,12 +1067,27 @@ void openslide_close(openslide_t *osr) {
   g_free(osr->property_names);
 
   if (osr->cache) {
+    // planes are per-slide heap pointers the allocator can recycle, so
+    // drop this slide's entries before they can alias a later slide's
+    // planes in a shared cache
+    _openslide_cache_purge_owner(osr->cache, osr);
     _openslide_cache_destroy(osr->cache);
   }
 
+  if (osr->diskcache) {
+    _openslide_diskcache_close(osr->diskcache);
+  }
+
+  if (osr->quickhash1) {
+    _openslide_hash_destroy(osr->quickhash1);
+  }
+
   g_free(g_atomic_pointer_get(&osr->error));
 
   g_slice_free(openslide_t, osr);
+
+  // make the trace durable at natural quiesce points
+  _openslide_trace_flush();
 }
 
 
@@ -464,19 +1183,81 @@ double openslide_get_layer_downsample(openslide_t *osr, int32_t level) {
 }
 
 
-int openslide_give_prefetch_hint(openslide_t *osr G_GNUC_UNUSED,
-				 int64_t x G_GNUC_UNUSED,
-				 int64_t y G_GNUC_UNUSED,
-				 int32_t level G_GNUC_UNUSED,
-				 int64_t w G_GNUC_UNUSED,
-				 int64_t h G_GNUC_UNUSED) {
-  g_warning("openslide_give_prefetch_hint has never been implemented and should not be called");
-  return 0;
+struct prefetch_hint {
+  openslide_t *osr;
+  int id;
+
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+
+  gint cancelled;  // atomic ops only
+};
+
+static void prefetch_worker(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct prefetch_hint *hint = data;
+  openslide_t *osr = hint->osr;
+
+  if (!g_atomic_int_get(&hint->cancelled)) {
+    // a NULL dest decodes the covered tiles into the cache without
+    // producing output
+    openslide_read_region(osr, NULL, hint->x, hint->y, hint->level,
+                          hint->w, hint->h);
+  }
+
+  g_mutex_lock(osr->prefetch_lock);
+  g_hash_table_remove(osr->prefetch_hints, GINT_TO_POINTER(hint->id));
+  g_mutex_unlock(osr->prefetch_lock);
+  g_slice_free(struct prefetch_hint, hint);
 }
 
-void openslide_cancel_prefetch_hint(openslide_t *osr G_GNUC_UNUSED,
-				    int prefetch_id G_GNUC_UNUSED) {
-  g_warning("openslide_cancel_prefetch_hint has never been implemented and should not be called");
+int openslide_give_prefetch_hint(openslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h) {
+  struct prefetch_hint *hint = g_slice_new0(struct prefetch_hint);
+  hint->osr = osr;
+  hint->x = x;
+  hint->y = y;
+  hint->level = level;
+  hint->w = w;
+  hint->h = h;
+
+  g_mutex_lock(osr->prefetch_lock);
+  if (!osr->prefetch_threads) {
+    // prefetching is disabled; hand back a valid id that is already
+    // complete
+    int id = osr->next_prefetch_id++;
+    g_mutex_unlock(osr->prefetch_lock);
+    g_slice_free(struct prefetch_hint, hint);
+    return id;
+  }
+  if (!osr->prefetch_pool) {
+    // by default a single queue-draining thread, so a burst of hints
+    // cannot starve foreground reads; openslide_open_with_options()
+    // can raise the parallelism
+    osr->prefetch_pool = g_thread_pool_new(prefetch_worker, NULL,
+                                           osr->prefetch_threads,
+                                           false, NULL);
+  }
+  hint->id = osr->next_prefetch_id++;
+  g_hash_table_insert(osr->prefetch_hints, GINT_TO_POINTER(hint->id), hint);
+  g_mutex_unlock(osr->prefetch_lock);
+
+  g_thread_pool_push(osr->prefetch_pool, hint, NULL);
+  return hint->id;
+}
+
+void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id) {
+  g_mutex_lock(osr->prefetch_lock);
+  struct prefetch_hint *hint =
+    g_hash_table_lookup(osr->prefetch_hints, GINT_TO_POINTER(prefetch_id));
+  if (hint) {
+    g_atomic_int_set(&hint->cancelled, 1);
+  }
+  g_mutex_unlock(osr->prefetch_lock);
 }
 
 static bool read_region(openslide_t *osr,
@@ -523,7 +1304,7 @@ static bool read_region(openslide_t *osr,
 
     // paint
     if (w > 0 && h > 0) {
-      success = osr->ops->paint_region(osr, cr, x, y, l, w, h, err);
+      success = paint_level_region(osr, cr, x, y, l, w, h, err);
     }
   }
 
@@ -541,6 +1322,85 @@ static bool read_region(openslide_t *osr,
   return success;
 }
 
+// Copy decoded tiles straight from the tile cache into dest, skipping
+// cairo group setup and saturate compositing.  Only valid for reads
+// exactly aligned to the tile grid of a level whose backend set
+// aligned_tiles; returns false if the request doesn't qualify or any
+// tile is missing from the cache, in which case the caller paints
+// through cairo as usual.
+static bool read_region_from_tile_cache(openslide_t *osr,
+                                        uint32_t *dest,
+                                        int64_t x, int64_t y,
+                                        int32_t level,
+                                        int64_t w, int64_t h) {
+  if (!level_in_range(osr, level)) {
+    return false;
+  }
+  struct _openslide_level *l = osr->levels[level];
+  int64_t tw = l->tile_w;
+  int64_t th = l->tile_h;
+  if (!l->aligned_tiles || tw <= 0 || th <= 0 ||
+      x < 0 || y < 0 || w <= 0 || h <= 0) {
+    return false;
+  }
+
+  // level-plane coordinates must be integral and tile-aligned
+  double ds = l->downsample;
+  double dlx = x / ds;
+  double dly = y / ds;
+  int64_t lx = (int64_t) dlx;
+  int64_t ly = (int64_t) dly;
+  if (dlx != (double) lx || dly != (double) ly ||
+      lx % tw || ly % th || w % tw || h % th) {
+    return false;
+  }
+
+  int64_t start_col = lx / tw;
+  int64_t start_row = ly / th;
+  int64_t cols = w / tw;
+  int64_t rows = h / th;
+
+  // collect every tile before copying, so a miss doesn't leave a
+  // partial result in dest
+  struct _openslide_cache_entry **entries =
+    g_new(struct _openslide_cache_entry *, cols * rows);
+  uint32_t **tiles = g_new(uint32_t *, cols * rows);
+  int64_t found = 0;
+  bool success = true;
+  for (int64_t row = 0; success && row < rows; row++) {
+    for (int64_t col = 0; col < cols; col++) {
+      tiles[found] = _openslide_cache_get(osr->cache, l,
+                                          start_col + col, start_row + row,
+                                          &entries[found]);
+      if (!tiles[found]) {
+        success = false;
+        break;
+      }
+      found++;
+    }
+  }
+
+  if (success) {
+    for (int64_t row = 0; row < rows; row++) {
+      for (int64_t col = 0; col < cols; col++) {
+        const uint32_t *tile = tiles[row * cols + col];
+        uint32_t *out = dest + row * th * w + col * tw;
+        for (int64_t ty = 0; ty < th; ty++) {
+          memcpy(out + ty * w, tile + ty * tw, tw * 4);
+        }
+      }
+    }
+  }
+
+  for (int64_t i = 0; i < found; i++) {
+    _openslide_cache_entry_unref(entries[i]);
+  }
+  g_free(tiles);
+  g_free(entries);
+
+  return success;
+}
+
 static bool ensure_nonnegative_dimensions(openslide_t *osr, int64_t w, int64_t h) {
   if (w < 0 || h < 0) {
     GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -574,6 +1434,22 @@ void openslide_read_region(openslide_t *osr,
     return;
   }
 
+  _openslide_trace_read_region(osr, x, y, level, w, h);
+
+  // tile-aligned reads can skip cairo -- and the decode-pool round
+  // trip below -- when every tile is already cached
+  if (dest && read_region_from_tile_cache(osr, dest, x, y, level, w, h)) {
+    return;
+  }
+
+  // decode tiles concurrently before compositing serially
+  prewarm_region(osr, x, y, level, w, h);
+
+  // retry the aligned fast path against the freshly warmed cache
+  if (dest && read_region_from_tile_cache(osr, dest, x, y, level, w, h)) {
+    return;
+  }
+
   // Break the work into smaller pieces if the region is large, because:
   // 1. Cairo will not allow surfaces larger than 32767 pixels on a side.
   // 2. cairo_push_group() creates an intermediate surface backed by a
@@ -632,6 +1508,97 @@ OUT:
   }
 }
 
+void openslide_read_region_scaled(openslide_t *osr,
+                                  uint32_t *dest,
+                                  int64_t x, int64_t y,
+                                  int32_t level,
+                                  int64_t w, int64_t h,
+                                  int32_t factor) {
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+  if (factor <= 1) {
+    openslide_read_region(osr, dest, x, y, level, w, h);
+    return;
+  }
+
+  if (dest) {
+    memset(dest, 0, w * h * 4);
+  }
+  if (openslide_get_error(osr) || !level_in_range(osr, level) ||
+      w == 0 || h == 0) {
+    return;
+  }
+  double ds = osr->levels[level]->downsample;
+
+  // read full-resolution strips and box-filter each one into dest, so
+  // the full-resolution intermediate is never materialized at once
+  int64_t strip_h = MAX(1, (16 << 20) / (w * factor * factor * 4));
+  uint32_t *strip = g_malloc(w * factor * strip_h * factor * 4);
+
+  for (int64_t dy = 0; dy < h; dy += strip_h) {
+    int64_t rows = MIN(h - dy, strip_h);
+    int64_t sy = y + (int64_t) (dy * factor * ds);  // level 0 plane
+    openslide_read_region(osr, strip, x, sy, level,
+                          w * factor, rows * factor);
+    if (openslide_get_error(osr)) {
+      break;
+    }
+    if (dest) {
+      _openslide_box_downsample_argb(strip, w * factor,
+                                     dest + dy * w, w,
+                                     w, rows, factor);
+    }
+  }
+
+  g_free(strip);
+  if (dest && openslide_get_error(osr)) {
+    // ensure we don't return a partial result
+    memset(dest, 0, w * h * 4);
+  }
+}
+
+void openslide_read_region_rgb(openslide_t *osr,
+                               uint8_t *dest,
+                               int64_t x, int64_t y,
+                               int32_t level,
+                               int64_t w, int64_t h) {
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+  if (dest) {
+    memset(dest, 0, w * h * 3);
+  }
+  if (openslide_get_error(osr) || !level_in_range(osr, level) ||
+      w == 0 || h == 0) {
+    return;
+  }
+  double ds = osr->levels[level]->downsample;
+
+  // read ARGB strips and pack each one, so the 4-byte intermediate is
+  // never materialized at once
+  int64_t strip_h = MAX((int64_t) 1, (16 << 20) / (w * 4));
+  uint32_t *strip = g_malloc(w * strip_h * 4);
+
+  for (int64_t dy = 0; dy < h; dy += strip_h) {
+    int64_t rows = MIN(h - dy, strip_h);
+    int64_t sy = y + (int64_t) (dy * ds);  // level 0 plane
+    openslide_read_region(osr, strip, x, sy, level, w, rows);
+    if (openslide_get_error(osr)) {
+      break;
+    }
+    if (dest) {
+      _openslide_argb_to_rgb24(strip, dest + dy * w * 3, w * rows);
+    }
+  }
+
+  g_free(strip);
+  if (dest && openslide_get_error(osr)) {
+    // ensure we don't return a partial result
+    memset(dest, 0, w * h * 3);
+  }
+}
+
 
 void openslide_cairo_read_region(openslide_t *osr,
 				 cairo_t *cr,
@@ -648,6 +1615,9 @@ void openslide_cairo_read_region(openslide_t *osr,
     return;
   }
 
+  // decode tiles concurrently before compositing serially
+  prewarm_region(osr, x, y, level, w, h);
+
   if (read_region(osr, cr, x, y, level, w, h, &tmp_err)) {
     _openslide_check_cairo_status(cr, &tmp_err);
   }
@@ -658,6 +1628,384 @@ void openslide_cairo_read_region(openslide_t *osr,
 }
 
 
+struct async_read {
+  uint32_t *dest;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+  openslide_read_region_callback callback;
+  void *user_data;
+};
+
+static void async_read_worker(gpointer data, gpointer user_data) {
+  struct async_read *ar = data;
+  openslide_t *osr = user_data;
+
+  openslide_read_region(osr, ar->dest, ar->x, ar->y, ar->level,
+                        ar->w, ar->h);
+  if (ar->callback) {
+    ar->callback(osr, ar->dest, ar->user_data);
+  }
+
+  g_mutex_lock(osr->async_lock);
+  if (!--osr->async_pending) {
+    g_cond_broadcast(osr->async_finished);
+  }
+  g_mutex_unlock(osr->async_lock);
+  g_slice_free(struct async_read, ar);
+}
+
+void openslide_read_region_async(openslide_t *osr,
+                                 uint32_t *dest,
+                                 int64_t x, int64_t y,
+                                 int32_t level,
+                                 int64_t w, int64_t h,
+                                 openslide_read_region_callback callback,
+                                 void *user_data) {
+  g_mutex_lock(osr->async_lock);
+  if (!osr->async_pool) {
+    // non-exclusive pools cannot fail to be created
+    osr->async_pool = g_thread_pool_new(async_read_worker, osr,
+                                        _openslide_num_processors(),
+                                        false, NULL);
+  }
+  osr->async_pending++;
+  g_mutex_unlock(osr->async_lock);
+
+  struct async_read *ar = g_slice_new0(struct async_read);
+  ar->dest = dest;
+  ar->x = x;
+  ar->y = y;
+  ar->level = level;
+  ar->w = w;
+  ar->h = h;
+  ar->callback = callback;
+  ar->user_data = user_data;
+  // on thread-creation failure the job is still queued
+  g_thread_pool_push(osr->async_pool, ar, NULL);
+}
+
+void openslide_read_region_async_wait(openslide_t *osr) {
+  g_mutex_lock(osr->async_lock);
+  while (osr->async_pending) {
+    g_cond_wait(osr->async_finished, osr->async_lock);
+  }
+  g_mutex_unlock(osr->async_lock);
+}
+
+static gint region_schedule_compare(gconstpointer a, gconstpointer b,
+                                    gpointer user_data G_GNUC_UNUSED) {
+  const openslide_region_t *ra = *(const openslide_region_t * const *) a;
+  const openslide_region_t *rb = *(const openslide_region_t * const *) b;
+
+  if (ra->level != rb->level) {
+    return ra->level < rb->level ? -1 : 1;
+  }
+  if (ra->y != rb->y) {
+    return ra->y < rb->y ? -1 : 1;
+  }
+  if (ra->x != rb->x) {
+    return ra->x < rb->x ? -1 : 1;
+  }
+  return 0;
+}
+
+void openslide_read_regions(openslide_t *osr,
+                            const openslide_region_t *regions,
+                            int32_t count) {
+  if (count <= 0) {
+    return;
+  }
+
+  // validate everything before touching any dest buffer
+  for (int32_t i = 0; i < count; i++) {
+    if (!ensure_nonnegative_dimensions(osr, regions[i].w, regions[i].h)) {
+      return;
+    }
+  }
+
+  if (count == 1) {
+    const openslide_region_t *r = regions;
+    openslide_read_region(osr, r->dest, r->x, r->y, r->level, r->w, r->h);
+    return;
+  }
+
+  // dispatch in (level, row, column) order so neighboring regions run
+  // close together in time; tiles they share are then decoded once and
+  // the rest of the batch hits them in the tile cache
+  const openslide_region_t **schedule =
+    g_new(const openslide_region_t *, count);
+  for (int32_t i = 0; i < count; i++) {
+    schedule[i] = &regions[i];
+  }
+  g_qsort_with_data(schedule, count, sizeof(*schedule),
+                    region_schedule_compare, NULL);
+
+  for (int32_t i = 0; i < count; i++) {
+    const openslide_region_t *r = schedule[i];
+    openslide_read_region_async(osr, r->dest, r->x, r->y, r->level,
+                                r->w, r->h, NULL, NULL);
+  }
+  g_free(schedule);
+
+  openslide_read_region_async_wait(osr);
+}
+
+
+void openslide_read_region_rows(openslide_t *osr,
+                                int64_t x, int64_t y,
+                                int32_t level,
+                                int64_t w, int64_t h,
+                                int64_t band_height,
+                                openslide_band_callback callback,
+                                void *user_data) {
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+  if (band_height <= 0) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "non-positive band height (%"PRId64") "
+                                  "not allowed", band_height);
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  if (openslide_get_error(osr) || !w || !h) {
+    return;
+  }
+
+  double ds = openslide_get_level_downsample(osr, level);
+  int64_t bands = (h + band_height - 1) / band_height;
+
+  // double buffer: decode band n+1 while the callback consumes band n
+  uint32_t *bufs[2];
+  bufs[0] = g_malloc(w * band_height * 4);
+  bufs[1] = bands > 1 ? g_malloc(w * band_height * 4) : NULL;
+
+  // start the first band
+  openslide_read_region_async(osr, bufs[0],
+                              x, y, level,
+                              w, MIN(h, band_height),
+                              NULL, NULL);
+
+  for (int64_t n = 0; n < bands; n++) {
+    openslide_read_region_async_wait(osr);
+    if (openslide_get_error(osr)) {
+      break;
+    }
+
+    // queue the next band before consuming this one
+    int64_t next_row = (n + 1) * band_height;
+    if (next_row < h) {
+      openslide_read_region_async(osr, bufs[(n + 1) % 2],
+                                  x, y + next_row * ds, level,
+                                  w, MIN(h - next_row, band_height),
+                                  NULL, NULL);
+    }
+
+    if (!callback(osr, bufs[n % 2], n * band_height,
+                  w, MIN(h - n * band_height, band_height),
+                  user_data)) {
+      break;
+    }
+  }
+
+  // drain any still-queued band before freeing its buffer
+  openslide_read_region_async_wait(osr);
+  g_free(bufs[0]);
+  g_free(bufs[1]);
+}
+
+struct _openslide_viewport {
+  openslide_t *osr;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+  uint32_t *buf;
+
+  // level 0 origin of the current contents
+  int64_t x;
+  int64_t y;
+  bool valid;
+};
+
+openslide_viewport_t *openslide_viewport_create(openslide_t *osr,
+                                                int32_t level,
+                                                int64_t w, int64_t h) {
+  if (w <= 0 || h <= 0 || !level_in_range(osr, level)) {
+    return NULL;
+  }
+
+  openslide_viewport_t *vp = g_slice_new0(openslide_viewport_t);
+  vp->osr = osr;
+  vp->level = level;
+  vp->w = w;
+  vp->h = h;
+  vp->buf = g_malloc(w * h * 4);
+  return vp;
+}
+
+// read a rectangle of level pixels into the buffer, bouncing through a
+// dense strip since openslide_read_region() wants a contiguous dest
+static void viewport_read_rect(openslide_viewport_t *vp,
+                               int64_t col, int64_t row,
+                               int64_t w, int64_t h) {
+  double ds = vp->osr->levels[vp->level]->downsample;
+
+  uint32_t *strip = g_malloc(w * h * 4);
+  openslide_read_region(vp->osr, strip,
+                        vp->x + (int64_t) round(col * ds),
+                        vp->y + (int64_t) round(row * ds),
+                        vp->level, w, h);
+  for (int64_t r = 0; r < h; r++) {
+    memcpy(vp->buf + (row + r) * vp->w + col, strip + r * w, w * 4);
+  }
+  g_free(strip);
+}
+
+void openslide_viewport_set_position(openslide_viewport_t *vp,
+                                     int64_t x, int64_t y) {
+  openslide_t *osr = vp->osr;
+  double ds = osr->levels[vp->level]->downsample;
+
+  // shift in whole level pixels
+  int64_t dx = 0;
+  int64_t dy = 0;
+  if (vp->valid) {
+    dx = (int64_t) round((x - vp->x) / ds);
+    dy = (int64_t) round((y - vp->y) / ds);
+  }
+  vp->x = x;
+  vp->y = y;
+
+  if (!vp->valid || ABS(dx) >= vp->w || ABS(dy) >= vp->h) {
+    // nothing survives the move
+    openslide_read_region(osr, vp->buf, x, y, vp->level, vp->w, vp->h);
+    vp->valid = !openslide_get_error(osr);
+    return;
+  }
+  if (openslide_get_error(osr)) {
+    memset(vp->buf, 0, vp->w * vp->h * 4);
+    vp->valid = false;
+    return;
+  }
+  if (!dx && !dy) {
+    return;
+  }
+
+  // translate the surviving pixels: dest (r, c) takes (r + dy, c + dx).
+  // iterate rows in an order that doesn't overwrite rows still to move;
+  // memmove handles the horizontal overlap within each row
+  int64_t keep_w = vp->w - ABS(dx);
+  int64_t keep_h = vp->h - ABS(dy);
+  int64_t dst_row0 = MAX(-dy, (int64_t) 0);
+  int64_t src_row0 = MAX(dy, (int64_t) 0);
+  int64_t dst_col0 = MAX(-dx, (int64_t) 0);
+  int64_t src_col0 = MAX(dx, (int64_t) 0);
+  for (int64_t i = 0; i < keep_h; i++) {
+    int64_t r = (dy > 0) ? i : keep_h - 1 - i;
+    memmove(vp->buf + (dst_row0 + r) * vp->w + dst_col0,
+            vp->buf + (src_row0 + r) * vp->w + src_col0,
+            keep_w * 4);
+  }
+
+  // newly-exposed rows, full width
+  if (dy) {
+    viewport_read_rect(vp, 0, (dy > 0) ? vp->h - dy : 0, vp->w, ABS(dy));
+  }
+  // newly-exposed columns, surviving rows only
+  if (dx) {
+    viewport_read_rect(vp, (dx > 0) ? vp->w - dx : 0, dst_row0,
+                       ABS(dx), keep_h);
+  }
+
+  if (openslide_get_error(osr)) {
+    // ensure we don't return a partial result
+    memset(vp->buf, 0, vp->w * vp->h * 4);
+    vp->valid = false;
+  }
+}
+
+const uint32_t *openslide_viewport_get_data(openslide_viewport_t *vp) {
+  return vp->buf;
+}
+
+void openslide_viewport_destroy(openslide_viewport_t *vp) {
+  g_free(vp->buf);
+  g_slice_free(openslide_viewport_t, vp);
+}
+
+void openslide_get_level_tile_geometry(openslide_t *osr, int32_t level,
+                                       int64_t *tile_w, int64_t *tile_h,
+                                       int64_t *tiles_across,
+                                       int64_t *tiles_down) {
+  *tile_w = 0;
+  *tile_h = 0;
+  *tiles_across = 0;
+  *tiles_down = 0;
+
+  if (openslide_get_error(osr) || !level_in_range(osr, level)) {
+    return;
+  }
+
+  struct _openslide_level *l = osr->levels[level];
+  if (l->tile_w <= 0 || l->tile_h <= 0) {
+    return;
+  }
+  *tile_w = l->tile_w;
+  *tile_h = l->tile_h;
+  *tiles_across = (l->w + l->tile_w - 1) / l->tile_w;
+  *tiles_down = (l->h + l->tile_h - 1) / l->tile_h;
+}
+
+void *openslide_read_raw_tile(openslide_t *osr, int32_t level,
+                              int64_t tile_col, int64_t tile_row,
+                              int64_t *size, const char **codec) {
+  GError *tmp_err = NULL;
+
+  *size = -1;
+  if (codec) {
+    *codec = NULL;
+  }
+
+  if (openslide_get_error(osr) || !level_in_range(osr, level) ||
+      !osr->ops->read_raw_tile ||
+      // synthesized levels have no compressed representation
+      synthetic_level_lookup(osr, osr->levels[level])) {
+    return NULL;
+  }
+
+  // out-of-range tiles are not an error; tile servers probe the edges
+  int64_t tw, th, tiles_across, tiles_down;
+  openslide_get_level_tile_geometry(osr, level, &tw, &th,
+                                    &tiles_across, &tiles_down);
+  if (tile_col < 0 || tile_col >= tiles_across ||
+      tile_row < 0 || tile_row >= tiles_down) {
+    return NULL;
+  }
+
+  void *buf = NULL;
+  int64_t len = 0;
+  const char *tile_codec = NULL;
+  if (!osr->ops->read_raw_tile(osr, osr->levels[level],
+                               tile_col, tile_row,
+                               &buf, &len, &tile_codec, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    return NULL;
+  }
+
+  *size = len;
+  if (codec) {
+    *codec = tile_codec;
+  }
+  return buf;
+}
+
+void openslide_raw_tile_free(void *buf) {
+  g_free(buf);
+}
+
 const char * const *openslide_get_property_names(openslide_t *osr) {
   if (openslide_get_error(osr)) {
     return EMPTY_STRING_ARRAY;
@@ -671,6 +2019,12 @@ const char *openslide_get_property_value(openslide_t *osr, const char *name) {
     return NULL;
   }
 
+  // quickhash-1 is computed lazily; the hashtable only holds a
+  // placeholder so the name appears in the property list
+  if (osr->quickhash1 && !strcmp(name, OPENSLIDE_PROPERTY_NAME_QUICKHASH1)) {
+    return _openslide_hash_get_string(osr->quickhash1);
+  }
+
   return g_hash_table_lookup(osr->properties, name);
 }
 
@@ -713,19 +2067,110 @@ void openslide_read_associated_image(openslide_t *osr,
   if (img) {
     // this function is documented to do nothing on failure, so we need an
     // extra memcpy
-    size_t pixels = img->w * img->h;
-    uint32_t *buf = g_new(uint32_t, pixels);
-
-    if (img->ops->get_argb_data(img, buf, &tmp_err)) {
-      if (dest) {
-        memcpy(dest, buf, pixels * sizeof(uint32_t));
+    int64_t size = img->w * img->h * sizeof(uint32_t);
+
+    // decoded associated images are cached alongside tiles, since UIs
+    // tend to fetch the macro and label repeatedly; use the image
+    // struct as the coordinate plane.  images too large for the cache's
+    // size accounting are decoded without caching
+    struct _openslide_cache_entry *cache_entry = NULL;
+    uint32_t *buf = NULL;
+    if (size <= G_MAXINT) {
+      buf = _openslide_cache_get(osr->cache, img, 0, 0, &cache_entry);
+    }
+    if (!buf) {
+      buf = _openslide_tile_alloc(size);
+      if (!img->ops->get_argb_data(img, buf, &tmp_err)) {
+        _openslide_propagate_error(osr, tmp_err);
+        _openslide_tile_free(size, buf);
+        return;
       }
+      if (size <= G_MAXINT) {
+        _openslide_cache_put(osr->cache, osr, img, 0, 0,
+                             buf, size, &cache_entry);
+      }
+    }
+
+    if (dest) {
+      memcpy(dest, buf, size);
+    }
+    if (cache_entry) {
+      _openslide_cache_entry_unref(cache_entry);
     } else {
-      _openslide_propagate_error(osr, tmp_err);
+      _openslide_tile_free(size, buf);
     }
+  }
+}
+
+void openslide_set_cache_size(int64_t capacity) {
+  _openslide_cache_shared_set_capacity(capacity);
+}
+
+int64_t openslide_get_cache_size(void) {
+  return _openslide_cache_shared_get_capacity();
+}
 
-    g_free(buf);
+// must match enum _openslide_codec
+static const char * const STATISTIC_CODEC_NAMES[] = {
+  "jpeg", "jp2k", "tiff", "png", "other",
+};
+
+static const char * const STATISTIC_NAMES[] = {
+  "cache.hits",
+  "cache.misses",
+  "cache.evictions",
+  "cache.puts",
+  "decode.jpeg.tiles", "decode.jpeg.bytes", "decode.jpeg.usec",
+  "decode.jp2k.tiles", "decode.jp2k.bytes", "decode.jp2k.usec",
+  "decode.tiff.tiles", "decode.tiff.bytes", "decode.tiff.usec",
+  "decode.png.tiles", "decode.png.bytes", "decode.png.usec",
+  "decode.other.tiles", "decode.other.bytes", "decode.other.usec",
+  NULL,
+};
+
+const char * const *openslide_get_statistic_names(openslide_t *osr G_GNUC_UNUSED) {
+  return STATISTIC_NAMES;
+}
+
+int64_t openslide_get_statistic(openslide_t *osr, const char *name) {
+  if (g_str_has_prefix(name, "cache.")) {
+    if (!osr->cache) {
+      // an object returned from a failed open never got a cache
+      return -1;
+    }
+    struct _openslide_cache_stats stats;
+    _openslide_cache_get_stats(osr->cache, &stats);
+    if (!strcmp(name, "cache.hits")) {
+      return stats.hits;
+    } else if (!strcmp(name, "cache.misses")) {
+      return stats.misses;
+    } else if (!strcmp(name, "cache.evictions")) {
+      return stats.evictions;
+    } else if (!strcmp(name, "cache.puts")) {
+      return stats.puts;
+    }
+  } else if (g_str_has_prefix(name, "decode.")) {
+    for (int i = 0; i < _OPENSLIDE_CODEC_LAST; i++) {
+      const char *codec = STATISTIC_CODEC_NAMES[i];
+      if (strncmp(name + 7, codec, strlen(codec)) ||
+          name[7 + strlen(codec)] != '.') {
+        continue;
+      }
+      const char *field = name + 7 + strlen(codec) + 1;
+      g_mutex_lock(osr->stats_lock);
+      struct _openslide_decode_stats stats = osr->decode_stats[i];
+      g_mutex_unlock(osr->stats_lock);
+      if (!strcmp(field, "tiles")) {
+        return stats.tiles;
+      } else if (!strcmp(field, "bytes")) {
+        return stats.bytes;
+      } else if (!strcmp(field, "usec")) {
+        return stats.usec;
+      }
+      break;
+    }
   }
+  return -1;
 }
 
 const char *openslide_get_version(void) {
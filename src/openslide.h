@@ -89,6 +89,61 @@ OPENSLIDE_PUBLIC()
 openslide_t *openslide_open(const char *filename);
 
 
+/**
+ * Open a whole slide image with per-object tuning options.
+ *
+ * This function behaves like openslide_open(), but additionally accepts
+ * a NULL-terminated array of <tt>"key=value"</tt> strings controlling
+ * the resources the new object may use.  The recognized keys are:
+ *
+ * - <tt>"decode-threads"</tt>: the number of worker threads used to
+ *   decode tiles concurrently.  0 or 1 disables concurrent decoding.
+ *   Defaults to the number of processors.
+ * - <tt>"cache-size"</tt>: the capacity of a private tile cache for
+ *   this object, in bytes.  0 disables caching.  If set, the object
+ *   never attaches to the shared cache configured with
+ *   openslide_set_cache_size().
+ * - <tt>"prefetch-threads"</tt>: the number of threads servicing
+ *   openslide_give_prefetch_hint().  0 ignores prefetch hints.
+ *   Defaults to 1.
+ * - <tt>"shared-handle"</tt>: if nonzero, repeated opens of the same
+ *   file return the same refcounted object, sharing one cache and one
+ *   set of parsed metadata; each open still pairs with one
+ *   openslide_close(), and the object is destroyed by the last closer.
+ *   The registry entry is validated against the file's size and
+ *   modification time, so a replaced file gets a fresh object.  Note
+ *   that an error in a shared object is visible to every holder.
+ *   Defaults to off, or on if the OPENSLIDE_SHARED_HANDLES environment
+ *   variable is set.
+ * - <tt>"synthetic-levels"</tt>: if nonzero, gaps in a sparse pyramid
+ *   (adjacent levels more than 8x apart, as in many Hamamatsu slides)
+ *   are filled with synthesized intermediate levels.  Their tiles are
+ *   computed on first use by downsampling the next finer level and are
+ *   then cached like native tiles, persistently if
+ *   OPENSLIDE_TILE_CACHE_DIR is configured; the levels otherwise
+ *   behave like native ones, including in
+ *   openslide_get_best_level_for_downsample().  Note that this changes
+ *   the level count and numbering reported for affected slides.
+ *   Defaults to off, or on if the OPENSLIDE_SYNTHETIC_LEVELS
+ *   environment variable is set.
+ *
+ * Unrecognized keys are ignored with a warning, so options can be
+ * passed to older library versions.
+ *
+ * @param filename The filename to open.  On Windows, this must be in UTF-8.
+ * @param options A NULL-terminated array of option strings, or NULL.
+ * @return
+ *         On success, a new OpenSlide object.
+ *         If the file is not recognized by OpenSlide, NULL.
+ *         If the file is recognized but an error occurred, an OpenSlide
+ *         object in error state.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_t *openslide_open_with_options(const char *filename,
+					 const char *const *options);
+
+
 /**
  * Get the number of levels in the whole slide image.
  *
@@ -179,6 +234,387 @@ void openslide_read_region(openslide_t *osr,
 			   int64_t w, int64_t h);
 
 
+/**
+ * Copy pre-multiplied ARGB data from a whole slide image, downscaled
+ * by an integer factor.
+ *
+ * This function reads the region of size (@p w * @p factor,
+ * @p h * @p factor) at the given level and shrinks it to (@p w, @p h)
+ * with a box filter, averaging each @p factor x @p factor block of
+ * pixels.  It is equivalent to reading the full-resolution region and
+ * averaging it afterward, but processes the image in bounded strips,
+ * so generating a small overview of a large level does not require
+ * memory for the full-resolution intermediate.  @p dest must be a
+ * valid pointer to at least (@p w * @p h * 4) bytes.
+ *
+ * Use this when the desired downsample falls between levels: read from
+ * the level given by openslide_get_best_level_for_downsample() with
+ * the residual integer factor, then apply any remaining fractional
+ * scaling to the much smaller result.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the destination region. Must be non-negative.
+ * @param h The height of the destination region. Must be non-negative.
+ * @param factor The downscale factor. A factor less than 2 behaves
+ *               like openslide_read_region().
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_scaled(openslide_t *osr,
+				  uint32_t *dest,
+				  int64_t x, int64_t y,
+				  int32_t level,
+				  int64_t w, int64_t h,
+				  int32_t factor);
+
+
+/**
+ * Copy packed 24-bit RGB data from a whole slide image.
+ *
+ * This function behaves like openslide_read_region(), but writes three
+ * bytes per pixel (R, G, B in memory order) instead of 4-byte
+ * premultiplied ARGB, composited over an opaque white background.
+ * Brightfield slides are fully opaque, so for them the output matches
+ * the color channels of openslide_read_region() exactly while using 25%
+ * less memory and letting consumers that want packed RGB skip a repack
+ * pass.  The region is converted in bounded strips, so no full-size
+ * ARGB intermediate is allocated.  @p dest must be a valid pointer to
+ * at least (@p w * @p h * 3) bytes.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the RGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_rgb(openslide_t *osr,
+			       uint8_t *dest,
+			       int64_t x, int64_t y,
+			       int32_t level,
+			       int64_t w, int64_t h);
+
+
+/**
+ * The type of a completion callback for openslide_read_region_async().
+ *
+ * The callback is invoked on an internal worker thread once the region
+ * has been read into @p dest.  It must not call openslide_close() on
+ * @p osr.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer passed to
+ *             openslide_read_region_async().
+ * @param user_data The user data passed to openslide_read_region_async().
+ * @since 3.5.0
+ */
+typedef void (*openslide_read_region_callback)(openslide_t *osr,
+					       uint32_t *dest,
+					       void *user_data);
+
+
+/**
+ * Queue an asynchronous region read.
+ *
+ * This function behaves like openslide_read_region(), but queues the
+ * read onto an internal executor and returns immediately.  When the
+ * region has been read, @p callback is invoked with @p dest and
+ * @p user_data on a worker thread.  Multiple queued reads may be
+ * processed concurrently and may complete in any order.  @p dest must
+ * remain valid until the callback runs.
+ *
+ * Call openslide_read_region_async_wait() to drain all outstanding
+ * reads, and always drain them before calling openslide_close().
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @param callback The completion callback.
+ * @param user_data Data passed through to @p callback.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_async(openslide_t *osr,
+				 uint32_t *dest,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h,
+				 openslide_read_region_callback callback,
+				 void *user_data);
+
+
+/**
+ * Wait for all outstanding asynchronous region reads.
+ *
+ * After this function returns, the completion callbacks of all reads
+ * previously queued with openslide_read_region_async() have run.
+ *
+ * @param osr The OpenSlide object.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_async_wait(openslide_t *osr);
+
+
+/**
+ * One region in a batch passed to openslide_read_regions().
+ *
+ * @since 3.5.0
+ */
+typedef struct {
+  /** The top left x-coordinate, in the level 0 reference frame. */
+  int64_t x;
+  /** The top left y-coordinate, in the level 0 reference frame. */
+  int64_t y;
+  /** The desired level. */
+  int32_t level;
+  /** The width of the region. Must be non-negative. */
+  int64_t w;
+  /** The height of the region. Must be non-negative. */
+  int64_t h;
+  /** The destination buffer for the ARGB data. */
+  uint32_t *dest;
+} openslide_region_t;
+
+
+/**
+ * Copy multiple regions from a whole slide image in one call.
+ *
+ * Each region behaves like a call to openslide_read_region(), but the
+ * batch is planned together: regions are scheduled so that tiles shared
+ * between overlapping or neighboring regions are decoded once, and the
+ * reads execute concurrently on an internal executor.  The function
+ * returns when every region has been read.  This is substantially
+ * faster than looping over openslide_read_region() when extracting many
+ * small patches.
+ *
+ * @param osr The OpenSlide object.
+ * @param regions An array of regions to read.
+ * @param count The number of regions in @p regions.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_regions(openslide_t *osr,
+			    const openslide_region_t *regions,
+			    int32_t count);
+
+
+/**
+ * The type of a band callback for openslide_read_region_rows().
+ *
+ * The callback is invoked once per band, in order from the top of the
+ * region to the bottom.  @p band holds premultiplied ARGB data for
+ * @p h rows of @p w pixels and is only valid until the callback
+ * returns.
+ *
+ * @param osr The OpenSlide object.
+ * @param band The decoded band.
+ * @param row The first row of the band, relative to the region.
+ * @param w The width of the band.
+ * @param h The height of the band.
+ * @param user_data The user data passed to openslide_read_region_rows().
+ * @return true to continue, false to stop reading.
+ * @since 3.5.0
+ */
+typedef bool (*openslide_band_callback)(openslide_t *osr,
+					uint32_t *band,
+					int64_t row,
+					int64_t w, int64_t h,
+					void *user_data);
+
+
+/**
+ * Read a region as a stream of horizontal bands.
+ *
+ * This function behaves like openslide_read_region(), but instead of
+ * requiring a w * h * 4 byte buffer for the whole region, it decodes
+ * the region in bands of @p band_height rows and hands each band to
+ * @p callback in order.  Memory use is bounded by two bands: while a
+ * band is being consumed, the next one is decoded concurrently.
+ * Intended for whole-slide exports and scans whose full-resolution
+ * output would not fit in memory.
+ *
+ * If an error occurs, reading stops and the error is available from
+ * openslide_get_error(); bands already delivered remain valid.
+ *
+ * @param osr The OpenSlide object.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @param band_height The number of rows per band. Must be positive.
+ * @param callback The band callback.
+ * @param user_data Data passed through to @p callback.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_rows(openslide_t *osr,
+				int64_t x, int64_t y,
+				int32_t level,
+				int64_t w, int64_t h,
+				int64_t band_height,
+				openslide_band_callback callback,
+				void *user_data);
+
+
+/**
+ * An incrementally-updated view of one slide level.
+ *
+ * @since 3.5.0
+ */
+typedef struct _openslide_viewport openslide_viewport_t;
+
+
+/**
+ * Create a viewport for incremental region reads.
+ *
+ * A viewport wraps a persistent (@p w * @p h) pixel buffer on one
+ * level.  Each call to openslide_viewport_set_position() shifts the
+ * surviving pixels within the buffer and reads only the newly-exposed
+ * strips, so panning a viewer costs a strip of tiles instead of a full
+ * region read.  Viewports are not thread-safe; use one per reader.
+ *
+ * A zoom to a different level invalidates every pixel, so it is no
+ * cheaper than creating a fresh viewport; the level is therefore fixed
+ * at creation.
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.
+ * @param w The width of the viewport, in level pixels. Must be positive.
+ * @param h The height of the viewport, in level pixels. Must be positive.
+ * @return A viewport to free with openslide_viewport_destroy(), or NULL
+ *         if the arguments are invalid.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_viewport_t *openslide_viewport_create(openslide_t *osr,
+						int32_t level,
+						int64_t w, int64_t h);
+
+
+/**
+ * Move a viewport and update its buffer.
+ *
+ * The first call reads the whole region, like openslide_read_region().
+ * Subsequent calls translate the pixels still visible at the new
+ * position and read only the exposed edge strips.  The position delta
+ * is applied in whole level pixels; if the level-0 delta is not an
+ * integral multiple of the level downsample, the surviving pixels may
+ * be misaligned by up to half a level pixel, so callers wanting exact
+ * output should pan in multiples of the downsample.
+ *
+ * If an error occurs or has occurred, the buffer is cleared.
+ *
+ * @param viewport The viewport.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_viewport_set_position(openslide_viewport_t *viewport,
+				     int64_t x, int64_t y);
+
+
+/**
+ * Get the pixel buffer of a viewport.
+ *
+ * The buffer holds pre-multiplied ARGB data for the position given in
+ * the last openslide_viewport_set_position() call, w * h pixels in row
+ * order.  It is owned by the viewport and remains valid, though not
+ * constant, until openslide_viewport_destroy().
+ *
+ * @param viewport The viewport.
+ * @return The buffer.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+const uint32_t *openslide_viewport_get_data(openslide_viewport_t *viewport);
+
+
+/**
+ * Free a viewport.
+ *
+ * @param viewport The viewport.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_viewport_destroy(openslide_viewport_t *viewport);
+
+
+/**
+ * Get the tile geometry of a level.
+ *
+ * Levels are divided into tiles of uniform size when the backend
+ * exposes its tile grid; the last tile in each row or column may extend
+ * past the level bounds.  All outputs are set to 0 if an error occurred
+ * or the level does not have uniform tile geometry.
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.
+ * @param[out] tile_w The tile width.
+ * @param[out] tile_h The tile height.
+ * @param[out] tiles_across The number of tile columns.
+ * @param[out] tiles_down The number of tile rows.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_level_tile_geometry(openslide_t *osr, int32_t level,
+				       int64_t *tile_w, int64_t *tile_h,
+				       int64_t *tiles_across,
+				       int64_t *tiles_down);
+
+
+/**
+ * Read the raw compressed bytes of one tile.
+ *
+ * For slide formats that store tiles in a compressed format a server
+ * can pass through directly (for example JPEG), this fetches the stored
+ * bytes without decoding them.  Codec headers shared between tiles,
+ * such as JPEG tables, are included so the returned buffer is a
+ * complete standalone stream.  @p codec, if non-NULL, receives a static
+ * string naming the compression, such as "jpeg", "deflate", or "raw".
+ *
+ * Returns NULL if an error occurred, the tile is out of range, or the
+ * backend cannot provide raw tiles; callers must be prepared to fall
+ * back to openslide_read_region().
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.
+ * @param tile_col The column of the tile, starting from 0.
+ * @param tile_row The row of the tile, starting from 0.
+ * @param[out] size The size of the returned buffer in bytes.
+ * @param[out] codec The compression name, or NULL if not wanted.
+ * @return A buffer to free with openslide_raw_tile_free(), or NULL.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void *openslide_read_raw_tile(openslide_t *osr, int32_t level,
+			      int64_t tile_col, int64_t tile_row,
+			      int64_t *size, const char **codec);
+
+
+/**
+ * Free a buffer returned by openslide_read_raw_tile().
+ *
+ * @param buf The buffer.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_raw_tile_free(void *buf);
+
+
 /**
  * Close an OpenSlide object.
  * No other threads may be using the object.
@@ -424,6 +860,148 @@ void openslide_read_associated_image(openslide_t *osr,
 				     uint32_t *dest);
 //@}
 
+/**
+ * @name Prefetching
+ * Hinting the library about regions that will be read soon.
+ */
+//@{
+
+/**
+ * Hint that a region is likely to be needed soon.
+ *
+ * The tiles covering the hinted region are decoded into the tile cache
+ * by a background thread, so that a subsequent openslide_read_region()
+ * call for the same area can composite from already-decoded tiles.
+ * Prefetching runs at low priority on a single thread and never blocks
+ * the caller.
+ *
+ * @param osr The OpenSlide object.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region.
+ * @param h The height of the region.
+ * @return An identifier that can be passed to
+ *         openslide_cancel_prefetch_hint().
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int openslide_give_prefetch_hint(openslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h);
+
+/**
+ * Cancel a prefetch hint.
+ *
+ * If the hinted region has not been prefetched yet, it will be skipped.
+ * A prefetch that is already in progress is not interrupted.
+ *
+ * @param osr The OpenSlide object.
+ * @param prefetch_id An identifier returned by
+ *                    openslide_give_prefetch_hint().
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id);
+//@}
+
+/**
+ * @name Caching
+ * Configuring the tile cache.
+ */
+//@{
+
+/**
+ * Set the capacity of the process-wide shared tile cache.
+ *
+ * By default, every OpenSlide object has a private 32 MiB tile cache.
+ * If a nonzero capacity is set with this function, objects opened
+ * afterward attach to a single shared cache with the given capacity,
+ * so the total cache memory of the process is bounded regardless of
+ * the number of open slides and hot slides can use most of the budget.
+ *
+ * Setting a capacity of 0 detaches the shared cache; objects opened
+ * afterward revert to private caches.  Objects that are already open
+ * keep the cache they were opened with.
+ *
+ * @param capacity The capacity of the shared cache, in bytes.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_cache_size(int64_t capacity);
+
+/**
+ * Get the capacity of the process-wide shared tile cache.
+ *
+ * @return The capacity set with openslide_set_cache_size(), or 0 if
+ *         slides use private caches.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int64_t openslide_get_cache_size(void);
+
+/**
+ * Hint that the calling thread should not pollute the tile cache.
+ *
+ * While the hint is set, reads issued by the calling thread still use
+ * tiles that are already cached, but the tiles they decode are not
+ * inserted into the cache.  Batch jobs that sweep a slide once should
+ * set this so that they do not evict the working sets of interactive
+ * readers sharing the cache.
+ *
+ * The hint is per-thread and persists until changed.
+ *
+ * @param bypass Non-zero to bypass cache insertion, 0 to restore
+ *               normal caching.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_cache_bypass(int bypass);
+//@}
+
+/**
+ * @name Statistics
+ * Querying runtime performance counters.
+ */
+//@{
+
+/**
+ * Get the NULL-terminated array of statistic names.
+ *
+ * The returned array is valid for the lifetime of the process.  The
+ * available statistics are cache counters (such as
+ * <tt>"cache.hits"</tt>, <tt>"cache.misses"</tt>, and
+ * <tt>"cache.evictions"</tt>) and per-codec decode counters (such as
+ * <tt>"decode.jpeg.tiles"</tt>, <tt>"decode.jpeg.bytes"</tt>, and
+ * <tt>"decode.jpeg.usec"</tt>).
+ *
+ * @param osr The OpenSlide object.
+ * @return A NULL-terminated string array of statistic names.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+const char * const *openslide_get_statistic_names(openslide_t *osr);
+
+/**
+ * Get the current value of a statistic.
+ *
+ * Counters accumulate over the lifetime of the OpenSlide object and
+ * may be read at any time from any thread.  If the object is attached
+ * to the process-wide shared tile cache, the cache counters cover the
+ * shared cache rather than this object alone.
+ *
+ * @param osr The OpenSlide object.
+ * @param name The name of the desired statistic.  Must be
+ *             a valid name as given by openslide_get_statistic_names().
+ * @return The value of the statistic, or -1 if the name was not
+ *         recognized.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int64_t openslide_get_statistic(openslide_t *osr, const char *name);
+//@}
+
 /**
  * @name Miscellaneous
  * Utility functions.
@@ -559,17 +1137,6 @@ const char *openslide_get_comment(openslide_t *osr);
 
 //@}
 
-#ifndef OPENSLIDE_SIMPLIFY_HEADERS
-// these are meant to throw compile- and link-time errors,
-// since the functions they replace were never implemented
-int _openslide_give_prefetch_hint_UNIMPLEMENTED(void);
-void _openslide_cancel_prefetch_hint_UNIMPLEMENTED(void);
-#define openslide_give_prefetch_hint(osr, x, y, level, w, h)	\
-  _openslide_give_prefetch_hint_UNIMPLEMENTED(-1);
-#define openslide_cancel_prefetch_hint(osr, prefetch_id)	\
-  _openslide_cancel_prefetch_hint_UNIMPLEMENTED(-1)
-#endif
-
 /**
  * @mainpage OpenSlide
  *
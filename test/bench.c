@@ -0,0 +1,310 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Parameterized read benchmark.  Reads a configurable number of regions
+   from a slide with a configurable region size, access pattern, and
+   thread count, and reports throughput and p50/p99 region latency.
+   Running multiple passes over the same schedule shows cold-cache
+   vs. warm-cache performance. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <openslide.h>
+#include "openslide-common.h"
+
+// viewer-pan simulation: length of each drag, in steps of half a region
+#define PAN_RUN_LENGTH 8
+
+struct region {
+  int64_t x;
+  int64_t y;
+};
+
+struct worker {
+  GThread *thread;
+  openslide_t *osr;
+  const struct region *regions;
+  int count;
+  int stride;   // thread count
+  int offset;   // thread index
+  double *latencies;  // seconds, one per region read by this worker
+  int nlatencies;
+};
+
+static int level;
+static int region_size = 512;
+static int region_count = 256;
+static int thread_count = 1;
+static int pass_count = 1;
+static int seed = 42;
+static int64_t cache_mb = -1;
+static char *pattern = NULL;
+
+static GOptionEntry options[] = {
+  {"level", 'l', 0, G_OPTION_ARG_INT, &level,
+   "Pyramid level to read (default 0)", "LEVEL"},
+  {"size", 's', 0, G_OPTION_ARG_INT, &region_size,
+   "Region size in pixels (default 512)", "PIXELS"},
+  {"count", 'c', 0, G_OPTION_ARG_INT, &region_count,
+   "Number of regions per pass (default 256)", "COUNT"},
+  {"threads", 't', 0, G_OPTION_ARG_INT, &thread_count,
+   "Number of reader threads (default 1)", "THREADS"},
+  {"passes", 'p', 0, G_OPTION_ARG_INT, &pass_count,
+   "Number of passes over the schedule (default 1)", "PASSES"},
+  {"pattern", 'a', 0, G_OPTION_ARG_STRING, &pattern,
+   "Access pattern: raster, random, or pan (default raster)", "PATTERN"},
+  {"cache-size", 'm', 0, G_OPTION_ARG_INT64, &cache_mb,
+   "Shared tile cache size in MiB (default: private 32 MiB caches)", "MIB"},
+  {"seed", 'r', 0, G_OPTION_ARG_INT, &seed,
+   "Random seed for random and pan patterns (default 42)", "SEED"},
+  {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+static struct region *make_raster_schedule(int64_t w, int64_t h) {
+  struct region *regions = g_new(struct region, region_count);
+  int64_t x = 0;
+  int64_t y = 0;
+  for (int i = 0; i < region_count; i++) {
+    regions[i].x = x;
+    regions[i].y = y;
+    x += region_size;
+    if (x + region_size > w) {
+      x = 0;
+      y += region_size;
+      if (y + region_size > h) {
+        y = 0;
+      }
+    }
+  }
+  return regions;
+}
+
+static struct region *make_random_schedule(GRand *rand,
+                                           int64_t w, int64_t h) {
+  struct region *regions = g_new(struct region, region_count);
+  for (int i = 0; i < region_count; i++) {
+    regions[i].x = g_rand_int_range(rand, 0, MAX(w - region_size, 1));
+    regions[i].y = g_rand_int_range(rand, 0, MAX(h - region_size, 1));
+  }
+  return regions;
+}
+
+static struct region *make_pan_schedule(GRand *rand, int64_t w, int64_t h) {
+  // simulate a viewer: jump to a random position, then drag in a random
+  // direction in half-region steps, then jump again
+  struct region *regions = g_new(struct region, region_count);
+  int64_t x = 0;
+  int64_t y = 0;
+  int64_t dx = 0;
+  int64_t dy = 0;
+  int run = 0;
+  for (int i = 0; i < region_count; i++) {
+    if (run == 0) {
+      x = g_rand_int_range(rand, 0, MAX(w - region_size, 1));
+      y = g_rand_int_range(rand, 0, MAX(h - region_size, 1));
+      dx = (g_rand_int_range(rand, 0, 3) - 1) * region_size / 2;
+      dy = (g_rand_int_range(rand, 0, 3) - 1) * region_size / 2;
+      run = PAN_RUN_LENGTH;
+    }
+    regions[i].x = x;
+    regions[i].y = y;
+    x = CLAMP(x + dx, 0, MAX(w - region_size, 0));
+    y = CLAMP(y + dy, 0, MAX(h - region_size, 0));
+    run--;
+  }
+  return regions;
+}
+
+static void *worker_func(void *data) {
+  struct worker *worker = data;
+  uint32_t bufsz = region_size * region_size * sizeof(uint32_t);
+  uint32_t *buf = g_slice_alloc(bufsz);
+  GTimer *timer = g_timer_new();
+
+  for (int i = worker->offset; i < worker->count; i += worker->stride) {
+    double start = g_timer_elapsed(timer, NULL);
+    openslide_read_region(worker->osr, buf,
+                          worker->regions[i].x, worker->regions[i].y,
+                          level, region_size, region_size);
+    worker->latencies[worker->nlatencies++] =
+      g_timer_elapsed(timer, NULL) - start;
+  }
+
+  g_timer_destroy(timer);
+  g_slice_free1(bufsz, buf);
+  return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  const double *da = a;
+  const double *db = b;
+  return (*da > *db) - (*da < *db);
+}
+
+static void run_pass(openslide_t *osr, const struct region *regions,
+                     int pass, double tiles_per_region) {
+  struct worker *workers = g_new0(struct worker, thread_count);
+  int64_t start_hits = openslide_get_statistic(osr, "cache.hits");
+  int64_t start_misses = openslide_get_statistic(osr, "cache.misses");
+  GTimer *timer = g_timer_new();
+
+  for (int i = 0; i < thread_count; i++) {
+    workers[i].osr = osr;
+    workers[i].regions = regions;
+    workers[i].count = region_count;
+    workers[i].stride = thread_count;
+    workers[i].offset = i;
+    workers[i].latencies = g_new(double, region_count / thread_count + 1);
+    workers[i].thread = g_thread_create(worker_func, &workers[i],
+                                        TRUE, NULL);
+    if (!workers[i].thread) {
+      common_fail("Couldn't start thread");
+    }
+  }
+
+  // gather latencies
+  double *latencies = g_new(double, region_count);
+  int nlatencies = 0;
+  for (int i = 0; i < thread_count; i++) {
+    g_thread_join(workers[i].thread);
+    memcpy(latencies + nlatencies, workers[i].latencies,
+           workers[i].nlatencies * sizeof(double));
+    nlatencies += workers[i].nlatencies;
+    g_free(workers[i].latencies);
+  }
+  double elapsed = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+  g_free(workers);
+
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    common_fail("Read failed: %s", err);
+  }
+
+  qsort(latencies, nlatencies, sizeof(double), compare_doubles);
+  double p50 = latencies[nlatencies / 2];
+  double p99 = latencies[MIN(nlatencies * 99 / 100, nlatencies - 1)];
+  double mpix = (double) nlatencies * region_size * region_size /
+                1e6 / elapsed;
+
+  int64_t hits = openslide_get_statistic(osr, "cache.hits") - start_hits;
+  int64_t misses = openslide_get_statistic(osr, "cache.misses") -
+                   start_misses;
+  double hit_rate = hits + misses ? 100.0 * hits / (hits + misses) : 0;
+
+  printf("pass %d: %d regions in %.3f s -> %.1f regions/s, "
+         "%.1f tiles/s, %.1f Mpix/s, p50 %.2f ms, p99 %.2f ms, "
+         "cache hit rate %.1f%%\n",
+         pass, nlatencies, elapsed, nlatencies / elapsed,
+         nlatencies * tiles_per_region / elapsed, mpix,
+         p50 * 1000, p99 * 1000, hit_rate);
+
+  g_free(latencies);
+}
+
+int main(int argc, char **argv) {
+  GError *tmp_err = NULL;
+
+  GOptionContext *ctx =
+    g_option_context_new("SLIDE - benchmark region reads from a slide");
+  g_option_context_add_main_entries(ctx, options, NULL);
+  if (!common_parse_options(ctx, &argc, &argv, &tmp_err)) {
+    common_fail("%s", tmp_err->message);
+  }
+  g_option_context_free(ctx);
+  if (argc != 2) {
+    common_fail("No slide specified");
+  }
+  const char *path = argv[1];
+
+  if (region_size < 1 || region_count < 1 || thread_count < 1 ||
+      pass_count < 1) {
+    common_fail("Invalid parameter");
+  }
+  if (!pattern) {
+    pattern = g_strdup("raster");
+  }
+
+  if (cache_mb >= 0) {
+    openslide_set_cache_size(cache_mb << 20);
+  }
+
+  openslide_t *osr = openslide_open(path);
+  if (!osr) {
+    common_fail("Couldn't open %s", path);
+  }
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    common_fail("Open failed: %s", err);
+  }
+  if (level >= openslide_get_level_count(osr)) {
+    common_fail("No such level: %d", level);
+  }
+
+  int64_t w, h;
+  openslide_get_level_dimensions(osr, level, &w, &h);
+  if (region_size > w || region_size > h) {
+    common_fail("Region size larger than level");
+  }
+
+  // compute tiles per region from the level's tile geometry, when known
+  int64_t tile_w, tile_h, tiles_across, tiles_down;
+  openslide_get_level_tile_geometry(osr, level, &tile_w, &tile_h,
+                                    &tiles_across, &tiles_down);
+  double tiles_per_region = 1;
+  if (tile_w > 0 && tile_h > 0) {
+    tiles_per_region = ((region_size + tile_w - 1) / tile_w + 1) *
+                       ((region_size + tile_h - 1) / tile_h + 1);
+  }
+
+  // build the region schedule
+  GRand *rand = g_rand_new_with_seed(seed);
+  struct region *regions;
+  if (!strcmp(pattern, "raster")) {
+    regions = make_raster_schedule(w, h);
+  } else if (!strcmp(pattern, "random")) {
+    regions = make_random_schedule(rand, w, h);
+  } else if (!strcmp(pattern, "pan")) {
+    regions = make_pan_schedule(rand, w, h);
+  } else {
+    common_fail("Unknown pattern: %s", pattern);
+  }
+  g_rand_free(rand);
+
+  printf("%s: level %d (%"PRId64" x %"PRId64"), %dx%d regions, "
+         "%s pattern, %d threads\n",
+         openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_VENDOR),
+         level, w, h, region_size, region_size, pattern, thread_count);
+
+  for (int pass = 1; pass <= pass_count; pass++) {
+    run_pass(osr, regions, pass, tiles_per_region);
+  }
+
+  g_free(regions);
+  g_free(pattern);
+  openslide_close(osr);
+
+  return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Replay a captured access trace against a slide.  Traces are recorded
+   by the library when OPENSLIDE_TRACE_FILE is set (see
+   src/openslide-trace.c for the format); replaying one reproduces a
+   production access pattern locally, with configurable thread count
+   and timing, and reports latency percentiles and cache hit rate. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <openslide.h>
+#include "openslide-common.h"
+
+#define TRACE_MAGIC "OSTRACE1"
+
+// must match struct trace_read in src/openslide-trace.c
+struct trace_read {
+  int64_t slide;
+  int64_t usec;
+  int64_t thread;
+  int64_t x;
+  int64_t y;
+  int64_t level;
+  int64_t w;
+  int64_t h;
+};
+
+struct worker {
+  GThread *thread;
+  openslide_t *osr;
+  GTimer *pass_timer;  // shared; read-only after start
+  int offset;          // thread index
+  double *latencies;   // seconds, one per region read by this worker
+  int nlatencies;
+};
+
+static int thread_count = 1;
+static int pass_count = 1;
+static int64_t slide_id = -1;
+static int64_t cache_mb = -1;
+static char *timing = NULL;
+static gboolean paced;
+
+static GArray *reads;        // of struct trace_read, for the chosen slide
+static int64_t max_region;   // pixels, over the chosen reads
+
+static GOptionEntry options[] = {
+  {"threads", 't', 0, G_OPTION_ARG_INT, &thread_count,
+   "Number of reader threads (default 1)", "THREADS"},
+  {"timing", 'T', 0, G_OPTION_ARG_STRING, &timing,
+   "Timing mode: asap replays at full speed, paced honors the "
+   "captured timestamps (default asap)", "MODE"},
+  {"passes", 'p', 0, G_OPTION_ARG_INT, &pass_count,
+   "Number of passes over the trace (default 1)", "PASSES"},
+  {"slide-id", 'i', 0, G_OPTION_ARG_INT64, &slide_id,
+   "Trace slide id to replay (default: first in the trace)", "ID"},
+  {"cache-size", 'm', 0, G_OPTION_ARG_INT64, &cache_mb,
+   "Shared tile cache size in MiB (default: private 32 MiB caches)", "MIB"},
+  {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+static char *read_string(FILE *f) {
+  int32_t len;
+  if (fread(&len, sizeof(len), 1, f) != 1 || len < 0 || len > 4096) {
+    return NULL;
+  }
+  char *str = g_malloc(len + 1);
+  if (len && fread(str, len, 1, f) != 1) {
+    g_free(str);
+    return NULL;
+  }
+  str[len] = 0;
+  return str;
+}
+
+static void load_trace(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    common_fail("Couldn't open %s", path);
+  }
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  if (fread(magic, sizeof(magic), 1, f) != 1 ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic))) {
+    common_fail("%s is not a trace file", path);
+  }
+
+  reads = g_array_new(FALSE, FALSE, sizeof(struct trace_read));
+  int64_t skipped = 0;
+  int c;
+  while ((c = getc(f)) != EOF) {
+    if (c == 'S') {
+      int64_t id;
+      if (fread(&id, sizeof(id), 1, f) != 1) {
+        break;
+      }
+      char *hash = read_string(f);
+      char *name = read_string(f);
+      if (!hash || !name) {
+        g_free(hash);
+        g_free(name);
+        break;
+      }
+      printf("trace slide %"PRId64": %s (quickhash-1 %s)\n",
+             id, name, hash[0] ? hash : "unavailable");
+      if (slide_id == -1) {
+        slide_id = id;
+      }
+      g_free(hash);
+      g_free(name);
+    } else if (c == 'R') {
+      struct trace_read rec;
+      if (fread(&rec, sizeof(rec), 1, f) != 1) {
+        break;
+      }
+      if (rec.slide != slide_id) {
+        skipped++;
+        continue;
+      }
+      g_array_append_val(reads, rec);
+      max_region = MAX(max_region, rec.w * rec.h);
+    } else {
+      common_fail("Corrupt record type %d in %s", c, path);
+    }
+  }
+  fclose(f);
+
+  if (!reads->len) {
+    common_fail("No reads for slide id %"PRId64" in %s", slide_id, path);
+  }
+  double span = g_array_index(reads, struct trace_read,
+                              reads->len - 1).usec / 1e6;
+  printf("replaying %u reads for slide %"PRId64" spanning %.1f s "
+         "(%"PRId64" reads for other slides skipped)\n",
+         reads->len, slide_id, span, skipped);
+}
+
+static void *worker_func(void *data) {
+  struct worker *worker = data;
+  int64_t bufsz = max_region * sizeof(uint32_t);
+  uint32_t *buf = g_malloc(bufsz);
+  GTimer *timer = g_timer_new();
+
+  for (unsigned i = worker->offset; i < reads->len; i += thread_count) {
+    const struct trace_read *rec = &g_array_index(reads,
+                                                  struct trace_read, i);
+    if (paced) {
+      // wait for this read's captured offset into the trace
+      double wait = rec->usec / 1e6 -
+                    g_timer_elapsed(worker->pass_timer, NULL);
+      if (wait > 0) {
+        g_usleep(wait * 1e6);
+      }
+    }
+    double start = g_timer_elapsed(timer, NULL);
+    openslide_read_region(worker->osr, buf, rec->x, rec->y,
+                          (int32_t) rec->level, rec->w, rec->h);
+    worker->latencies[worker->nlatencies++] =
+      g_timer_elapsed(timer, NULL) - start;
+  }
+
+  g_timer_destroy(timer);
+  g_free(buf);
+  return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  const double *da = a;
+  const double *db = b;
+  return (*da > *db) - (*da < *db);
+}
+
+static void run_pass(openslide_t *osr, int pass) {
+  struct worker *workers = g_new0(struct worker, thread_count);
+  int64_t start_hits = openslide_get_statistic(osr, "cache.hits");
+  int64_t start_misses = openslide_get_statistic(osr, "cache.misses");
+  GTimer *timer = g_timer_new();
+
+  for (int i = 0; i < thread_count; i++) {
+    workers[i].osr = osr;
+    workers[i].pass_timer = timer;
+    workers[i].offset = i;
+    workers[i].latencies = g_new(double, reads->len / thread_count + 1);
+    workers[i].thread = g_thread_create(worker_func, &workers[i],
+                                        TRUE, NULL);
+    if (!workers[i].thread) {
+      common_fail("Couldn't start thread");
+    }
+  }
+
+  // gather latencies
+  double *latencies = g_new(double, reads->len);
+  int nlatencies = 0;
+  for (int i = 0; i < thread_count; i++) {
+    g_thread_join(workers[i].thread);
+    memcpy(latencies + nlatencies, workers[i].latencies,
+           workers[i].nlatencies * sizeof(double));
+    nlatencies += workers[i].nlatencies;
+    g_free(workers[i].latencies);
+  }
+  double elapsed = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+  g_free(workers);
+
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    common_fail("Read failed: %s", err);
+  }
+
+  qsort(latencies, nlatencies, sizeof(double), compare_doubles);
+  double p50 = latencies[nlatencies / 2];
+  double p90 = latencies[MIN(nlatencies * 90 / 100, nlatencies - 1)];
+  double p99 = latencies[MIN(nlatencies * 99 / 100, nlatencies - 1)];
+  double worst = latencies[nlatencies - 1];
+
+  int64_t hits = openslide_get_statistic(osr, "cache.hits") - start_hits;
+  int64_t misses = openslide_get_statistic(osr, "cache.misses") -
+                   start_misses;
+  double hit_rate = hits + misses ? 100.0 * hits / (hits + misses) : 0;
+
+  printf("pass %d: %d reads in %.3f s -> %.1f reads/s, "
+         "p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms, "
+         "cache hit rate %.1f%%\n",
+         pass, nlatencies, elapsed, nlatencies / elapsed,
+         p50 * 1000, p90 * 1000, p99 * 1000, worst * 1000, hit_rate);
+
+  g_free(latencies);
+}
+
+int main(int argc, char **argv) {
+  GError *tmp_err = NULL;
+
+  GOptionContext *ctx =
+    g_option_context_new("TRACE SLIDE - replay a captured access trace");
+  g_option_context_add_main_entries(ctx, options, NULL);
+  if (!common_parse_options(ctx, &argc, &argv, &tmp_err)) {
+    common_fail("%s", tmp_err->message);
+  }
+  g_option_context_free(ctx);
+  if (argc != 3) {
+    common_fail("Usage: replay [OPTION...] TRACE SLIDE");
+  }
+
+  if (thread_count < 1 || pass_count < 1) {
+    common_fail("Invalid parameter");
+  }
+  if (timing) {
+    if (!strcmp(timing, "paced")) {
+      paced = TRUE;
+    } else if (strcmp(timing, "asap")) {
+      common_fail("Unknown timing mode \"%s\"", timing);
+    }
+  }
+
+  load_trace(argv[1]);
+
+  if (cache_mb >= 0) {
+    openslide_set_cache_size(cache_mb << 20);
+  }
+
+  openslide_t *osr = openslide_open(argv[2]);
+  if (!osr) {
+    common_fail("Couldn't open %s", argv[2]);
+  }
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    common_fail("Open failed: %s", err);
+  }
+
+  for (int pass = 1; pass <= pass_count; pass++) {
+    run_pass(osr, pass);
+  }
+
+  openslide_close(osr);
+  g_array_free(reads, TRUE);
+  return 0;
+}
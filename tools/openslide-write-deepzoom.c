@@ -0,0 +1,312 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide.h"
+#include "openslide-common.h"
+
+#include <png.h>
+#include <cairo.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Tiles are read in batches through openslide_read_regions, so decode
+// runs in parallel on the library's executor while memory stays bounded
+// at BATCH_TILES source buffers.
+#define BATCH_TILES 64
+
+static const char IMAGE_NAME[] = "image";
+
+struct tile_job {
+  int64_t col;
+  int64_t row;
+  int32_t dz_w;     // tile size in DeepZoom pixels
+  int32_t dz_h;
+  int64_t src_w;    // source read size in slide level pixels
+  int64_t src_h;
+  uint32_t *buf;
+};
+
+static void fail_on_error(openslide_t *osr) {
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    common_fail("%s", err);
+  }
+}
+
+// write one unpremultiplied RGBA PNG from premultiplied ARGB data
+static void write_png_tile(const char *path,
+                           const uint32_t *data, int64_t stride_pixels,
+                           int32_t w, int32_t h) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    common_fail("Can't create %s", path);
+  }
+
+  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                                                NULL, NULL, NULL);
+  png_infop info_ptr = NULL;
+  if (png_ptr) {
+    info_ptr = png_create_info_struct(png_ptr);
+  }
+  if (!info_ptr) {
+    common_fail("Could not initialize PNG");
+  }
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    common_fail("Error writing %s", path);
+  }
+  png_init_io(png_ptr, f);
+  png_set_IHDR(png_ptr, info_ptr, w, h, 8,
+               PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png_ptr, info_ptr);
+
+  uint32_t *row_buf = g_malloc(w * 4);
+  for (int32_t y = 0; y < h; y++) {
+    const uint32_t *row = data + y * stride_pixels;
+    // un-premultiply alpha and pack into expected format
+    for (int32_t i = 0; i < w; i++) {
+      uint32_t p = row[i];
+      uint8_t *p8 = (uint8_t *) (row_buf + i);
+
+      uint8_t a = (p >> 24) & 0xFF;
+      uint8_t r = (p >> 16) & 0xFF;
+      uint8_t g = (p >> 8) & 0xFF;
+      uint8_t b = p & 0xFF;
+
+      switch (a) {
+      case 0:
+        r = 0;
+        g = 0;
+        b = 0;
+        break;
+
+      case 255:
+        // no action
+        break;
+
+      default:
+        r = (r * 255 + a / 2) / a;
+        g = (g * 255 + a / 2) / a;
+        b = (b * 255 + a / 2) / a;
+        break;
+      }
+
+      p8[0] = r;
+      p8[1] = g;
+      p8[2] = b;
+      p8[3] = a;
+    }
+    png_write_row(png_ptr, (png_bytep) row_buf);
+  }
+  g_free(row_buf);
+
+  png_write_end(png_ptr, info_ptr);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  fclose(f);
+}
+
+// scale a source buffer to tile size through cairo, then write the PNG
+static void emit_tile(const char *level_dir, struct tile_job *job) {
+  char *path = g_strdup_printf("%s/%"PRId64"_%"PRId64".png",
+                               level_dir, job->col, job->row);
+
+  if (job->src_w == job->dz_w && job->src_h == job->dz_h) {
+    // already at DeepZoom resolution
+    write_png_tile(path, job->buf, job->src_w, job->dz_w, job->dz_h);
+  } else {
+    cairo_surface_t *src =
+      cairo_image_surface_create_for_data((unsigned char *) job->buf,
+                                          CAIRO_FORMAT_ARGB32,
+                                          job->src_w, job->src_h,
+                                          job->src_w * 4);
+    cairo_surface_t *dst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                      job->dz_w, job->dz_h);
+    cairo_t *cr = cairo_create(dst);
+    cairo_scale(cr,
+                (double) job->dz_w / job->src_w,
+                (double) job->dz_h / job->src_h);
+    cairo_set_source_surface(cr, src, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(src);
+
+    cairo_surface_flush(dst);
+    write_png_tile(path,
+                   (const uint32_t *) cairo_image_surface_get_data(dst),
+                   cairo_image_surface_get_stride(dst) / 4,
+                   job->dz_w, job->dz_h);
+    cairo_surface_destroy(dst);
+  }
+
+  g_free(path);
+}
+
+static void flush_batch(openslide_t *osr,
+                        const char *level_dir,
+                        openslide_region_t *regions,
+                        struct tile_job *jobs,
+                        int32_t count) {
+  openslide_read_regions(osr, regions, count);
+  fail_on_error(osr);
+  for (int32_t i = 0; i < count; i++) {
+    emit_tile(level_dir, &jobs[i]);
+    g_free(jobs[i].buf);
+  }
+}
+
+static void write_dz_level(openslide_t *osr,
+                           const char *files_dir,
+                           int32_t dz_level,
+                           double dz_downsample,
+                           int64_t dz_w, int64_t dz_h,
+                           int32_t tile_size) {
+  char *level_dir = g_strdup_printf("%s/%d", files_dir, dz_level);
+  if (g_mkdir_with_parents(level_dir, 0777)) {
+    common_fail("Can't create %s", level_dir);
+  }
+
+  // read from the slide level closest to this DeepZoom level
+  int32_t level =
+    openslide_get_best_level_for_downsample(osr, dz_downsample);
+  double level_downsample = openslide_get_level_downsample(osr, level);
+  fail_on_error(osr);
+  // slide level pixels per DeepZoom pixel
+  double ratio = dz_downsample / level_downsample;
+
+  int64_t cols = (dz_w + tile_size - 1) / tile_size;
+  int64_t rows = (dz_h + tile_size - 1) / tile_size;
+
+  openslide_region_t regions[BATCH_TILES];
+  struct tile_job jobs[BATCH_TILES];
+  int32_t pending = 0;
+
+  for (int64_t row = 0; row < rows; row++) {
+    for (int64_t col = 0; col < cols; col++) {
+      struct tile_job *job = &jobs[pending];
+      job->col = col;
+      job->row = row;
+      job->dz_w = MIN(dz_w - col * tile_size, tile_size);
+      job->dz_h = MIN(dz_h - row * tile_size, tile_size);
+      job->src_w = MAX((int64_t) ceil(job->dz_w * ratio), 1);
+      job->src_h = MAX((int64_t) ceil(job->dz_h * ratio), 1);
+      job->buf = g_malloc(job->src_w * job->src_h * 4);
+
+      openslide_region_t *region = &regions[pending];
+      region->x = (int64_t) (col * tile_size * dz_downsample);
+      region->y = (int64_t) (row * tile_size * dz_downsample);
+      region->level = level;
+      region->w = job->src_w;
+      region->h = job->src_h;
+      region->dest = job->buf;
+
+      if (++pending == BATCH_TILES) {
+        flush_batch(osr, level_dir, regions, jobs, pending);
+        pending = 0;
+      }
+    }
+  }
+  if (pending) {
+    flush_batch(osr, level_dir, regions, jobs, pending);
+  }
+
+  g_free(level_dir);
+}
+
+static void write_dzi(const char *path,
+                      int64_t w, int64_t h, int32_t tile_size) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    common_fail("Can't create %s", path);
+  }
+  fprintf(f,
+          "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\"\n"
+          "       TileSize=\"%d\" Overlap=\"0\" Format=\"png\">\n"
+          "  <Size Width=\"%"PRId64"\" Height=\"%"PRId64"\"/>\n"
+          "</Image>\n",
+          tile_size, w, h);
+  fclose(f);
+}
+
+static const struct common_usage_info usage_info = {
+  "slide tile-size output-dir",
+  "Convert a virtual slide to a DeepZoom tile pyramid.",
+};
+
+int main(int argc, char **argv) {
+  common_parse_commandline(&usage_info, &argc, &argv);
+  if (argc != 4) {
+    common_usage(&usage_info);
+  }
+
+  const char *slide = argv[1];
+  int32_t tile_size = strtol(argv[2], NULL, 10);
+  const char *output_dir = argv[3];
+
+  if (tile_size <= 0 || tile_size > 4096) {
+    common_fail("tile-size must be between 1 and 4096");
+  }
+
+  openslide_t *osr = openslide_open(slide);
+  if (osr == NULL) {
+    common_fail("%s: Not a file that OpenSlide can recognize", slide);
+  }
+  fail_on_error(osr);
+
+  int64_t w, h;
+  openslide_get_level0_dimensions(osr, &w, &h);
+  fail_on_error(osr);
+
+  if (g_mkdir_with_parents(output_dir, 0777)) {
+    common_fail("Can't create %s", output_dir);
+  }
+
+  char *dzi_path = g_strdup_printf("%s/%s.dzi", output_dir, IMAGE_NAME);
+  write_dzi(dzi_path, w, h, tile_size);
+  g_free(dzi_path);
+
+  char *files_dir = g_strdup_printf("%s/%s_files", output_dir, IMAGE_NAME);
+
+  // DeepZoom level n has downsample 2^(max_level - n); level 0 is 1x1
+  int32_t max_level = 0;
+  while ((MAX(w, h) >> max_level) > 1) {
+    max_level++;
+  }
+
+  for (int32_t dz_level = max_level; dz_level >= 0; dz_level--) {
+    double dz_downsample = pow(2, max_level - dz_level);
+    int64_t dz_w = MAX((int64_t) ceil(w / dz_downsample), 1);
+    int64_t dz_h = MAX((int64_t) ceil(h / dz_downsample), 1);
+    write_dz_level(osr, files_dir, dz_level, dz_downsample,
+                   dz_w, dz_h, tile_size);
+  }
+
+  g_free(files_dir);
+  openslide_close(osr);
+  return 0;
+}
@@ -35,6 +35,10 @@
 static const char SOFTWARE[] = "Software";
 static const char OPENSLIDE[] = "OpenSlide <https://openslide.org/>";
 
+// rows per openslide_read_region call; two bands are in flight at once,
+// so memory stays bounded regardless of region height
+#define BAND_HEIGHT 256
+
 #define ENSURE_NONNEG(i) \
   if (i < 0) {					\
     fail(#i " must be non-negative");	\
@@ -59,9 +63,64 @@ static void fail(const char *format, ...) {
 }
 
 
+struct band_read {
+  openslide_t *osr;
+  uint32_t *buf;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int32_t w;
+  int32_t h;
+};
+
+static gpointer read_band_thread(gpointer data) {
+  struct band_read *br = data;
+  openslide_read_region(br->osr, br->buf, br->x, br->y, br->level,
+			br->w, br->h);
+  return NULL;
+}
+
+// un-premultiply alpha and pack into expected format
+static void unpremultiply_row(uint32_t *row, int32_t w) {
+  for (int i = 0; i < w; i++) {
+    uint32_t p = row[i];
+    uint8_t *p8 = (uint8_t *) (row + i);
+
+    uint8_t a = (p >> 24) & 0xFF;
+    uint8_t r = (p >> 16) & 0xFF;
+    uint8_t g = (p >> 8) & 0xFF;
+    uint8_t b = p & 0xFF;
+
+    switch (a) {
+    case 0:
+      r = 0;
+      b = 0;
+      g = 0;
+      break;
+
+    case 255:
+      // no action
+      break;
+
+    default:
+      r = (r * 255 + a / 2) / a;
+      g = (g * 255 + a / 2) / a;
+      b = (b * 255 + a / 2) / a;
+      break;
+    }
+
+    // write back
+    p8[0] = r;
+    p8[1] = g;
+    p8[2] = b;
+    p8[3] = a;
+  }
+}
+
 static void write_png(openslide_t *osr, FILE *f,
 		      int64_t x, int64_t y, int32_t level,
-		      int32_t w, const int32_t h) {
+		      int32_t w, const int32_t h,
+		      int32_t compression) {
   png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
 						NULL, NULL, NULL);
   if (!png_ptr) {
@@ -107,64 +166,64 @@ static void write_png(openslide_t *osr, FILE *f,
     png_set_bKGD(png_ptr, info_ptr, &background);
   }
 
+  if (compression >= 0) {
+    png_set_compression_level(png_ptr, compression);
+  }
+
   // start writing
   png_write_info(png_ptr, info_ptr);
 
-  uint32_t *dest = g_malloc(w * 4);
-  int32_t lines_to_draw = h;
   double ds = openslide_get_level_downsample(osr, level);
-  int32_t yy = y / ds;
-  while (lines_to_draw) {
-    openslide_read_region(osr, dest,
-			  x, yy * ds, level, w, 1);
+  int64_t yy = y / ds;
+
+  int32_t band_h = MIN(h, BAND_HEIGHT);
+  int32_t band_count = (h + band_h - 1) / band_h;
+  uint32_t *bufs[2] = { g_malloc((int64_t) w * band_h * 4),
+			g_malloc((int64_t) w * band_h * 4) };
+
+  // read bands on a helper thread, so band N+1's region read overlaps
+  // band N's PNG encode
+  struct band_read br = {
+    .osr = osr,
+    .buf = bufs[0],
+    .x = x,
+    .y = yy * ds,
+    .level = level,
+    .w = w,
+    .h = band_h,
+  };
+  GThread *reader = g_thread_create(read_band_thread, &br, TRUE, NULL);
+
+  for (int32_t band = 0; band < band_count; band++) {
+    g_thread_join(reader);
+    reader = NULL;
 
     const char *err = openslide_get_error(osr);
     if (err) {
       fail("%s", err);
     }
 
-    // un-premultiply alpha and pack into expected format
-    for (int i = 0; i < w; i++) {
-      uint32_t p = dest[i];
-      uint8_t *p8 = (uint8_t *) (dest + i);
-
-      uint8_t a = (p >> 24) & 0xFF;
-      uint8_t r = (p >> 16) & 0xFF;
-      uint8_t g = (p >> 8) & 0xFF;
-      uint8_t b = p & 0xFF;
-
-      switch (a) {
-      case 0:
-	r = 0;
-	b = 0;
-	g = 0;
-	break;
-
-      case 255:
-	// no action
-	break;
-
-      default:
-	r = (r * 255 + a / 2) / a;
-	g = (g * 255 + a / 2) / a;
-	b = (b * 255 + a / 2) / a;
-	break;
-      }
-
-      // write back
-      p8[0] = r;
-      p8[1] = g;
-      p8[2] = b;
-      p8[3] = a;
+    uint32_t *buf = bufs[band % 2];
+    int32_t rows = MIN(h - band * band_h, band_h);
+
+    // start the next band
+    if (band + 1 < band_count) {
+      br.buf = bufs[(band + 1) % 2];
+      br.y = (yy + (int64_t) (band + 1) * band_h) * ds;
+      br.h = MIN(h - (band + 1) * band_h, band_h);
+      reader = g_thread_create(read_band_thread, &br, TRUE, NULL);
     }
 
-    png_write_row(png_ptr, (png_bytep) dest);
-    yy++;
-    lines_to_draw--;
+    for (int32_t row = 0; row < rows; row++) {
+      uint32_t *line = buf + (int64_t) row * w;
+      unpremultiply_row(line, w);
+      png_write_row(png_ptr, (png_bytep) line);
+    }
   }
 
   // end
-  g_free(dest);
+  g_free(bufs[0]);
+  g_free(bufs[1]);
   g_free(key);
   g_free(text);
   png_write_end(png_ptr, info_ptr);
@@ -173,13 +232,13 @@ static void write_png(openslide_t *osr, FILE *f,
 
 
 static const struct common_usage_info usage_info = {
-  "slide x y level width height output.png",
+  "slide x y level width height output.png [compression-level]",
   "Write a region of a virtual slide to a PNG.",
 };
 
 int main (int argc, char **argv) {
   common_parse_commandline(&usage_info, &argc, &argv);
-  if (argc != 8) {
+  if (argc != 8 && argc != 9) {
     common_usage(&usage_info);
   }
 
@@ -192,6 +251,16 @@ int main (int argc, char **argv) {
   int64_t height = g_ascii_strtoll(argv[6], NULL, 10);
   const char *output = argv[7];
 
+  // optional zlib compression level; 1 is usually the right choice for
+  // large QA exports
+  int32_t compression = -1;
+  if (argc == 9) {
+    compression = strtol(argv[8], NULL, 10);
+    if (compression < 0 || compression > 9) {
+      fail("compression-level must be between 0 and 9");
+    }
+  }
+
   // open slide
   openslide_t *osr = openslide_open(slide);
 
@@ -227,7 +296,7 @@ int main (int argc, char **argv) {
 	 strerror(errno));
   }
 
-  write_png(osr, png, x, y, level, width, height);
+  write_png(osr, png, x, y, level, width, height, compression);
 
   fclose(png);
   openslide_close(osr);